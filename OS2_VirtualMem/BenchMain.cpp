@@ -0,0 +1,885 @@
+#include <iostream>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "IntegralTypes.hpp"
+#include "KernelSystem.hpp"
+#include "FreeFrameStore.hpp"
+#include "FrameScan.hpp"
+#include "Platform.hpp"
+#include "Process.h"
+#include "Part.h"
+#include "Macros.hpp"
+#include "VmDecl.hpp"
+
+// Benchmarks of the kernel, run through bench_main(). Each benchmark builds
+// its own KernelSystem so that configurations can be compared side by side.
+
+using namespace std::chrono;
+
+static char *bench_align(char *ptr) {
+
+    std::uintptr_t addr = reinterpret_cast<std::uintptr_t>(ptr);
+
+    addr = (addr + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+
+    return reinterpret_cast<char*>(addr);
+
+    }
+
+// Access an address the way the test harness does: on PAGE_FAULT, let the
+// process handle the fault and retry once.
+static Status bench_touch(KernelSystem &sys, Process *proc, VirtualAddress addr, AccessType type) {
+
+    Status status = sys.access(proc->getProcessId(), addr, type);
+
+    if (status == PAGE_FAULT) {
+
+        proc->pageFault(addr);
+
+        status = sys.access(proc->getProcessId(), addr, type);
+
+        }
+
+    return status;
+
+    }
+
+// Several processes, each with a segment spanning whole L1 slots, under
+// kernel-space pressure. With large pages the page tables disappear once
+// their spans are promoted, so kernel-space swap-ins should drop sharply.
+static void bench_superpages(bool huge) {
+
+    const PageNum US_SIZE = 2048;
+    const PageNum KS_SIZE = 60;
+    const int     N_PROC  = 3;
+    const PageNum SEG_SIZE = 2 * VmConfig::PTL2_ENTRIES;
+    const int     ROUNDS  = 100000;
+
+    char *us_raw = new char[(US_SIZE + 1) * PAGE_SIZE];
+    char *ks_raw = new char[(KS_SIZE + 1) * PAGE_SIZE];
+
+    Partition part("partition1.ini");
+
+    KernelSystem sys(bench_align(us_raw), US_SIZE, bench_align(ks_raw), KS_SIZE, &part, huge);
+
+    Process *proc[N_PROC];
+
+    for (int p = 0; p < N_PROC; p += 1) {
+
+        proc[p] = sys.create_process();
+
+        proc[p]->createSegment(0, SEG_SIZE, READ_WRITE);
+
+        }
+
+    std::default_random_engine rng(42);
+    std::uniform_int_distribution<VirtualAddress> distribution(0, SEG_SIZE * PAGE_SIZE - 1);
+
+    auto start = high_resolution_clock::now();
+
+    for (int i = 0; i < ROUNDS; i += 1) {
+
+        Process *p = proc[i % N_PROC];
+
+        VirtualAddress addr = distribution(rng);
+
+        if (bench_touch(sys, p, addr, (i % 3) ? READ : WRITE) != OK) {
+
+            std::cout << "bench_superpages - Access failed.\n";
+
+            }
+
+        }
+
+    auto elapsed = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+
+    std::cout << "bench_superpages (huge = " << huge << "): " << ROUNDS << " accesses in "
+              << elapsed << " microsecs.\n";
+
+    sys.diag();
+
+    for (int p = 0; p < N_PROC; p += 1) {
+
+        delete proc[p];
+
+        }
+
+    delete [] us_raw;
+    delete [] ks_raw;
+
+    }
+
+// Many processes, each with a few small segments scattered over distinct L1
+// slots, so that every process needs several mostly empty page tables. With
+// an inverted page table, resident pages are translated without the tables,
+// which can then stay swapped out.
+static void bench_sparse(TranslationMode::ModeEnum mode) {
+
+    const PageNum US_SIZE  = 1024;
+    const PageNum KS_SIZE  = 80;
+    const int     N_PROC   = 64;
+    const int     N_SEG    = 4;
+    const PageNum SEG_SIZE = 4;
+    const int     ROUNDS   = 200000;
+
+    char *us_raw = new char[(US_SIZE + 1) * PAGE_SIZE];
+    char *ks_raw = new char[(KS_SIZE + 1) * PAGE_SIZE];
+
+    Partition part("partition1.ini");
+
+    KernelSystem sys(bench_align(us_raw), US_SIZE, bench_align(ks_raw), KS_SIZE, &part, false, mode);
+
+    const VirtualAddress L1_SPAN = (VirtualAddress)1 << (VmConfig::ADDRESS_BITS - VmConfig::PTL1_BITS);
+
+    Process *proc[N_PROC];
+
+    for (int p = 0; p < N_PROC; p += 1) {
+
+        proc[p] = sys.create_process();
+
+        for (int s = 0; s < N_SEG; s += 1) {
+
+            proc[p]->createSegment(s * (VmConfig::PTL1_ENTRIES / N_SEG) * L1_SPAN, SEG_SIZE, READ_WRITE);
+
+            }
+
+        }
+
+    std::default_random_engine rng(42);
+    std::uniform_int_distribution<int> seg_dist(0, N_SEG - 1);
+    std::uniform_int_distribution<VirtualAddress> offset_dist(0, SEG_SIZE * PAGE_SIZE - 1);
+
+    auto start = high_resolution_clock::now();
+
+    for (int i = 0; i < ROUNDS; i += 1) {
+
+        // Processes take turns in bursts, as they would under a scheduler:
+        Process *p = proc[(i / 64) % N_PROC];
+
+        VirtualAddress addr = seg_dist(rng) * (VmConfig::PTL1_ENTRIES / N_SEG) * L1_SPAN + offset_dist(rng);
+
+        if (bench_touch(sys, p, addr, (i % 3) ? READ : WRITE) != OK) {
+
+            std::cout << "bench_sparse - Access failed.\n";
+
+            }
+
+        }
+
+
+    auto elapsed = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+
+    std::cout << "bench_sparse (inverted = " << (mode == TranslationMode::Inverted) << "): "
+              << ROUNDS << " accesses in " << elapsed << " microsecs.\n";
+
+    sys.diag();
+
+    for (int p = 0; p < N_PROC; p += 1) {
+
+        delete proc[p];
+
+        }
+
+    delete [] us_raw;
+    delete [] ks_raw;
+
+    }
+
+// Several processes touching the same pages, either through one shared
+// segment or through private segments of the same size. Shared pages are
+// translated through the connected process's own page table while they are
+// resident, so the two should cost about the same.
+static void bench_shared(bool shared) {
+
+    const PageNum US_SIZE  = 512;
+    const PageNum KS_SIZE  = 60;
+    const int     N_PROC   = 8;
+    const PageNum SEG_SIZE = 48;
+    const int     ROUNDS   = 400000;
+
+    char *us_raw = new char[(US_SIZE + 1) * PAGE_SIZE];
+    char *ks_raw = new char[(KS_SIZE + 1) * PAGE_SIZE];
+
+    Partition part("partition1.ini");
+
+    KernelSystem sys(bench_align(us_raw), US_SIZE, bench_align(ks_raw), KS_SIZE, &part);
+
+    Process *proc[N_PROC];
+
+    for (int p = 0; p < N_PROC; p += 1) {
+
+        proc[p] = sys.create_process();
+
+        if (shared) {
+
+            proc[p]->createSharedSegment(0, SEG_SIZE, "bench", READ_WRITE);
+
+            }
+        else {
+
+            proc[p]->createSegment(0, SEG_SIZE, READ_WRITE);
+
+            }
+
+        }
+
+    std::default_random_engine rng(42);
+    std::uniform_int_distribution<VirtualAddress> distribution(0, SEG_SIZE * PAGE_SIZE - 1);
+
+    auto start = high_resolution_clock::now();
+
+    for (int i = 0; i < ROUNDS; i += 1) {
+
+        Process *p = proc[i % N_PROC];
+
+        VirtualAddress addr = distribution(rng);
+
+        if (bench_touch(sys, p, addr, (i % 3) ? READ : WRITE) != OK) {
+
+            std::cout << "bench_shared - Access failed.\n";
+
+            }
+
+        }
+
+    auto elapsed = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+
+    std::cout << "bench_shared (shared = " << shared << "): " << ROUNDS << " accesses in "
+              << elapsed << " microsecs.\n";
+
+    sys.diag();
+
+    if (shared) {
+
+        proc[0]->deleteSharedSegment("bench");
+
+        }
+
+    for (int p = 0; p < N_PROC; p += 1) {
+
+        delete proc[p];
+
+        }
+
+    delete [] us_raw;
+    delete [] ks_raw;
+
+    }
+
+// Tens of thousands of named shared segments: each is created and touched
+// through one process and left in the registry, then segments are looked up
+// by name and connected at random, and finally all are deleted. A segment
+// costs no kernel space of its own.
+static void bench_sseg_registry() {
+
+    const PageNum US_SIZE  = 512;
+    const PageNum KS_SIZE  = 60;
+    const int     N_SSEG   = 20000;
+    const int     LOOKUPS  = 100000;
+
+    char *us_raw = new char[(US_SIZE + 1) * PAGE_SIZE];
+    char *ks_raw = new char[(KS_SIZE + 1) * PAGE_SIZE];
+
+    Partition part("partition1.ini");
+
+    KernelSystem sys(bench_align(us_raw), US_SIZE, bench_align(ks_raw), KS_SIZE, &part);
+
+    Process *proc = sys.create_process();
+
+    std::vector<std::string> names(N_SSEG);
+
+    for (int i = 0; i < N_SSEG; i += 1) {
+
+        names[i] = "bench_sseg_" + std::to_string(i);
+
+        }
+
+    auto start = high_resolution_clock::now();
+
+    for (int i = 0; i < N_SSEG; i += 1) {
+
+        if (proc->createSharedSegment(0, 1, names[i].c_str(), READ_WRITE) != OK ||
+            bench_touch(sys, proc, 0, WRITE) != OK) {
+
+            std::cout << "bench_sseg_registry - Create failed.\n";
+
+            break;
+
+            }
+
+        proc->disconnectSharedSegment(names[i].c_str());
+
+        }
+
+    auto created = high_resolution_clock::now();
+
+    std::default_random_engine rng(42);
+    std::uniform_int_distribution<int> distribution(0, N_SSEG - 1);
+
+    for (int i = 0; i < LOOKUPS; i += 1) {
+
+        const char *name = names[distribution(rng)].c_str();
+
+        proc->createSharedSegment(0, 1, name, READ_WRITE); // Connects to the existing segment
+
+        proc->disconnectSharedSegment(name);
+
+        }
+
+    auto looked_up = high_resolution_clock::now();
+
+    for (int i = 0; i < N_SSEG; i += 1) {
+
+        proc->deleteSharedSegment(names[i].c_str());
+
+        }
+
+    auto deleted = high_resolution_clock::now();
+
+    std::cout << "bench_sseg_registry: " << N_SSEG << " segments created in "
+              << duration_cast<microseconds>(created - start).count() << " microsecs, "
+              << LOOKUPS << " connects by name in "
+              << duration_cast<microseconds>(looked_up - created).count() << " microsecs, deleted in "
+              << duration_cast<microseconds>(deleted - looked_up).count() << " microsecs.\n";
+
+    sys.diag();
+
+    delete proc;
+
+    delete [] us_raw;
+    delete [] ks_raw;
+
+    }
+
+// Fork/exit churn: processes are created (or cloned from a parent with a
+// private and a shared segment) and destroyed right away, so the cost is in
+// setting up and tearing down their control blocks.
+static void bench_process_churn() {
+
+    const PageNum US_SIZE  = 512;
+    const PageNum KS_SIZE  = 60;
+    const PageNum SEG_SIZE = 8;
+    const int     ROUNDS   = 100000;
+
+    char *us_raw = new char[(US_SIZE + 1) * PAGE_SIZE];
+    char *ks_raw = new char[(KS_SIZE + 1) * PAGE_SIZE];
+
+    Partition part("partition1.ini");
+
+    KernelSystem sys(bench_align(us_raw), US_SIZE, bench_align(ks_raw), KS_SIZE, &part);
+
+    auto start = high_resolution_clock::now();
+
+    for (int i = 0; i < ROUNDS; i += 1) {
+
+        Process *proc = sys.create_process();
+
+        delete proc;
+
+        }
+
+    auto created = high_resolution_clock::now();
+
+    Process *parent = sys.create_process();
+
+    parent->createSegment(0, SEG_SIZE, READ_WRITE);
+    parent->createSharedSegment(SEG_SIZE * PAGE_SIZE, SEG_SIZE, "bench_churn", READ_WRITE);
+
+    for (PageNum p = 0; p < 2 * SEG_SIZE; p += 1) {
+
+        bench_touch(sys, parent, p * PAGE_SIZE, WRITE);
+
+        }
+
+    auto set_up = high_resolution_clock::now();
+
+    for (int i = 0; i < ROUNDS; i += 1) {
+
+        Process *child = sys.clone_process(parent->getProcessId());
+
+        delete child;
+
+        }
+
+    auto cloned = high_resolution_clock::now();
+
+    std::cout << "bench_process_churn: " << ROUNDS << " creates/destroys in "
+              << duration_cast<microseconds>(created - start).count() << " microsecs, "
+              << ROUNDS << " clones/destroys in "
+              << duration_cast<microseconds>(cloned - set_up).count() << " microsecs.\n";
+
+    sys.diag();
+
+    parent->deleteSharedSegment("bench_churn");
+
+    delete parent;
+
+    delete [] us_raw;
+    delete [] ks_raw;
+
+    }
+
+// Swap traffic of many-page operations: clusters moved one per call and
+// DISK_BATCH per call straight through the partition, then clones of a
+// process whose pages are mostly swapped out, which read them back in batches.
+static void bench_cluster_io() {
+
+    const ClusterNo CLUSTERS = 16384;
+    const ClusterNo BATCH    = (ClusterNo)KernelSystem::DISK_BATCH;
+    const PageNum   US_SIZE  = 256;
+    const PageNum   KS_SIZE  = 60;
+    const PageNum   SEG_SIZE = 2048;
+    const int       ROUNDS   = 50;
+
+    char *us_raw = new char[(US_SIZE + 1) * PAGE_SIZE];
+    char *ks_raw = new char[(KS_SIZE + 1) * PAGE_SIZE];
+
+    Partition part("partition1.ini");
+
+    std::vector<char> buffer(BATCH * ClusterSize, 'x');
+    std::vector<ClusterIo> io(BATCH);
+
+    auto start = high_resolution_clock::now();
+
+    for (ClusterNo c = 0; c < CLUSTERS; c += 1) {
+
+        part.writeCluster(c, buffer.data() + (c % BATCH) * ClusterSize);
+
+        }
+
+    for (ClusterNo c = 0; c < CLUSTERS; c += 1) {
+
+        part.readCluster(c, buffer.data() + (c % BATCH) * ClusterSize);
+
+        }
+
+    auto single = high_resolution_clock::now();
+
+    for (ClusterNo c = 0; c < CLUSTERS; c += BATCH) {
+
+        for (ClusterNo j = 0; j < BATCH; j += 1) {
+
+            io[j].cluster = c + j;
+            io[j].buffer  = buffer.data() + j * ClusterSize;
+
+            }
+
+        part.writeClusters(io.data(), BATCH);
+        part.readClusters(io.data(), BATCH);
+
+        }
+
+    auto vectored = high_resolution_clock::now();
+
+    std::cout << "bench_cluster_io: " << CLUSTERS << " clusters written and read one per call in "
+              << duration_cast<microseconds>(single - start).count() << " microsecs, "
+              << BATCH << " per call in "
+              << duration_cast<microseconds>(vectored - single).count() << " microsecs.\n";
+
+    KernelSystem sys(bench_align(us_raw), US_SIZE, bench_align(ks_raw), KS_SIZE, &part);
+
+    Process *parent = sys.create_process();
+
+    parent->createSegment(0, SEG_SIZE, READ_WRITE);
+
+    for (PageNum p = 0; p < SEG_SIZE; p += 1) {
+
+        bench_touch(sys, parent, p * PAGE_SIZE, WRITE);
+
+        }
+
+    start = high_resolution_clock::now();
+
+    for (int i = 0; i < ROUNDS; i += 1) {
+
+        Process *child = sys.clone_process(parent->getProcessId());
+
+        delete child;
+
+        }
+
+    std::cout << "bench_cluster_io: " << ROUNDS << " clones of a " << SEG_SIZE << "-page process in "
+              << duration_cast<microseconds>(high_resolution_clock::now() - start).count() << " microsecs.\n";
+
+    sys.diag();
+
+    delete parent;
+
+    delete [] us_raw;
+    delete [] ks_raw;
+
+    }
+
+// Swap-heavy random writes with swap on one partition, or striped over two
+// of equal priority (partition1.ini and partition2.ini).
+static void bench_swap_devices(bool striped) {
+
+    const PageNum US_SIZE  = 256;
+    const PageNum KS_SIZE  = 80;
+    const PageNum SEG_SIZE = 4096;
+    const int     ROUNDS   = 100000;
+
+    char *us_raw = new char[(US_SIZE + 1) * PAGE_SIZE];
+    char *ks_raw = new char[(KS_SIZE + 1) * PAGE_SIZE];
+
+    Partition part1("partition1.ini");
+    Partition part2("partition2.ini");
+
+    std::vector<SwapArea> areas;
+
+    areas.push_back(SwapArea{ &part1, 0 });
+
+    if (striped) areas.push_back(SwapArea{ &part2, 0 });
+
+    KernelSystem sys(bench_align(us_raw), US_SIZE, bench_align(ks_raw), KS_SIZE, areas);
+
+    Process *proc = sys.create_process();
+
+    proc->createSegment(0, SEG_SIZE, READ_WRITE);
+
+    std::default_random_engine rng(42);
+    std::uniform_int_distribution<VirtualAddress> distribution(0, SEG_SIZE * PAGE_SIZE - 1);
+
+    auto start = high_resolution_clock::now();
+
+    for (int i = 0; i < ROUNDS; i += 1) {
+
+        if (bench_touch(sys, proc, distribution(rng), WRITE) != OK) {
+
+            std::cout << "bench_swap_devices - Access failed.\n";
+
+            }
+
+        }
+
+    auto elapsed = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+
+    std::cout << "bench_swap_devices (striped = " << striped << "): " << ROUNDS << " accesses in "
+              << elapsed << " microsecs.\n";
+
+    sys.diag();
+
+    delete proc;
+
+    delete [] us_raw;
+    delete [] ks_raw;
+
+    }
+
+// Frame allocation churn from several threads at once, each taking a handful
+// of frames and giving them back, with and without per-thread magazines in
+// front of the shared lists. Fails if a frame is handed out twice or is not
+// back in the store after (take_run also drains the magazines).
+static bool bench_free_frames(bool cached) {
+
+    const PageNum FRAMES  = 16384;
+    const int     THREADS = 4;
+    const int     HELD    = 8;
+    const int     ROUNDS  = 200000;
+
+    char *raw = new char[(FRAMES + 1) * PAGE_SIZE];
+    char *base = bench_align(raw);
+
+    std::unique_ptr<std::atomic<bool>[]> taken(new std::atomic<bool>[FRAMES]);
+
+    for (PageNum i = 0; i < FRAMES; i += 1) taken[i].store(false, std::memory_order_relaxed);
+
+    std::atomic<size_t> failures(0);
+
+    FreeFrameStore store;
+
+    store.init(base, FRAMES, cached);
+
+    auto start = high_resolution_clock::now();
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < THREADS; t += 1) {
+
+        threads.emplace_back([&]() {
+
+            PageAnte *held[HELD];
+
+            for (int i = 0; i < ROUNDS; i += 1) {
+
+                for (int j = 0; j < HELD; j += 1) {
+
+                    held[j] = store.acquire();
+
+                    if (held[j] == nullptr || taken[((char*)held[j] - base) / PAGE_SIZE].exchange(true)) failures += 1;
+
+                    }
+
+                for (int j = 0; j < HELD; j += 1) {
+
+                    if (held[j] == nullptr) continue;
+
+                    taken[((char*)held[j] - base) / PAGE_SIZE].store(false);
+
+                    store.release(held[j]);
+
+                    }
+
+                }
+
+            });
+
+        }
+
+    for (auto &thread : threads) thread.join();
+
+    auto elapsed = duration_cast<microseconds>(high_resolution_clock::now() - start).count();
+
+    size_t free_after = store.count();
+
+    bool all_back = store.take_run(0, FRAMES) && store.count() == 0;
+
+    std::cout << "bench_free_frames (cached = " << cached << "): " << THREADS << " threads x "
+              << ROUNDS * HELD << " acquires/releases in " << elapsed << " microsecs, "
+              << free_after << " / " << FRAMES << " frames free after.\n";
+
+    if (failures > 0 || !all_back) {
+
+        std::cout << "bench_free_frames - " << failures << " failed or repeated acquires, "
+                  << (all_back ? "all" : "not all") << " frames back.\n";
+
+        }
+
+    delete [] raw;
+
+    return failures == 0 && all_back;
+
+    }
+
+// The frame-table scans at each instruction set level, over tables far
+// larger than the test configurations: a search for a victim that has to
+// pass every locked frame, an aging pass and a count of dirty frames.
+static void bench_frame_scan() {
+
+    const size_t SIZES[] = { 10000, 100000, 1000000 };
+    const size_t WORK    = 100000000; // Frames scanned per measurement
+
+    const Uint8 LOCKED = (1 << FrameTable::Locked);
+    const Uint8 DIRTY  = (1 << FrameTable::Dirty);
+
+    for (size_t n : SIZES) {
+
+        Uint8 *flags = static_cast<Uint8*>(plat::aligned_malloc(n, FrameTable::ALIGN));
+        Uint8 *ref   = static_cast<Uint8*>(plat::aligned_malloc(n, FrameTable::ALIGN));
+
+        std::default_random_engine rng(42);
+
+        for (size_t i = 0; i < n; i += 1) {
+
+            flags[i] = (rng() % 2) ? DIRTY : 0;
+            ref[i]   = (Uint8)rng();
+
+            }
+
+        // Only the last frame is both unlocked and unreferenced:
+        for (size_t i = 0; i + 1 < n; i += 1) flags[i] |= LOCKED;
+
+        ref[n - 1] = 0;
+
+        size_t rounds = WORK / n;
+
+        for (int l = fscan::IsaLevel::Scalar; l <= fscan::IsaLevel::Avx2; l += 1) {
+
+            auto level = fscan::set_level((fscan::IsaLevel::LevelEnum)l);
+
+            if (level != l) continue; // Not supported here
+
+            size_t sink = 0;
+
+            auto start = high_resolution_clock::now();
+
+            for (size_t r = 0; r < rounds; r += 1) sink += fscan::find_clear(flags, ref, LOCKED, 0, n);
+
+            auto found = high_resolution_clock::now();
+
+            for (size_t r = 0; r < rounds; r += 1) {
+
+                fscan::age(ref, n);
+
+                ref[r % n] |= FrameTable::REF_TOP; // Keeps the ages from settling at 0
+
+                }
+
+            auto aged = high_resolution_clock::now();
+
+            for (size_t r = 0; r < rounds; r += 1) sink += fscan::count_set(flags, DIRTY, n);
+
+            auto counted = high_resolution_clock::now();
+
+            std::cout << "bench_frame_scan (" << fscan::level_name(level) << ", " << n << " frames x " << rounds << "): find "
+                      << duration_cast<microseconds>(found - start).count() << " microsecs, age "
+                      << duration_cast<microseconds>(aged - found).count() << " microsecs, count "
+                      << duration_cast<microseconds>(counted - aged).count() << " microsecs (" << sink % 10 << ").\n";
+
+            }
+
+        plat::aligned_free(flags);
+        plat::aligned_free(ref);
+
+        }
+
+    fscan::set_level(fscan::IsaLevel::Avx2);
+
+    }
+
+// Checks the SSE2 and AVX2 scans against the scalar ones on random tables.
+// Lengths and starting points are mostly not multiples of the vector width,
+// and bytes past the end would match if read. Some tables are long and all
+// dirty, so count_set's byte counters fill up. Returns false on any
+// difference.
+static bool bench_frame_scan_check() {
+
+    const size_t MAX_FRAMES = 20000;
+    const int    TRIALS     = 4000;
+
+    const Uint8 LOCKED = (1 << FrameTable::Locked);
+    const Uint8 DIRTY  = (1 << FrameTable::Dirty);
+
+    const size_t padded = DIV_CEIL(MAX_FRAMES, FrameTable::ALIGN) * FrameTable::ALIGN;
+
+    Uint8 *flags = static_cast<Uint8*>(plat::aligned_malloc(padded, FrameTable::ALIGN));
+    Uint8 *ref   = static_cast<Uint8*>(plat::aligned_malloc(padded, FrameTable::ALIGN));
+    Uint8 *aged  = static_cast<Uint8*>(plat::aligned_malloc(padded, FrameTable::ALIGN));
+    Uint8 *want  = static_cast<Uint8*>(plat::aligned_malloc(padded, FrameTable::ALIGN));
+
+    std::default_random_engine rng(7);
+
+    size_t mismatches = 0;
+
+    for (int t = 0; t < TRIALS; t += 1) {
+
+        size_t n    = 1 + rng() % ((t % 16 == 0) ? MAX_FRAMES : 300);
+        size_t from = rng() % (n + 1);
+        size_t to   = from + rng() % (n - from + 1);
+
+        bool all_dirty  = (t % 3 == 0);
+        bool all_locked = (t % 8 == 0);
+
+        for (size_t i = 0; i < padded; i += 1) {
+
+            if (i >= n) { // Would match every scan
+
+                flags[i] = DIRTY;
+                ref[i]   = 0;
+
+                continue;
+
+                }
+
+            flags[i] = ((all_locked || rng() % 4) ? LOCKED : 0) | ((all_dirty || rng() % 2) ? DIRTY : 0);
+            ref[i]   = (rng() % 4) ? (Uint8)rng() : 0;
+
+            }
+
+        fscan::set_level(fscan::IsaLevel::Scalar);
+
+        size_t found = fscan::find_clear(flags, ref, LOCKED, from, to);
+        size_t count = fscan::count_set(flags, DIRTY, to);
+
+        std::memcpy(want, ref, padded);
+
+        fscan::age(want, to);
+
+        for (int l = fscan::IsaLevel::Sse2; l <= fscan::IsaLevel::Avx2; l += 1) {
+
+            auto level = fscan::set_level((fscan::IsaLevel::LevelEnum)l);
+
+            if (level != l) continue; // Not supported here
+
+            std::memcpy(aged, ref, padded);
+
+            fscan::age(aged, to);
+
+            size_t level_found = fscan::find_clear(flags, ref, LOCKED, from, to);
+            size_t level_count = fscan::count_set(flags, DIRTY, to);
+
+            bool same_age = (std::memcmp(aged, want, padded) == 0);
+
+            if (level_found != found || level_count != count || !same_age) {
+
+                if (mismatches < 10) {
+
+                    std::cout << "bench_frame_scan_check - " << fscan::level_name(level) << " differs from scalar (n = " << n
+                              << ", from = " << from << ", to = " << to << "): find " << level_found << "/" << found
+                              << ", count " << level_count << "/" << count << ", age " << (same_age ? "same" : "different") << ".\n";
+
+                    }
+
+                mismatches += 1;
+
+                }
+
+            }
+
+        }
+
+    fscan::set_level(fscan::IsaLevel::Avx2);
+
+    plat::aligned_free(flags);
+    plat::aligned_free(ref);
+    plat::aligned_free(aged);
+    plat::aligned_free(want);
+
+    std::cout << "bench_frame_scan_check: " << TRIALS << " random tables, " << mismatches << " mismatches.\n";
+
+    return mismatches == 0;
+
+    }
+
+int bench_main(int, char**) {
+
+    PRINT_SET_ACTIVE(false);
+
+    bench_superpages(false);
+    bench_superpages(true);
+
+    bench_sparse(TranslationMode::PageTables);
+    bench_sparse(TranslationMode::Inverted);
+
+    bench_shared(false);
+    bench_shared(true);
+
+    bench_sseg_registry();
+
+    bench_process_churn();
+
+    bench_cluster_io();
+
+    bench_swap_devices(false);
+    bench_swap_devices(true);
+
+    bool ok = true;
+
+    ok = bench_free_frames(false) && ok;
+    ok = bench_free_frames(true) && ok;
+
+    bench_frame_scan();
+
+    ok = bench_frame_scan_check() && ok;
+
+    return ok ? 0 : 1;
+
+    }
+
+#if defined(VM_BENCH_MAIN)
+
+int main(int argc, char **argv) {
+
+    return bench_main(argc, argv);
+
+    }
+
+#endif
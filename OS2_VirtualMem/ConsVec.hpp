@@ -56,7 +56,7 @@ namespace gen { // Start Generic namespace
 
     // =============================================== //
 
-    template<class T, class Alloc = std::allocator<T>> 
+    template<class T, class Alloc = std::allocator<CV_Elem<T>>> 
     class ConsVec {
 
         private:
@@ -144,7 +144,7 @@ namespace gen { // Start Generic namespace
                 
                 first_empty = CV_Elem<T>::EOL;
 
-                for (size_t i = elem_vec.size() - 1; i >= 0; i -= 1) {
+                for (size_t i = elem_vec.size(); i-- > 0; ) {
                     
                     elem_vec[i].next_empty = first_empty;
 
@@ -172,27 +172,23 @@ namespace gen { // Start Generic namespace
 
             void shrink_to_fit() {
                 
-                size_t i;
+                size_t n = elem_vec.size();
 
-                for (i = elem_vec.size() - 1; i >= 0; i -= 1) {
-                    
-                    if (!elem_vec[n].empty()) break;
-                    
-                    }
+                while (n > 1 && elem_vec[n - 1].empty()) n -= 1; // Keep at least one element
 
-                if (i == 0) return;
+                if (n == elem_vec.size()) return;
 
-                elem_vec.resize(i + 1);
+                while (elem_vec.size() > n) elem_vec.pop_back();
                 
                 first_empty = CV_Elem<T>::EOL;
 
-                for (i = elem_vec.size() - 1; i >=0; i -= 1) {
+                for (size_t i = elem_vec.size(); i-- > 0; ) {
 
                     if (elem_vec[i].empty()) {
 
                         elem_vec[i].next_empty = first_empty;
 
-                        first_empty = i;
+                        first_empty = (int)i;
 
                         }
 
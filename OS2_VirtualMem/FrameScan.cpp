@@ -0,0 +1,318 @@
+#include "FrameScan.hpp"
+#include "Platform.hpp"
+
+#include <atomic>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define FSCAN_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+// GCC and Clang build the wider versions for their own functions only, so
+// that the rest of the program still runs on any x86 processor:
+#if defined(FSCAN_X86) && (defined(__GNUC__) || defined(__clang__))
+#define FSCAN_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FSCAN_TARGET(isa)
+#endif
+
+namespace fscan { // Start Frame Scan namespace
+
+    namespace {
+
+        struct Kernels {
+
+            size_t (*find_clear)(const Uint8*, const Uint8*, Uint8, size_t, size_t);
+            void   (*age)(Uint8*, size_t);
+            size_t (*count_set)(const Uint8*, Uint8, size_t);
+
+            IsaLevel::LevelEnum level;
+
+            };
+
+        // Scalar:
+        size_t find_clear_scalar(const Uint8 *flags, const Uint8 *ref, Uint8 mask, size_t from, size_t to) {
+
+            for (size_t i = from; i < to; i += 1) {
+
+                if ((flags[i] & mask) == 0 && ref[i] == 0) return i;
+
+                }
+
+            return to;
+
+            }
+
+        void age_scalar(Uint8 *ref, size_t n) {
+
+            for (size_t i = 0; i < n; i += 1) ref[i] >>= 1;
+
+            }
+
+        size_t count_set_scalar(const Uint8 *flags, Uint8 mask, size_t n) {
+
+            size_t rv = 0;
+
+            for (size_t i = 0; i < n; i += 1) rv += ((flags[i] & mask) == mask);
+
+            return rv;
+
+            }
+
+        const Kernels SCALAR = { find_clear_scalar, age_scalar, count_set_scalar, IsaLevel::Scalar };
+
+    #if defined(FSCAN_X86)
+
+        // SSE2, 16 frames at a time; the rest go through the scalar versions:
+        FSCAN_TARGET("sse2")
+        size_t find_clear_sse2(const Uint8 *flags, const Uint8 *ref, Uint8 mask, size_t from, size_t to) {
+
+            const __m128i zero  = _mm_setzero_si128();
+            const __m128i vmask = _mm_set1_epi8((char)mask);
+
+            size_t i = from;
+
+            for (; i + 16 <= to; i += 16) {
+
+                __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(flags + i));
+                __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ref + i));
+
+                __m128i hit = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(f, vmask), zero),
+                                            _mm_cmpeq_epi8(r, zero));
+
+                Uint32 bits = (Uint32)_mm_movemask_epi8(hit);
+
+                if (bits != 0) return i + plat::bit_scan_forward(bits);
+
+                }
+
+            return find_clear_scalar(flags, ref, mask, i, to);
+
+            }
+
+        FSCAN_TARGET("sse2")
+        void age_sse2(Uint8 *ref, size_t n) {
+
+            const __m128i low7 = _mm_set1_epi8(0x7F); // There is no 8-bit shift
+
+            size_t i = 0;
+
+            for (; i + 16 <= n; i += 16) {
+
+                __m128i *p = reinterpret_cast<__m128i*>(ref + i);
+
+                _mm_storeu_si128(p, _mm_and_si128(_mm_srli_epi16(_mm_loadu_si128(p), 1), low7));
+
+                }
+
+            age_scalar(ref + i, n - i);
+
+            }
+
+        // Matches are counted bytewise (a match is -1) and summed up with
+        // SAD before the byte counters can overflow:
+        FSCAN_TARGET("sse2")
+        size_t count_set_sse2(const Uint8 *flags, Uint8 mask, size_t n) {
+
+            const __m128i zero  = _mm_setzero_si128();
+            const __m128i vmask = _mm_set1_epi8((char)mask);
+
+            __m128i sums = _mm_setzero_si128();
+
+            size_t i = 0;
+
+            while (i + 16 <= n) {
+
+                __m128i counts = _mm_setzero_si128();
+
+                for (size_t j = 0; j < 255 && i + 16 <= n; j += 1, i += 16) {
+
+                    __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(flags + i));
+
+                    counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_and_si128(f, vmask), vmask));
+
+                    }
+
+                sums = _mm_add_epi64(sums, _mm_sad_epu8(counts, zero));
+
+                }
+
+            size_t rv = (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+
+            return rv + count_set_scalar(flags + i, mask, n - i);
+
+            }
+
+        const Kernels SSE2 = { find_clear_sse2, age_sse2, count_set_sse2, IsaLevel::Sse2 };
+
+        // AVX2, 32 frames at a time:
+        FSCAN_TARGET("avx2")
+        size_t find_clear_avx2(const Uint8 *flags, const Uint8 *ref, Uint8 mask, size_t from, size_t to) {
+
+            const __m256i zero  = _mm256_setzero_si256();
+            const __m256i vmask = _mm256_set1_epi8((char)mask);
+
+            size_t i = from;
+
+            for (; i + 32 <= to; i += 32) {
+
+                __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(flags + i));
+                __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ref + i));
+
+                __m256i hit = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(f, vmask), zero),
+                                               _mm256_cmpeq_epi8(r, zero));
+
+                Uint32 bits = (Uint32)_mm256_movemask_epi8(hit);
+
+                if (bits != 0) return i + plat::bit_scan_forward(bits);
+
+                }
+
+            return find_clear_scalar(flags, ref, mask, i, to);
+
+            }
+
+        FSCAN_TARGET("avx2")
+        void age_avx2(Uint8 *ref, size_t n) {
+
+            const __m256i low7 = _mm256_set1_epi8(0x7F);
+
+            size_t i = 0;
+
+            for (; i + 32 <= n; i += 32) {
+
+                __m256i *p = reinterpret_cast<__m256i*>(ref + i);
+
+                _mm256_storeu_si256(p, _mm256_and_si256(_mm256_srli_epi16(_mm256_loadu_si256(p), 1), low7));
+
+                }
+
+            age_scalar(ref + i, n - i);
+
+            }
+
+        FSCAN_TARGET("avx2")
+        size_t count_set_avx2(const Uint8 *flags, Uint8 mask, size_t n) {
+
+            const __m256i zero  = _mm256_setzero_si256();
+            const __m256i vmask = _mm256_set1_epi8((char)mask);
+
+            __m256i sums = _mm256_setzero_si256();
+
+            size_t i = 0;
+
+            while (i + 32 <= n) {
+
+                __m256i counts = _mm256_setzero_si256();
+
+                for (size_t j = 0; j < 255 && i + 32 <= n; j += 1, i += 32) {
+
+                    __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(flags + i));
+
+                    counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_and_si256(f, vmask), vmask));
+
+                    }
+
+                sums = _mm256_add_epi64(sums, _mm256_sad_epu8(counts, zero));
+
+                }
+
+            __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+
+            size_t rv = (size_t)_mm_cvtsi128_si32(half) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+
+            return rv + count_set_scalar(flags + i, mask, n - i);
+
+            }
+
+        const Kernels AVX2 = { find_clear_avx2, age_avx2, count_set_avx2, IsaLevel::Avx2 };
+
+    #endif
+
+        std::atomic<const Kernels*> active(nullptr);
+
+        IsaLevel::LevelEnum supported() {
+
+        #if defined(FSCAN_X86)
+            return plat::cpu_has_avx2() ? IsaLevel::Avx2 : IsaLevel::Sse2;
+        #else
+            return IsaLevel::Scalar;
+        #endif
+
+            }
+
+        const Kernels *kernels() {
+
+            const Kernels *rv = active.load(std::memory_order_acquire);
+
+            if (rv == nullptr) {
+
+                set_level(IsaLevel::Avx2);
+
+                rv = active.load(std::memory_order_acquire);
+
+                }
+
+            return rv;
+
+            }
+
+        }
+
+    size_t find_clear(const Uint8 *flags, const Uint8 *ref, Uint8 mask, size_t from, size_t to) {
+
+        return kernels()->find_clear(flags, ref, mask, from, to);
+
+        }
+
+    void age(Uint8 *ref, size_t n) {
+
+        kernels()->age(ref, n);
+
+        }
+
+    size_t count_set(const Uint8 *flags, Uint8 mask, size_t n) {
+
+        return kernels()->count_set(flags, mask, n);
+
+        }
+
+    IsaLevel::LevelEnum level() {
+
+        return kernels()->level;
+
+        }
+
+    const char *level_name(IsaLevel::LevelEnum level) {
+
+        switch (level) {
+
+            case IsaLevel::Sse2: return "SSE2";
+            case IsaLevel::Avx2: return "AVX2";
+            default:             return "scalar";
+
+            }
+
+        }
+
+    IsaLevel::LevelEnum set_level(IsaLevel::LevelEnum level) {
+
+        IsaLevel::LevelEnum best = supported();
+
+        if (level > best) level = best;
+
+        const Kernels *table = &SCALAR;
+
+    #if defined(FSCAN_X86)
+        if (level == IsaLevel::Sse2) table = &SSE2;
+        if (level == IsaLevel::Avx2) table = &AVX2;
+    #endif
+
+        active.store(table, std::memory_order_release);
+
+        return level;
+
+        }
+
+    } // End Frame Scan namespace
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+
+#include "IntegralTypes.hpp"
+
+// Bulk scans over the byte arrays of a FrameTable. Each has a scalar, an
+// SSE2 and an AVX2 version; the widest one the processor supports is picked
+// on first use (SSE2 is always there on x86-64, off x86 only the scalar
+// versions are built).
+namespace fscan { // Start Frame Scan namespace
+
+    struct IsaLevel {
+
+        enum LevelEnum {
+
+            Scalar,
+            Sse2,
+            Avx2
+
+            };
+
+        };
+
+    // First i in [from, to) whose flags have no bit of mask set and whose
+    // reference history is 0, or to if there is none.
+    size_t find_clear(const Uint8 *flags, const Uint8 *ref, Uint8 mask, size_t from, size_t to);
+
+    // Shifts the reference history of n frames right by one (aging).
+    void age(Uint8 *ref, size_t n);
+
+    // Number of the first n frames with every bit of mask set in their flags.
+    size_t count_set(const Uint8 *flags, Uint8 mask, size_t n);
+
+    IsaLevel::LevelEnum level();
+    const char *level_name(IsaLevel::LevelEnum level);
+
+    // Makes the scans use the given level, or the widest supported one below
+    // it; returns the level in use. Meant for benchmarks and tests.
+    IsaLevel::LevelEnum set_level(IsaLevel::LevelEnum level);
+
+    } // End Frame Scan namespace
@@ -0,0 +1,364 @@
+#include "FreeFrameStore.hpp"
+#include "Macros.hpp"
+#include "Platform.hpp"
+
+#include <iostream>
+#include <new>
+#include <thread>
+
+// Thread safety: Not needed ('Structor)
+FreeFrameStore::FreeFrameStore()
+    : start(nullptr)
+    , size(0)
+    , magazine_size(0)
+    , batch(0) {
+
+    for (size_t s = 0; s < SHARDS; s += 1) {
+
+        shards[s].head = nullptr;
+        shards[s].tail = nullptr;
+        shards[s].count.store(0, std::memory_order_relaxed);
+
+        }
+
+    for (size_t m = 0; m < SLOTS; m += 1) {
+
+        magazines[m].busy.clear();
+        magazines[m].count.store(0, std::memory_order_relaxed);
+
+        }
+
+    }
+
+// Thread safety: Not needed (Called once, before the store is shared)
+// Links n frames from start_addr, in order, over the shards.
+void FreeFrameStore::init(char *start_addr, PageNum n, bool cached) {
+
+    start = start_addr;
+    size  = n;
+
+    magazine_size = cached ? MIN(MAGAZINE_MAX, n / (SLOTS * MAGAZINE_SHARE)) : 0;
+
+    if (magazine_size < 2) magazine_size = 0;
+
+    batch = magazine_size / 2;
+
+    size_t per_shard = DIV_CEIL(MAX(n, (PageNum)1), SHARDS);
+
+    for (PageNum i = 0; i < n; i += 1) {
+
+        shard_push(shards[i / per_shard], new (start + (size_t)i * PAGE_SIZE) PageAnte());
+
+        }
+
+    }
+
+// Thread safety: Yes (Thread-local)
+size_t FreeFrameStore::thread_slot() {
+
+    return plat::thread_index() % SLOTS;
+
+    }
+
+// Thread safety: Not needed (Shard mutex locked by caller)
+PageAnte *FreeFrameStore::shard_pop(Shard &shard) {
+
+    PageAnte *rv = shard.head;
+
+    if (rv == nullptr) return nullptr;
+
+    shard.head = rv->next_empty;
+
+    if (shard.head == nullptr) shard.tail = nullptr;
+
+    shard.count.store(shard.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+
+    return rv;
+
+    }
+
+// Thread safety: Not needed (Shard mutex locked by caller)
+void FreeFrameStore::shard_push(Shard &shard, PageAnte *page) {
+
+    page->next_empty = nullptr;
+
+    if (shard.head == nullptr) {
+
+        shard.head = page;
+        shard.tail = page;
+
+        }
+    else {
+
+        shard.tail->next_empty = page;
+
+        shard.tail = page;
+
+        }
+
+    shard.count.store(shard.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    }
+
+// Thread safety: Yes (Magazine flag)
+void FreeFrameStore::magazine_lock(Magazine &mag) {
+
+    while (mag.busy.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+
+    }
+
+// Thread safety: Not needed (Magazine flag held by caller)
+// Moves the n oldest frames of the magazine to its home shard.
+void FreeFrameStore::magazine_drain(Magazine &mag, size_t slot, size_t n) {
+
+    size_t count = mag.count.load(std::memory_order_relaxed);
+
+    Shard &shard = shards[slot % SHARDS];
+
+    {
+        std::lock_guard<std::mutex> lg(shard.mutex);
+
+        for (size_t i = 0; i < n; i += 1) shard_push(shard, mag.frames[i]);
+
+        }
+
+    for (size_t i = n; i < count; i += 1) mag.frames[i - n] = mag.frames[i];
+
+    mag.count.store(count - n, std::memory_order_relaxed);
+
+    }
+
+// Thread safety: Not needed (Magazine flag held by caller)
+// Fills half the magazine from the first shard that has frames, starting with
+// the home shard.
+size_t FreeFrameStore::magazine_refill(Magazine &mag, size_t slot) {
+
+    size_t count = mag.count.load(std::memory_order_relaxed);
+
+    for (size_t i = 0; i < SHARDS && count == 0; i += 1) {
+
+        Shard &shard = shards[(slot + i) % SHARDS];
+
+        if (shard.count.load(std::memory_order_relaxed) == 0) continue;
+
+        std::lock_guard<std::mutex> lg(shard.mutex);
+
+        while (count < batch) {
+
+            PageAnte *page = shard_pop(shard);
+
+            if (page == nullptr) break;
+
+            mag.frames[count++] = page;
+
+            }
+
+        }
+
+    mag.count.store(count, std::memory_order_relaxed);
+
+    return count;
+
+    }
+
+// Thread safety: Yes (Shard mutexes)
+PageAnte *FreeFrameStore::shards_take(size_t slot) {
+
+    for (size_t i = 0; i < SHARDS; i += 1) {
+
+        Shard &shard = shards[(slot + i) % SHARDS];
+
+        std::lock_guard<std::mutex> lg(shard.mutex);
+
+        PageAnte *rv = shard_pop(shard);
+
+        if (rv != nullptr) return rv;
+
+        }
+
+    return nullptr;
+
+    }
+
+// Thread safety: Yes (Magazine flag, shard mutexes)
+// Returns nullptr if no frame is left outside other threads' magazines.
+PageAnte *FreeFrameStore::acquire() {
+
+    size_t slot = thread_slot();
+
+    Magazine &mag = magazines[slot];
+
+    if (magazine_size == 0 || mag.busy.test_and_set(std::memory_order_acquire)) return shards_take(slot);
+
+    PageAnte *rv = nullptr;
+
+    size_t count = mag.count.load(std::memory_order_relaxed);
+
+    if (count == 0) count = magazine_refill(mag, slot);
+
+    if (count > 0) {
+
+        rv = mag.frames[count - 1];
+
+        mag.count.store(count - 1, std::memory_order_relaxed);
+
+        }
+
+    mag.busy.clear(std::memory_order_release);
+
+    return rv;
+
+    }
+
+// Thread safety: Yes (Magazine flag, shard mutexes)
+void FreeFrameStore::release(PageAnte *page) {
+
+    size_t slot = thread_slot();
+
+    Magazine &mag = magazines[slot];
+
+    if (magazine_size == 0 || mag.busy.test_and_set(std::memory_order_acquire)) {
+
+        Shard &shard = shards[slot % SHARDS];
+
+        std::lock_guard<std::mutex> lg(shard.mutex);
+
+        shard_push(shard, page);
+
+        return;
+
+        }
+
+    if (mag.count.load(std::memory_order_relaxed) == magazine_size) magazine_drain(mag, slot, batch);
+
+    size_t count = mag.count.load(std::memory_order_relaxed);
+
+    mag.frames[count] = page;
+
+    mag.count.store(count + 1, std::memory_order_relaxed);
+
+    mag.busy.clear(std::memory_order_release);
+
+    }
+
+// Thread safety: Yes (Magazine flags, shard mutexes)
+// Empties every thread's magazine into the shards; returns the number of
+// frames moved.
+size_t FreeFrameStore::reclaim() {
+
+    size_t moved = 0;
+
+    if (magazine_size == 0) return 0;
+
+    for (size_t m = 0; m < SLOTS; m += 1) {
+
+        Magazine &mag = magazines[m];
+
+        if (mag.count.load(std::memory_order_relaxed) == 0) continue;
+
+        magazine_lock(mag);
+
+        size_t count = mag.count.load(std::memory_order_relaxed);
+
+        magazine_drain(mag, m, count);
+
+        moved += count;
+
+        mag.busy.clear(std::memory_order_release);
+
+        }
+
+    return moved;
+
+    }
+
+// Thread safety: Yes (Magazine flags, shard mutexes)
+// Takes frames [first, first + n) out of the store if all of them are in it,
+// otherwise leaves the store as it is and returns false.
+bool FreeFrameStore::take_run(size_t first, size_t n) {
+
+    // Magazines before shards, as everywhere else:
+    for (size_t m = 0; m < SLOTS; m += 1) magazine_lock(magazines[m]);
+
+    for (size_t s = 0; s < SHARDS; s += 1) shards[s].mutex.lock();
+
+    for (size_t m = 0; m < SLOTS; m += 1) {
+
+        Magazine &mag = magazines[m];
+
+        size_t count = mag.count.load(std::memory_order_relaxed);
+
+        for (size_t i = 0; i < count; i += 1) shard_push(shards[m % SHARDS], mag.frames[i]);
+
+        mag.count.store(0, std::memory_order_relaxed);
+
+        }
+
+    char *lo = start + first * PAGE_SIZE;
+    char *hi = lo + n * PAGE_SIZE;
+
+    size_t found = 0;
+
+    for (size_t s = 0; s < SHARDS; s += 1) {
+
+        for (PageAnte *p = shards[s].head; p != nullptr; p = p->next_empty) {
+
+            if ((char*)p >= lo && (char*)p < hi) found += 1;
+
+            }
+
+        }
+
+    if (found == n) {
+
+        for (size_t s = 0; s < SHARDS; s += 1) {
+
+            Shard &shard = shards[s];
+
+            PageAnte **link = &shard.head;
+            PageAnte  *prev = nullptr;
+
+            while (*link != nullptr) {
+
+                if ((char*)*link >= lo && (char*)*link < hi) {
+
+                    *link = (*link)->next_empty;
+
+                    shard.count.store(shard.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+
+                    }
+                else {
+
+                    prev = *link;
+                    link = &((*link)->next_empty);
+
+                    }
+
+                }
+
+            shard.tail = prev;
+
+            }
+
+        }
+
+    for (size_t s = SHARDS; s > 0; s -= 1) shards[s - 1].mutex.unlock();
+
+    for (size_t m = SLOTS; m > 0; m -= 1) magazines[m - 1].busy.clear(std::memory_order_release);
+
+    return (found == n);
+
+    }
+
+// Thread safety: Yes (Atomic; a snapshot that may be off while frames move)
+size_t FreeFrameStore::count() const {
+
+    size_t rv = 0;
+
+    for (size_t s = 0; s < SHARDS; s += 1) rv += shards[s].count.load(std::memory_order_relaxed);
+
+    for (size_t m = 0; m < SLOTS; m += 1) rv += magazines[m].count.load(std::memory_order_relaxed);
+
+    return rv;
+
+    }
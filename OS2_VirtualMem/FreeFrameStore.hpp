@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+#include "VmDecl.hpp"
+#include "IntegralTypes.hpp"
+#include "HelperStructs.hpp"
+#include "VmGeometry.hpp"
+
+// The empty frames of one memory space, linked through their first bytes.
+//
+// The list is split into SHARDS lists, each under its own mutex. In front of
+// them, every thread has a magazine of up to MAGAZINE_MAX frames which it
+// takes frames from and returns them to without locking anything shared; a
+// magazine is refilled from (or, when full, half drained into) the thread's
+// home shard in one batch, and an empty home shard is refilled from the
+// others. A thread owns its magazine in the common case - the flag on it only
+// matters when more than SLOTS threads share the magazines, and a thread that
+// finds its magazine taken goes to the shards directly.
+//
+// Frames held in magazines are free but can't be seen by other threads;
+// reclaim() sends them back to the shards before anyone has to evict a page.
+// Spaces too small to spare them run without magazines.
+class FreeFrameStore {
+
+    public:
+
+        static const size_t SHARDS       = 4;
+        static const size_t SLOTS        = 16;
+        static const size_t MAGAZINE_MAX = 16;
+
+        // A space gets magazines of at most 1/MAGAZINE_SHARE of its frames
+        // between all of them:
+        static const size_t MAGAZINE_SHARE = 16;
+
+    private:
+
+        struct Shard {
+
+            std::mutex mutex;
+
+            PageAnte *head;
+            PageAnte *tail;
+
+            std::atomic<size_t> count;
+
+            };
+
+        struct Magazine {
+
+            std::atomic_flag busy;
+
+            std::atomic<size_t> count;
+
+            PageAnte *frames[MAGAZINE_MAX];
+
+            };
+
+        char *start;
+        PageNum size;
+
+        size_t magazine_size; // 0 - no magazines
+        size_t batch;
+
+        Shard shards[SHARDS];
+        Magazine magazines[SLOTS];
+
+        static size_t thread_slot();
+
+        static PageAnte *shard_pop(Shard &shard);
+        static void shard_push(Shard &shard, PageAnte *page);
+
+        void magazine_lock(Magazine &mag);
+        void magazine_drain(Magazine &mag, size_t slot, size_t n);
+        size_t magazine_refill(Magazine &mag, size_t slot);
+
+        PageAnte *shards_take(size_t slot);
+
+    public:
+
+        FreeFrameStore();
+
+        FreeFrameStore(const FreeFrameStore &other) = delete;
+        FreeFrameStore& operator=(const FreeFrameStore &other) = delete;
+
+        void init(char *start_addr, PageNum n, bool cached = true);
+
+        PageAnte *acquire();
+        void release(PageAnte *page);
+
+        size_t reclaim();
+
+        bool take_run(size_t first, size_t n);
+
+        size_t count() const;
+
+    };
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <cstring>
+#include <type_traits>
+
 #include "IntegralTypes.hpp"
 #include "Macros.hpp"
 #include "VmDecl.hpp"
+#include "VmGeometry.hpp"
 
 #include "Part.h"
 
@@ -18,106 +22,157 @@ struct PageType {
 
         UsUnused,
         UsUserPage,
+        UsHugePage,
         UsReserved,
 
         KsUnused,
         KsSegTable,
         KsPageTable,
+        KsPageDir,
+        KsRmapPool,
         KsReserved
 
         };
 
     };
 
-#pragma pack(push, 1)
+struct TranslationMode {
+
+    enum ModeEnum {
 
-struct FrameTableEntry {
+        PageTables, // Per-process multi-level page tables
+        Inverted    // Global hashed inverted page table for resident pages
+
+        };
+
+    };
+
+// Frame table of one memory space, kept as parallel arrays (in kernel space)
+// so that a scan over one attribute - reference history, flags or type - reads
+// only that attribute's bytes. Every array starts on an ALIGN boundary.
+struct FrameTable {
 
     enum FlagEnum {
         
         Dirty  = 7,
         Shared = 6,
-        Locked = 5
+        Locked = 5,
+        Fresh  = 4  // Holds a to-be-created page of a large page
 
         };
 
-    static const Uint16 REF_TOP = 0x8000;
+    static const Uint8 REF_TOP = 0x80;
 
-    Uint16 ref_history;
+    static const size_t ALIGN = 64;
 
-    Uint8 flags;
+    void **owner;
 
-    Uint8 type;
+    Uint8 *ref_history; // Newest reference on top, older ones shifted down
 
-    void *owner;
+    Uint8 *flags;
 
-    FrameTableEntry() { // TEMP
+    Uint8 *type;
 
-        ref_history = 0;
+    // Bytes taken by the arrays of n frames:
+    static size_t bytes(size_t n) {
 
-        flags = type = 0;
+        return DIV_CEIL(n * sizeof(void*), ALIGN) * ALIGN + 3 * DIV_CEIL(n, ALIGN) * ALIGN;
 
-        owner = nullptr;
+        }
+
+    // Lays the arrays of n frames out from memory (ALIGN-aligned) and clears them:
+    void place(char *memory, size_t n) {
+
+        size_t bytes_owner = DIV_CEIL(n * sizeof(void*), ALIGN) * ALIGN;
+        size_t bytes_byte  = DIV_CEIL(n, ALIGN) * ALIGN;
+
+        owner       = reinterpret_cast<void**>(memory);
+        ref_history = reinterpret_cast<Uint8*>(memory + bytes_owner);
+        flags       = ref_history + bytes_byte;
+        type        = flags + bytes_byte;
+
+        for (size_t i = 0; i < n; i += 1) owner[i] = nullptr;
+
+        std::memset(ref_history, 0, 3 * bytes_byte);
 
         }
 
     // Flags
-    void set_dirty(bool val) {
+    void set_dirty(size_t i, bool val) {
 
-        flags = BIT_VAL(flags, Dirty, val);
+        flags[i] = BIT_VAL(flags[i], Dirty, val);
 
         }
 
-    bool get_dirty() const {
+    bool get_dirty(size_t i) const {
 
-        return BIT_GET(flags, Dirty);
+        return BIT_GET(flags[i], Dirty);
 
         }
 
-    void set_shared(bool val) {
+    void set_shared(size_t i, bool val) {
 
-        flags = BIT_VAL(flags, Shared, val);
+        flags[i] = BIT_VAL(flags[i], Shared, val);
 
         }
 
-    bool get_shared() const {
+    bool get_shared(size_t i) const {
 
-        return BIT_GET(flags, Shared);
+        return BIT_GET(flags[i], Shared);
+
+        }
+
+    void set_locked(size_t i, bool val) {
+
+        flags[i] = BIT_VAL(flags[i], Locked, val);
+
+        }
+
+    bool get_locked(size_t i) const {
+
+        return BIT_GET(flags[i], Locked);
 
         }
 
-    void set_locked(bool val) {
+    void set_fresh(size_t i, bool val) {
 
-        flags = BIT_VAL(flags, Locked, val);
+        flags[i] = BIT_VAL(flags[i], Fresh, val);
 
         }
 
-    bool get_locked() const {
+    bool get_fresh(size_t i) const {
 
-        return BIT_GET(flags, Locked);
+        return BIT_GET(flags[i], Fresh);
 
         }
 
     };
 
+#pragma pack(push, 1)
+
 struct PageTableL1Entry {
 
     enum StatusEnum {
         
         Unused,
         PagedOut,
-        Present
+        Present,
+        Huge     // Maps a run of PTL2_ENTRIES user frames starting at block_disk
         
         };
 
-    Uint8 status;
+    Uint32 status     : 2;
 
-    Uint8 unused;
+    Uint32 access     : 2; // Access type of a Huge mapping
 
-    Uint16 block_disk;
+    Uint32 block_disk : 28;
 
     };
 
+// A mapped page costs one 4-byte entry: a 24-bit frame or swap slot number
+// and 8 flag bits. A shared page's entry holds the frame while it is valid,
+// and the shared segment index otherwise. The origin table adds 4 bytes per
+// user frame.
 struct PageTableL2Entry {
     
     enum FlagEnum {
@@ -133,11 +188,9 @@ struct PageTableL2Entry {
         
         };
 
-    Uint16 block_disk;
-    
-    Uint8 sseg_ind;
+    Uint32 block_disk : 24;
 
-    Uint8 flags;   
+    Uint32 flags      : 8;
 
     // Flags
     void set_valid(bool val) {
@@ -215,6 +268,20 @@ struct PageTableL2Entry {
 
         }
 
+    // Shared pages not mapped directly hold the index of their segment in
+    // the process's segment table (see KernelProcess::shared_ssegs)
+    void set_seg_ind(size_t seg_ind) {
+
+        block_disk = (Uint32)seg_ind;
+
+        }
+
+    size_t get_seg_ind() const {
+
+        return block_disk;
+
+        }
+
     // Other
     void reset() {
         
@@ -224,7 +291,10 @@ struct PageTableL2Entry {
 
     };
 
-struct SegTableEntry {
+// A segment's first page and its length. With two levels, page numbers are
+// VPN_BITS wide and the entry keeps to 4 bytes; deeper tables use 8.
+template<typename Word, unsigned StartBits>
+struct SegTableEntryT {
 
     enum KindEnum { // Max 4 elements
         
@@ -234,9 +304,13 @@ struct SegTableEntry {
         
         };
 
-    Uint16 len_kind; // length [14], kind [2]
+    static const unsigned LEN_KIND_BITS = 8 * sizeof(Word) - StartBits;
+
+    static const size_t MAX_LENGTH = ((size_t)1 << (LEN_KIND_BITS - 2)) - 1;
 
-    Uint16 start_page;
+    Word len_kind   : LEN_KIND_BITS; // length, kind [2]
+
+    Word start_page : StartBits;
 
     void set_kind(KindEnum kind) {
         
@@ -255,22 +329,75 @@ struct SegTableEntry {
         
         KindEnum temp = get_kind();
 
-        len_kind = (Uint16)length;
-        len_kind <<= 2;
-        len_kind |= temp;
+        len_kind = ((Word)length << 2) | temp;
 
         }
 
     size_t get_length() const {
         
-        return (len_kind >> 2);
+        return (size_t)(len_kind >> 2);
 
         }
 
+    static_assert(LEN_KIND_BITS > 2, "SegTableEntry - No room left for the length.");
+
+    };
+
+typedef std::conditional<VmConfig::DIR_LEVELS == 0,
+                         SegTableEntryT<Uint32, VmConfig::VPN_BITS>,
+                         SegTableEntryT<Uint64, 40>>::type SegTableEntry;
+
+// Reverse map entry, one per user frame: the (pid, page) that maps the
+// frame. Lets a frame be evicted while the page table mapping it is swapped
+// out, and serves as the key of the inverted page table. A frame with
+// several mappers is chained: page then holds the pool handle of the first
+// node of its mapping list.
+struct RmapEntry {
+
+    static const Uint32 NIL = 0xFFFFFF; // End of an IPT bucket chain
+
+    static const unsigned PID_BITS = 20;
+
+    Uint64 page    : 40;
+
+    Uint64 pid     : PID_BITS;
+
+    Uint64 mapped  : 1;
+
+    Uint64 chained : 1;
+
+    Uint64 access  : 2;
+
+    };
+
+// Node of a frame's mapping list, allocated from the reverse map pool
+struct RmapLink {
+
+    static const Uint32 NIL = 0xFFFFFFFF;
+
+    RmapEntry mapping;
+
+    Uint32 next;
+
+    };
+
+// Start of a reverse map pool frame, in place of its first node
+struct RmapPoolHeader {
+
+    Uint32 live;       // Nodes in use
+    Uint32 free;       // First free node
+    Uint32 next_frame; // Next pool frame
+
     };
 
 #pragma pack(pop)
 
+static_assert(sizeof(PageTableL1Entry) == 4, "VmGeometry assumes 4-byte L1 entries.");
+static_assert(sizeof(PageTableL2Entry) == 4, "VmGeometry assumes 4-byte L2 entries.");
+static_assert(sizeof(SegTableEntry)    == VmConfig::SEGMENT_ENTRY_SIZE, "VmGeometry assumes another size of segment table entries.");
+static_assert(sizeof(RmapEntry)        == 8, "RmapEntry should be 8 bytes.");
+static_assert(sizeof(RmapPoolHeader)   <= sizeof(RmapLink), "RmapPoolHeader must fit into a pool node.");
+
 struct Victim {
     
     size_t ordinal;
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <mutex>
+#include <shared_mutex>
+
+#include "Latency.hpp"
+#include "LockProfile.hpp"
+
+#define KERNEL_MUTEX_TIMED (VM_LATENCY || VM_LOCK_PROFILE)
+
+// Recursive mutex of the kernel, named by the lock it is profiled as (see
+// LockProfile.hpp) and whose wait histogram it records into (see
+// Latency.hpp). Meets the Lockable requirements, so std::lock_guard and
+// std::unique_lock take it as they would a std::recursive_mutex. With both
+// VM_LATENCY and VM_LOCK_PROFILE off it only forwards to the mutex.
+class KernelMutex {
+
+    public:
+
+        explicit KernelMutex(LockId::IdEnum id_) : id(id_) { }
+
+        KernelMutex(const KernelMutex &other) = delete;
+        KernelMutex &operator=(const KernelMutex &other) = delete;
+
+        // Thread safety: Yes (Mutex)
+        void lock() {
+
+        #if KERNEL_MUTEX_TIMED
+            if (mutex.try_lock()) { acquired(id, 0, false); return; }
+
+            Uint64 start = latency::now();
+
+            mutex.lock();
+
+            acquired(id, latency::now() - start, true);
+        #else
+            mutex.lock();
+        #endif
+
+            }
+
+        // Thread safety: Yes (Mutex)
+        bool try_lock() {
+
+        #if KERNEL_MUTEX_TIMED
+            if (!mutex.try_lock()) return false;
+
+            acquired(id, 0, false);
+
+            return true;
+        #else
+            return mutex.try_lock();
+        #endif
+
+            }
+
+        // Thread safety: Yes (Mutex)
+        void unlock() {
+
+        #if VM_LOCK_PROFILE
+            lockprof::released(id);
+        #endif
+
+            mutex.unlock();
+
+            }
+
+        // Thread safety: Yes (Thread-local)
+        static void acquired(LockId::IdEnum id, Uint64 wait_ns, bool contended) {
+
+            // Unused when neither is built in:
+            (void)id;
+            (void)wait_ns;
+            (void)contended;
+
+        #if VM_LATENCY
+            latency::record(static_cast<LatencyId::IdEnum>(LatencyId::WaitDvt + id), wait_ns);
+        #endif
+
+        #if VM_LOCK_PROFILE
+            lockprof::acquired(id, wait_ns, contended);
+        #endif
+
+            }
+
+    private:
+
+        static_assert(LatencyId::COUNT - LatencyId::WaitDvt == LockId::COUNT, "KernelMutex - wait histograms out of order.");
+
+        std::recursive_mutex mutex;
+
+        LockId::IdEnum id;
+
+    };
+
+// Reader-writer counterpart of KernelMutex; readers and writers are
+// profiled together.
+class KernelRwMutex {
+
+    public:
+
+        explicit KernelRwMutex(LockId::IdEnum id_) : id(id_) { }
+
+        KernelRwMutex(const KernelRwMutex &other) = delete;
+        KernelRwMutex &operator=(const KernelRwMutex &other) = delete;
+
+        // Thread safety: Yes (Mutex)
+        void lock() {
+
+        #if KERNEL_MUTEX_TIMED
+            if (mutex.try_lock()) { KernelMutex::acquired(id, 0, false); return; }
+
+            Uint64 start = latency::now();
+
+            mutex.lock();
+
+            KernelMutex::acquired(id, latency::now() - start, true);
+        #else
+            mutex.lock();
+        #endif
+
+            }
+
+        // Thread safety: Yes (Mutex)
+        bool try_lock() {
+
+            bool rv = mutex.try_lock();
+
+        #if KERNEL_MUTEX_TIMED
+            if (rv) KernelMutex::acquired(id, 0, false);
+        #endif
+
+            return rv;
+
+            }
+
+        // Thread safety: Yes (Mutex)
+        void unlock() {
+
+        #if VM_LOCK_PROFILE
+            lockprof::released(id);
+        #endif
+
+            mutex.unlock();
+
+            }
+
+        // Thread safety: Yes (Mutex)
+        void lock_shared() {
+
+        #if KERNEL_MUTEX_TIMED
+            if (mutex.try_lock_shared()) { KernelMutex::acquired(id, 0, false); return; }
+
+            Uint64 start = latency::now();
+
+            mutex.lock_shared();
+
+            KernelMutex::acquired(id, latency::now() - start, true);
+        #else
+            mutex.lock_shared();
+        #endif
+
+            }
+
+        // Thread safety: Yes (Mutex)
+        bool try_lock_shared() {
+
+            bool rv = mutex.try_lock_shared();
+
+        #if KERNEL_MUTEX_TIMED
+            if (rv) KernelMutex::acquired(id, 0, false);
+        #endif
+
+            return rv;
+
+            }
+
+        // Thread safety: Yes (Mutex)
+        void unlock_shared() {
+
+        #if VM_LOCK_PROFILE
+            lockprof::released(id);
+        #endif
+
+            mutex.unlock_shared();
+
+            }
+
+    private:
+
+        std::shared_timed_mutex mutex;
+
+        LockId::IdEnum id;
+
+    };
@@ -1,6 +1,8 @@
 
 #include "KernelProcess.hpp"
 #include "KernelSystem.hpp"
+#include "Trace.hpp"
+#include "Latency.hpp"
 
 #include <new>
 #include <iostream>
@@ -9,11 +11,12 @@
 
 KernelProcess::KernelProcess(KernelSystem *owner_, ProcessId pid_)
     : owner(owner_)
-    , pid(pid_) {
+    , pid(pid_)
+    , mutex_tables(LockId::Tables) {
 
     seg_count = 0;
 
-    sscb = nullptr;
+    for (size_t i = 0; i < ProcessStat::COUNT; i += 1) stats[i].store(0, std::memory_order_relaxed);
 
     }
 
@@ -21,9 +24,9 @@ KernelProcess::~KernelProcess() {
 
     size_t mt = master_table_lock();
 
-    for (size_t i = 0; i < MAX_SEGMENTS; i += 1) {
+    for (size_t i = 0; i < MAX_SEGMENTS && seg_count > 0; i += 1) {
         
-        if (st_ptr[i].get_kind() == SegTableEntry::Occupied) {
+        if (st_ptr[i].get_kind() != SegTableEntry::Free) { // Also disconnects from shared segments
 
             delete_segment_ind(i, true);
 
@@ -31,6 +34,13 @@ KernelProcess::~KernelProcess() {
         
         }
 
+    // Release page tables:
+    for (size_t i = 0; i < MAX_PAGE_TABLES_L1; i += 1) {
+
+        table_release(ptl1_ptr + i, 0);
+
+        }
+
     owner->ks_relinquish_page(mt);
 
     owner->ks_unlock_page(mt);
@@ -54,55 +64,78 @@ void KernelProcess::page_fault(VirtualAddress addr) {
 
     //PRINT("Process with PID " << pid << " called page_fault (addr = " << addr << ").\n");
 
+    LATENCY_TIMER(latency_timer); // Recorded once the kind of fault is known
+
     master_table_lock();
 
     PageUnlocker punl(owner, master_table);
 
-    ptl1e = access_ptl1(addr, status, true);
+    ptl1e = walk_ptl1(addr, false);
 
-    if (ptl1e->status == PageTableL1Entry::Unused) {
+    if (ptl1e == nullptr || ptl1e->status == PageTableL1Entry::Unused) {
         HALT("KernelProcess::page_fault - Master table error.");
         }
 
-    do {
-        ptl2e = access_ptl2(addr, ptl1e, status, true);
-        if (status == TRAP) { HALT("KernelProcess::page_fault - Accessed unused page table."); }
-        if (status == PAGE_FAULT) { 
-            swap_page_table(MODE_IN, addr);
-            }
-        }
-        while (status != OK);  
+    if (ptl1e->status == PageTableL1Entry::Huge) return; // Large pages are always resident
+
+    size_t pt = page_table_lock(addr);
+    PageUnlocker punl1(owner, pt);
+
+    ptl2e = access_ptl2(addr, ptl1e, status, true);
 
     if (!ptl2e->get_shared()) { // Normal page
 
+        if (ptl2e->get_tbc()) {
+            owner->stat_add(StatId::FaultsZeroFill);
+            stat_add(ProcessStat::MinorFaults);
+            LATENCY_KIND(latency_timer, FaultZeroFill);
+            }
+        else if (!ptl2e->get_valid()) {
+            owner->stat_add(StatId::FaultsSwapIn);
+            stat_add(ProcessStat::MajorFaults);
+            LATENCY_KIND(latency_timer, FaultSwapIn);
+            }
+
+        if ((ptl2e->get_tbc() || !ptl2e->get_valid()) && owner->us_huge_promote(this, addr, ptl1e)) {
+            return;
+            }
+
         if (ptl2e->get_tbc()) { // if page is to-be-created
         
             PageAnte *temp = owner->us_request_page(PageType::UsUserPage, ptl2e);
 
-            ptl2e->block_disk = (Uint16)owner->us_page_ordinal(temp);
+            ptl2e->block_disk = (Uint32)owner->us_page_ordinal(temp);
 
             ptl2e->set_valid(true);
             ptl2e->set_dirty(false);
             ptl2e->set_tbc(false);
 
+            owner->rmap_set(ptl2e->block_disk, pid, VmConfig::page(addr), ptl2e->get_access());
+
             }
         else if (!ptl2e->get_valid()) { // if page is not in memory
         
             PageAnte *temp = owner->us_request_page(PageType::UsUserPage, ptl2e, ptl2e->block_disk);
 
-            ptl2e->block_disk = (Uint16)owner->us_page_ordinal(temp);
+            stat_add(ProcessStat::SwappedPages, -1);
+
+            ptl2e->block_disk = (Uint32)owner->us_page_ordinal(temp);
 
             ptl2e->set_valid(true);
             ptl2e->set_dirty(false);
 
+            owner->rmap_set(ptl2e->block_disk, pid, VmConfig::page(addr), ptl2e->get_access());
+
             }
 
         }
-    else{ // Shared page
+    else if (!ptl2e->get_valid()) { // Shared page - map its frame directly
         
-        VirtualAddress sseg_addr = ((VirtualAddress)ptl2e->block_disk * PAGE_SIZE) + (addr & 0x03FF); // PEP
+        owner->stat_add(StatId::FaultsShared);
 
-        owner->shared_segment_pf(ptl2e->sseg_ind, sseg_addr);
+        LATENCY_KIND(latency_timer, FaultShared);
+
+        owner->shared_segment_pf(this, addr, ptl2e);
         
         }
 
@@ -112,10 +145,18 @@ void KernelProcess::swap_master_table(bool mode, bool lock) {
 
     if (mode == MODE_IN) {
 
-        master_table = reinterpret_cast<char*>(
-            owner->ks_request_page(PageType::KsSegTable, this, mt_disk, lock));
+        // Read like a page table (see table_request):
+        PageAnte *page = owner->ks_request_page(PageType::KsSegTable, this, KernelSystem::NULL_CLUSTER, true);
+
+        {
+            RaiiLock rl(mutex_tables);
+
+            owner->ks_read_table(page, mt_disk);
+
+            set_master_table(page);
+            }
 
-        master_table_valid = true;
+        if (!lock) owner->ks_unlock_page(owner->ks_page_ordinal(page));
 
         }
     else {
@@ -132,19 +173,14 @@ void KernelProcess::swap_master_table(bool mode, bool lock) {
 
 void KernelProcess::swap_page_table(bool mode, VirtualAddress addr) {
 
-    Status status;
-
     if (mode == MODE_IN) {
         
-        PageTableL1Entry *ptl1e = access_ptl1(addr, status, true);
+        PageTableL1Entry *ptl1e = walk_ptl1(addr, false);
 
-        if (status != OK)
+        if (ptl1e == nullptr || ptl1e->status != PageTableL1Entry::PagedOut)
             HALT("KernelProcess::swap_page_table - Could not fetch descriptor.");
 
-        PageAnte *page = owner->ks_request_page(PageType::KsPageTable, ptl1e, ptl1e->block_disk);
-
-        ptl1e->block_disk = (Uint16)owner->ks_page_ordinal(page);
-        ptl1e->status = PageTableL1Entry::Present;
+        table_request(ptl1e, PageType::KsPageTable, false);
 
         }
     else {
@@ -166,7 +202,7 @@ void KernelProcess::init_page_table(PageAnte *page) {
 
     /*auto *ptl2_ptr = reinterpret_cast<PageTableL2Entry*>(page);
 
-    for (size_t i = 0; i < 256; i += 1) {
+    for (size_t i = 0; i < PAGE_TABLE_SIZE_L2; i += 1) {
         
         new (ptl2_ptr + i) PageTableL2Entry();
         
@@ -176,28 +212,109 @@ void KernelProcess::init_page_table(PageAnte *page) {
 
     }
 
+PageAnte *KernelProcess::table_request(PageTableL1Entry *entry, PageType::TypeEnum type, bool lock) {
+
+    // Keep the table holding the entry in memory while the new one is acquired:
+    PageUnlocker pin(owner, owner->ks_pin_page(entry));
+
+    bool fresh = (entry->status == PageTableL1Entry::Unused);
+
+    // The frame stays locked until the entry points to it:
+    PageAnte *page = owner->ks_request_page(type, entry, KernelSystem::NULL_CLUSTER, true);
+
+    if (fresh) init_page_table(page);
+
+    {
+        // A paged-out table is read and its entry updated in one step for
+        // rmap_swap_out, which patches tables in their swap slots:
+        RaiiLock rl(mutex_tables);
+
+        if (!fresh) owner->ks_read_table(page, entry->block_disk);
+
+        entry->block_disk = (Uint32)owner->ks_page_ordinal(page);
+        entry->status = PageTableL1Entry::Present;
+        }
+
+    if (!lock) owner->ks_unlock_page(owner->ks_page_ordinal(page));
+
+    return page;
+
+    }
+
+void KernelProcess::table_release(PageTableL1Entry *entry, unsigned depth) {
+
+    if (entry->status == PageTableL1Entry::Unused) return;
+
+    if (depth < VmConfig::DIR_LEVELS) { // Directory - its children are released first
+
+        if (entry->status == PageTableL1Entry::PagedOut) {
+
+            table_request(entry, PageType::KsPageDir, false);
+
+            }
+
+        PageAnte *page = owner->ks_page_addr(entry->block_disk);
+        PageUnlocker pin(owner, owner->ks_pin_page(page));
+
+        auto *dir = reinterpret_cast<PageTableL1Entry*>(page);
+
+        for (size_t i = 0; i < VmConfig::DIR_ENTRIES; i += 1) {
+
+            table_release(dir + i, depth + 1);
+
+            }
+
+        }
+
+    if (entry->status == PageTableL1Entry::Present) {
+
+        owner->ks_relinquish_page(entry->block_disk);
+
+        }
+    else if (entry->status == PageTableL1Entry::PagedOut) {
+
+        RaiiLock rl(mutex_tables); // The slot is given up with the entry (see table_request)
+
+        owner->relinquish_cluster(entry->block_disk);
+
+        entry->status = PageTableL1Entry::Unused;
+
+        }
+
+    entry->status = PageTableL1Entry::Unused;
+
+    }
+
 void KernelProcess::page_table_evict_children(KernelSystem *system, PageAnte *page, bool destroy) {
 
-    PRINTLN("Page table evicting children...");
+    TRACE_EVENT(TableEvict, system->ks_page_ordinal(page), 0);
 
     PageTableL2Entry *ptl2_ptr = reinterpret_cast<PageTableL2Entry*>(page);
 
     if (!destroy) {
         
+        Victim victims[PAGE_TABLE_SIZE_L2];
+
+        size_t count = 0;
+
         for (size_t i = 0; i < PAGE_TABLE_SIZE_L2; i += 1)  {
             
             if (ptl2_ptr[i].get_shared()) continue;
 
             if (ptl2_ptr[i].get_valid()) {
 
-                system->us_evict_page(ptl2_ptr[i].block_disk, ptl2_ptr[i].get_dirty());
+                victims[count] = Victim(ptl2_ptr[i].block_disk, ptl2_ptr[i].get_dirty(), KernelSystem::NULL_CLUSTER);
 
-                // Above method call clears valid and dirty bits and sets block_disk
+                count += 1;
 
                 }
 
             }
 
+        system->us_evict_pages(victims, count);
+
+        // Above method call clears valid and dirty bits and sets block_disk
+
         }
     else {
 
@@ -224,26 +341,23 @@ void KernelProcess::page_table_evict_children(KernelSystem *system, PageAnte *pa
 
     }
 
-void KernelProcess::master_table_evict_children(bool destroy) {
+void KernelProcess::directory_evict_children(KernelSystem *system, PageAnte *page) {
 
-    PRINTLN("Master table evicting children...");
+    TRACE_EVENT(DirectoryEvict, system->ks_page_ordinal(page), 0);
 
-    if (!destroy) {
+    system->ks_evict_tables(reinterpret_cast<PageTableL1Entry*>(page), VmConfig::DIR_ENTRIES);
 
-        for (size_t i = 0; i < MAX_PAGE_TABLES_L1; i += 1) {
+    // Above method call evicts the tables' children and sets status and block_disk
 
-            if (ptl1_ptr[i].status == PageTableL1Entry::Present) {
-
-                page_table_evict_children(owner, owner->ks_page_addr(ptl1_ptr[i].block_disk), destroy);
+    }
 
-                //swap_page_table(MODE_OUT, 0);
-                owner->ks_evict_page(ptl1_ptr[i].block_disk, true);
+void KernelProcess::master_table_evict_children(bool destroy) {
 
-                }
+    TRACE_EVENT(MasterEvict, owner->ks_page_ordinal(master_table), 0);
 
-            ptl1_ptr[i].status = PageTableL1Entry::PagedOut;
+    if (!destroy) {
 
-            }
+        owner->ks_evict_tables(ptl1_ptr, MAX_PAGE_TABLES_L1);
 
         }
     else {
@@ -303,22 +417,26 @@ size_t KernelProcess::master_table_lock() {
 
     }
 
+// Brings in (or creates) the page table mapping addr, along with the
+// directories above it, and locks it
 size_t KernelProcess::page_table_lock(VirtualAddress addr) {
 
-    auto slot  = (addr >> 18) & 0x03F;
+    // Assume master table is present and locked
 
-    auto *ptl1e = ptl1_ptr + slot;
+    auto *ptl1e = walk_ptl1(addr, true);
 
     while (true) {
 
-        if (ptl1e->status == PageTableL1Entry::PagedOut) {
+        if (ptl1e->status == PageTableL1Entry::Huge) {
 
-            PageAnte *page = owner->ks_request_page(PageType::KsPageTable, ptl1e, ptl1e->block_disk, true);
+            owner->us_huge_demote(ptl1e);
 
-            ptl1e->block_disk = (Uint16)owner->ks_page_ordinal(page);
-            ptl1e->status = PageTableL1Entry::Present;
+            }
+        else if (ptl1e->status != PageTableL1Entry::Present) {
 
-            return ptl1e->block_disk;
+            PageAnte *page = table_request(ptl1e, PageType::KsPageTable, true);
+
+            return owner->ks_page_ordinal(page);
 
             }
         else {
@@ -339,13 +457,15 @@ size_t KernelProcess::page_table_lock(VirtualAddress addr) {
 
 Status KernelProcess::create_segment(VirtualAddress start_addr, PageNum size, AccessType acc_type) {
 
-    size_t ordinal = (start_addr >> 10) & 0x03FFF;
+    VirtualAddress ordinal = VmConfig::page(start_addr);
+
+    if (size > SegTableEntry::MAX_LENGTH || size == 0) return TRAP;
 
-    if (size > (1 << 14) || size == 0) return TRAP;
+    if (ordinal + size > ((VirtualAddress)1 << VmConfig::VPN_BITS)) return TRAP;
 
     if (seg_count == MAX_SEGMENTS) return TRAP;
 
-    if ((start_addr & 0x03FF) != 0) return TRAP;
+    if (!VmConfig::aligned(start_addr)) return TRAP;
 
     master_table_lock();
     PageUnlocker punl0(owner, master_table);
@@ -357,7 +477,7 @@ Status KernelProcess::create_segment(VirtualAddress start_addr, PageNum size, Ac
         if (ste.get_kind() == SegTableEntry::Free) continue;
 
         if ((ste.start_page + ste.get_length() - 1 < ordinal) ||
-            (ste.start_page > start_addr + size - 1))
+            (ste.start_page > ordinal + size - 1))
             continue;
 
         return TRAP;
@@ -378,7 +498,7 @@ Status KernelProcess::create_segment(VirtualAddress start_addr, PageNum size, Ac
         
         }
 
-    st_ptr[entry].start_page = (Uint16)ordinal;
+    st_ptr[entry].start_page = ordinal;
     st_ptr[entry].set_kind(SegTableEntry::Occupied);
     st_ptr[entry].set_length(size);
 
@@ -392,21 +512,11 @@ Status KernelProcess::create_segment(VirtualAddress start_addr, PageNum size, Ac
         Status status;
         PageUnlocker punl1(owner, KernelSystem::NULL_CLUSTER);
 
-        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
-
         // New way:
-        if (ptl1e->status == PageTableL1Entry::Unused) {
-            PageAnte *pa = owner->ks_request_page(PageType::KsPageTable, ptl1e, KernelSystem::NULL_CLUSTER, true);
-            ptl1e->block_disk = (Uint16)owner->ks_page_ordinal(pa);
-            ptl1e->status = PageTableL1Entry::Present;
-            init_page_table(pa);
-            punl1.reset(pa, true);
-            }
-        else {
-            size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
-            punl1.reset(ptind, true);
-            }
+        size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
+        punl1.reset(ptind, true);
 
+        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
         ptl2e = access_ptl2(start_addr + i * PAGE_SIZE, ptl1e, status, true);
 
         // Old way:
@@ -452,13 +562,15 @@ Status KernelProcess::create_segment(VirtualAddress start_addr, PageNum size, Ac
 
 Status KernelProcess::load_segment(VirtualAddress start_addr, PageNum size, AccessType acc_type, void *content) {
 
-    size_t ordinal = (start_addr >> 10) & 0x03FF;
+    VirtualAddress ordinal = VmConfig::page(start_addr);
+
+    if (size > SegTableEntry::MAX_LENGTH || size == 0) return TRAP;
 
-    if (size > (1 << 14) || size == 0) return TRAP;
+    if (ordinal + size > ((VirtualAddress)1 << VmConfig::VPN_BITS)) return TRAP;
 
     if (seg_count == MAX_SEGMENTS) return TRAP;
 
-    if ((start_addr & 0x03FF) != 0) return TRAP;
+    if (!VmConfig::aligned(start_addr)) return TRAP;
 
     master_table_lock();
     PageUnlocker punl0(owner, master_table);
@@ -476,7 +588,7 @@ Status KernelProcess::load_segment(VirtualAddress start_addr, PageNum size, Acce
         if (ste.get_kind() == SegTableEntry::Free) continue;
 
         if ((ste.start_page + ste.get_length() - 1 < ordinal) ||
-            (ste.start_page > start_addr + size - 1))
+            (ste.start_page > ordinal + size - 1))
             continue;
 
         return TRAP;
@@ -497,7 +609,7 @@ Status KernelProcess::load_segment(VirtualAddress start_addr, PageNum size, Acce
 
         }
 
-    st_ptr[entry].start_page = (Uint16)ordinal;
+    st_ptr[entry].start_page = ordinal;
     st_ptr[entry].set_kind(SegTableEntry::Occupied);
     st_ptr[entry].set_length(size);
 
@@ -511,21 +623,11 @@ Status KernelProcess::load_segment(VirtualAddress start_addr, PageNum size, Acce
         Status status;
         PageUnlocker punl1(owner, KernelSystem::NULL_CLUSTER);
 
-        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
-
         // New way:
-        if (ptl1e->status == PageTableL1Entry::Unused) {
-            PageAnte *pa = owner->ks_request_page(PageType::KsPageTable, ptl1e, KernelSystem::NULL_CLUSTER, true);
-            ptl1e->block_disk = (Uint16)owner->ks_page_ordinal(pa);
-            ptl1e->status = PageTableL1Entry::Present;
-            init_page_table(pa);
-            punl1.reset(pa, true);
-            }
-        else {
-            size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
-            punl1.reset(ptind, true);
-            }
+        size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
+        punl1.reset(ptind, true);
 
+        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
         ptl2e = access_ptl2(start_addr + i * PAGE_SIZE, ptl1e, status, true);
 
         // Old way:
@@ -555,7 +657,7 @@ Status KernelProcess::load_segment(VirtualAddress start_addr, PageNum size, Acce
 
         PageAnte *upg = owner->us_load_page(PageType::UsUserPage, ptl2e, static_cast<char*>(content) + i * PAGE_SIZE);
 
-        ptl2e->block_disk = (Uint16)owner->us_page_ordinal(upg);
+        ptl2e->block_disk = (Uint32)owner->us_page_ordinal(upg);
 
         ptl2e->flags = static_cast<Uint8>(acc_type)
             | (1 << PageTableL2Entry::Valid)
@@ -564,6 +666,8 @@ Status KernelProcess::load_segment(VirtualAddress start_addr, PageNum size, Acce
             | (0 << PageTableL2Entry::TBC)
             | (0 << PageTableL2Entry::Shared);
 
+        owner->rmap_set(ptl2e->block_disk, pid, VmConfig::page(start_addr) + i, acc_type);
+
         //PRINTLN("Set ptl2e for address " << start_addr + i * PAGE_SIZE);
 
         }
@@ -575,11 +679,11 @@ Status KernelProcess::load_segment(VirtualAddress start_addr, PageNum size, Acce
 
 Status KernelProcess::delete_segment(VirtualAddress start_addr) {
 
-    size_t ordinal = (start_addr >> 10) & 0x03FF;
+    VirtualAddress ordinal = VmConfig::page(start_addr);
 
     if (seg_count == 0) return TRAP;
 
-    if ((start_addr & 0x03FF) != 0) return TRAP;
+    if (!VmConfig::aligned(start_addr)) return TRAP;
 
     master_table_lock();
     PageUnlocker punl(owner, master_table);
@@ -613,7 +717,6 @@ Status KernelProcess::delete_segment_ind(size_t entry, bool do_release_shared) {
 
     size_t size = st_ptr[entry].get_length();
     VirtualAddress start_addr = (VirtualAddress)(st_ptr[entry].start_page) * PAGE_SIZE;
-    bool released_shared = false;
 
     // Work:
     for (size_t i = 0; i < size; i += 1) {
@@ -624,15 +727,10 @@ Status KernelProcess::delete_segment_ind(size_t entry, bool do_release_shared) {
 
         // Assume master table is present and locked
 
-        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
-
-        if (ptl1e->status == PageTableL1Entry::Unused) {
-            HALT("KernelProcess::delete_segment - How did this even happen?");
-            }
-
-        size_t pt = page_table_lock(start_addr);
+        size_t pt = page_table_lock(start_addr + i * PAGE_SIZE);
         PageUnlocker punl(owner, pt);
 
+        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
         ptl2e = access_ptl2(start_addr + i * PAGE_SIZE, ptl1e, status, true);
 
         if (!ptl2e->get_inseg()) {
@@ -652,20 +750,16 @@ Status KernelProcess::delete_segment_ind(size_t entry, bool do_release_shared) {
 
                     owner->relinquish_cluster(ptl2e->block_disk);
 
+                    stat_add(ProcessStat::SwappedPages, -1);
+
                     }
 
                 }
 
             }
         else { // Shared page
-            
-            if (!released_shared && do_release_shared) {
-                
-                owner->disconnect_shared_segment(this, ptl2e->sseg_ind);
 
-                released_shared = true;
-
-                }
+            owner->shared_entry_unmap(this, VmConfig::page(start_addr) + i, ptl2e);
 
             }
 
@@ -682,6 +776,16 @@ Status KernelProcess::delete_segment_ind(size_t entry, bool do_release_shared) {
 
         }
 
+    owner->rmap_pool_trim(); // Mapping lists shortened by shared_entry_unmap
+
+    // Evicting a frame of the segment looks its users up until none of their
+    // pages maps it any more (see KernelSystem::shared_user_entry):
+    if (do_release_shared && st_ptr[entry].get_kind() == SegTableEntry::OccShared) {
+
+        owner->disconnect_shared_segment(this, shared_ssegs[entry], entry);
+
+        }
+
     // Finalize:
     st_ptr[entry].set_kind(SegTableEntry::Free);
     seg_count -= 1;
@@ -693,10 +797,10 @@ Status KernelProcess::delete_segment_ind(size_t entry, bool do_release_shared) {
 // Utility:
 void KernelProcess::set_master_table(PageAnte *page, bool newly_created) {
     
-    PRINTLN("Process setting master table.");
-
     master_table = reinterpret_cast<char*>(page);
 
+    TRACE_EVENT(MasterTableSet, owner->ks_page_ordinal(page), newly_created);
+
     ptl1_ptr = reinterpret_cast<PageTableL1Entry*>(master_table);
 
     st_ptr = reinterpret_cast<SegTableEntry*>(
@@ -704,19 +808,19 @@ void KernelProcess::set_master_table(PageAnte *page, bool newly_created) {
 
     if (newly_created) {
         
-        PRINTLN("It's newly created.");
-
         seg_count = 0;
 
-        for (size_t i = 0; i < MAX_PAGE_TABLES_L1; i += 1) {
-            
-            ptl1_ptr[i].status = PageTableL1Entry::Unused;
-            
-            }
+        std::memset(ptl1_ptr, 0, MAX_PAGE_TABLES_L1 * sizeof(PageTableL1Entry)); // All Unused
+
+        SegTableEntry free_entry;
+
+        free_entry.len_kind = 0;
+        free_entry.start_page = 0;
+        free_entry.set_kind(SegTableEntry::Free);
 
         for (size_t i = 0; i < MAX_SEGMENTS; i += 1) {
             
-            st_ptr[i].set_kind(SegTableEntry::Free);
+            st_ptr[i] = free_entry;
 
             }
         
@@ -728,23 +832,75 @@ void KernelProcess::set_master_table(PageAnte *page, bool newly_created) {
 
 PageTableL1Entry *KernelProcess::access_ptl1(VirtualAddress addr, Status &status, bool visit) {
 
-    PRINTLN("Accessing page table L1 on page " << owner->ks_page_ordinal(master_table) 
-            << " (slot = " << ((addr >> 18) & 0x03F) << ") with address " << addr << ".");
+    TRACE_WALK(AccessPtl1, owner->ks_page_ordinal(master_table), addr);
 
     if (!master_table_valid) { status = PAGE_FAULT; return nullptr; }
 
     if (visit) owner->ks_visited_page(master_table);
 
+    PageTableL1Entry *entry = ptl1_ptr + VmConfig::ptl1_slot(addr);
+
+    for (unsigned depth = 1; depth <= VmConfig::DIR_LEVELS; depth += 1) {
+
+        if (entry->status != PageTableL1Entry::Present) {
+
+            status = (entry->status == PageTableL1Entry::PagedOut) ? PAGE_FAULT : TRAP;
+
+            return nullptr;
+
+            }
+
+        auto *dir = reinterpret_cast<PageTableL1Entry*>(owner->ks_page_addr(entry->block_disk));
+
+        if (visit) owner->ks_visited_page(dir);
+
+        entry = dir + VmConfig::dir_slot(addr, depth);
+
+        }
+
     status = OK;
 
-    return ptl1_ptr + ((addr >> 18) & 0x03F);
+    return entry;
+
+    }
+
+// Like access_ptl1, but brings in directories that are paged out and, if
+// create is set, allocates missing ones. Returns nullptr if a directory is
+// missing and create is not set.
+PageTableL1Entry *KernelProcess::walk_ptl1(VirtualAddress addr, bool create) {
+
+    // Assume master table is present and locked
+
+    PageTableL1Entry *entry = ptl1_ptr + VmConfig::ptl1_slot(addr);
+
+    for (unsigned depth = 1; depth <= VmConfig::DIR_LEVELS; depth += 1) {
+
+        PageAnte *page;
+
+        if (entry->status == PageTableL1Entry::Present) {
+
+            page = owner->ks_page_addr(entry->block_disk);
+
+            }
+        else {
+
+            if (entry->status == PageTableL1Entry::Unused && !create) return nullptr;
+
+            page = table_request(entry, PageType::KsPageDir, false);
+
+            }
+
+        entry = reinterpret_cast<PageTableL1Entry*>(page) + VmConfig::dir_slot(addr, depth);
+
+        }
+
+    return entry;
 
     }
 
 PageTableL2Entry *KernelProcess::access_ptl2(VirtualAddress addr, PageTableL1Entry *ptl1e, Status &status, bool visit) {
 
-    PRINTLN("Accessing page table L2 on page " << ptl1e->block_disk 
-            << " (slot = " << ((addr >> 10) & 0x0FF) << ") with address " << addr << ".");
+    TRACE_WALK(AccessPtl2, ptl1e->block_disk, addr);
 
     if (ptl1e->status == PageTableL1Entry::Unused)   { 
         
@@ -756,20 +912,21 @@ PageTableL2Entry *KernelProcess::access_ptl2(VirtualAddress addr, PageTableL1Ent
 
     if (ptl1e->status == PageTableL1Entry::PagedOut) { status = PAGE_FAULT; return nullptr; }
 
+    if (ptl1e->status == PageTableL1Entry::Huge) { status = TRAP; return nullptr; }
+
     PageTableL2Entry *ptl2_ptr = reinterpret_cast<PageTableL2Entry*>(owner->ks_page_addr(ptl1e->block_disk));
 
     if (visit) owner->ks_visited_page(ptl2_ptr);
 
     status = OK;
 
-    return ptl2_ptr + ((addr >> 10) & 0x0FF);
+    return ptl2_ptr + VmConfig::ptl2_slot(addr);
     
     }
 
 char *KernelProcess::access_phys(VirtualAddress addr, PageTableL2Entry *ptl2e, Status &status, bool visit) {
 
-    PRINTLN("Accessing physical memory " << ptl2e->block_disk 
-            << " (offset = " << (addr & 0x03FF) << ") with address " << addr << ".");
+    TRACE_WALK(AccessPhys, ptl2e->block_disk, addr);
 
     if (!ptl2e->get_inseg()) { status = TRAP; return nullptr; }
     if (!ptl2e->get_valid()) { status = PAGE_FAULT; return nullptr; }
@@ -780,18 +937,35 @@ char *KernelProcess::access_phys(VirtualAddress addr, PageTableL2Entry *ptl2e, S
 
     status = OK;
 
-    return pp + (addr & 0x03FF);
+    return pp + VmConfig::offset(addr);
 
     }
 
 void *KernelProcess::get_pa(VirtualAddress addr) {
 
     Status status;
+
+    size_t frame = owner->ipt_lookup(pid, VmConfig::page(addr));
+
+    if (frame != KernelSystem::NULL_CLUSTER) {
+
+        return reinterpret_cast<char*>(owner->us_page_addr(frame)) + VmConfig::offset(addr);
+
+        }
     
     auto *ptl1e = access_ptl1(addr, status);
+
+    if (ptl1e->status == PageTableL1Entry::Huge) { // Large page
+
+        char *pp = reinterpret_cast<char*>(owner->us_page_addr(ptl1e->block_disk + VmConfig::ptl2_slot(addr)));
+
+        return pp + VmConfig::offset(addr);
+
+        }
+
     auto *ptl2e = access_ptl2(addr, ptl1e, status);
 
-    if (!ptl2e->get_shared()) { // Normal page
+    if (!ptl2e->get_shared() || ptl2e->get_valid()) { // Normal page, or shared page mapped directly
         
         char *pa = access_phys(addr, ptl2e, status);
 
@@ -800,20 +974,18 @@ void *KernelProcess::get_pa(VirtualAddress addr) {
         }
     else { // Shared page
         
-        VirtualAddress sseg_addr = ((VirtualAddress)ptl2e->block_disk * PAGE_SIZE) + (addr & 0x03FF); // PEP
-
-        return owner->shared_segment_pa(ptl2e->sseg_ind, sseg_addr);
+        return owner->shared_segment_pa(shared_sseg(ptl2e), shared_page(addr, ptl2e), VmConfig::offset(addr));
 
         }
 
     /*
     // Inlined manually ... PEP
 
-    auto * ptl1e = ptl1_ptr + ((addr >> 18) & 0x03F);
+    auto * ptl1e = ptl1_ptr + VmConfig::ptl1_slot(addr);
     auto * ptl2_ptr = reinterpret_cast<PageTableL2Entry*>(owner->ks_page_addr(ptl1e->block_disk));
-    auto * ptl2e = ptl2_ptr + ((addr >> 10) & 0x0FF);
+    auto * ptl2e = ptl2_ptr + VmConfig::ptl2_slot(addr);
     char * pp = reinterpret_cast<char*>(owner->us_page_addr(ptl2e->block_disk));
-    char * pa = pp + (addr & 0x03FF);
+    char * pa = pp + VmConfig::offset(addr);
 
     return (void*)pa;
     */
@@ -823,13 +995,15 @@ void *KernelProcess::get_pa(VirtualAddress addr) {
 // Bonus:
 Status KernelProcess::create_shared_segment(VirtualAddress start_addr, PageNum size, const char * name, AccessType acc_type) {
 
-    size_t ordinal = (start_addr >> 10) & 0x03FFF;
+    VirtualAddress ordinal = VmConfig::page(start_addr);
 
-    if (size > (1 << 14) || size == 0) return TRAP;
+    if (size > SegTableEntry::MAX_LENGTH || size == 0) return TRAP;
+
+    if (ordinal + size > ((VirtualAddress)1 << VmConfig::VPN_BITS)) return TRAP;
 
     if (seg_count == MAX_SEGMENTS) return TRAP;
 
-    if ((start_addr & 0x03FF) != 0) return TRAP;
+    if (!VmConfig::aligned(start_addr)) return TRAP;
 
     master_table_lock();
     PageUnlocker punl0(owner, master_table);
@@ -841,7 +1015,7 @@ Status KernelProcess::create_shared_segment(VirtualAddress start_addr, PageNum s
         if (ste.get_kind() == SegTableEntry::Free) continue;
 
         if ((ste.start_page + ste.get_length() - 1 < ordinal) ||
-            (ste.start_page > start_addr + size - 1))
+            (ste.start_page > ordinal + size - 1))
             continue;
 
         return TRAP;
@@ -851,14 +1025,8 @@ Status KernelProcess::create_shared_segment(VirtualAddress start_addr, PageNum s
     // Find shared segment:
     size_t sseg_ind;
 
-    if (!owner->shared_segment_find(name, &sseg_ind)) {
-        
-        if (owner->create_shared_segment(size, name, acc_type) != OK) {
-            return TRAP;     
-            }
-
-        owner->shared_segment_find(name, &sseg_ind);
-
+    if (owner->create_shared_segment(size, name, acc_type, &sseg_ind) != OK) { // Finds it if it exists
+        return TRAP;
         }
 
     // Find suitable entry of segment table:
@@ -875,10 +1043,12 @@ Status KernelProcess::create_shared_segment(VirtualAddress start_addr, PageNum s
 
         }
 
-    st_ptr[entry].start_page = (Uint16)ordinal;
+    st_ptr[entry].start_page = ordinal;
     st_ptr[entry].set_kind(SegTableEntry::OccShared);
     st_ptr[entry].set_length(size);
 
+    shared_ssegs[entry] = (Uint32)sseg_ind;
+
     seg_count += 1;
 
     // Connect to shared segment:
@@ -892,21 +1062,11 @@ Status KernelProcess::create_shared_segment(VirtualAddress start_addr, PageNum s
         Status status;
         PageUnlocker punl1(owner, KernelSystem::NULL_CLUSTER);
 
-        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
-
         // New way:
-        if (ptl1e->status == PageTableL1Entry::Unused) {
-            PageAnte *pa = owner->ks_request_page(PageType::KsPageTable, ptl1e, KernelSystem::NULL_CLUSTER, true);
-            ptl1e->block_disk = (Uint16)owner->ks_page_ordinal(pa);
-            ptl1e->status = PageTableL1Entry::Present;
-            init_page_table(pa);
-            punl1.reset(pa, true);
-            }
-        else {
-            size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
-            punl1.reset(ptind, true);
-            }
+        size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
+        punl1.reset(ptind, true);
 
+        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
         ptl2e = access_ptl2(start_addr + i * PAGE_SIZE, ptl1e, status, true);
 
         // Old way:
@@ -935,15 +1095,13 @@ Status KernelProcess::create_shared_segment(VirtualAddress start_addr, PageNum s
         */
 
         ptl2e->flags = static_cast<Uint8>(acc_type)
-                     | (1 << PageTableL2Entry::Valid)
+                     | (0 << PageTableL2Entry::Valid)
                      | (0 << PageTableL2Entry::Dirty)
                      | (1 << PageTableL2Entry::InSeg)
                      | (0 << PageTableL2Entry::TBC)
                      | (1 << PageTableL2Entry::Shared);
 
-        ptl2e->sseg_ind = (Uint8)sseg_ind;
-
-        ptl2e->block_disk = (Uint16)i;
+        ptl2e->set_seg_ind(entry); // Mapped directly on first access
 
         //PRINTLN("Set ptl2e for address " << start_addr + i * PAGE_SIZE);
 
@@ -964,11 +1122,22 @@ Status KernelProcess::disconnect_shared_segment(const char *name) {
 
         }
     
-    size_t local_index = owner->disconnect_shared_segment(this, sseg_ind);
+    master_table_lock();
+    PageUnlocker punl(owner, master_table);
 
-    delete_segment_ind(local_index, false);
+    for (size_t i = 0; i < MAX_SEGMENTS; i += 1) {
 
-    return OK;
+        if (st_ptr[i].get_kind() == SegTableEntry::OccShared && shared_ssegs[i] == sseg_ind) {
+
+            delete_segment_ind(i, true);
+
+            return OK;
+
+            }
+
+        }
+
+    return TRAP;
 
     }
 
@@ -991,7 +1160,7 @@ void KernelProcess::clone_segment_from(KernelProcess *source, size_t index) {
     // Assume both master tables are present and locked
 
     size_t size  = source->st_ptr[index].get_length();
-    size_t start = source->st_ptr[index].start_page;
+    VirtualAddress start = source->st_ptr[index].start_page;
     int    kind  = source->st_ptr[index].get_kind();
 
     VirtualAddress start_addr = start * PAGE_SIZE;
@@ -1010,14 +1179,33 @@ void KernelProcess::clone_segment_from(KernelProcess *source, size_t index) {
 
         }
 
-    st_ptr[entry].start_page = (Uint16)start;
+    st_ptr[entry].start_page = start;
     st_ptr[entry].set_kind(static_cast<SegTableEntry::KindEnum>(kind));
     st_ptr[entry].set_length(size);
 
     seg_count += 1;
 
+    if (kind == SegTableEntry::OccShared) { // Copy shared segment descriptor
+
+        shared_ssegs[entry] = source->shared_ssegs[index];
+
+        owner->connect_shared_segment(this, shared_ssegs[entry], entry);
+
+        }
+
     // Update page tables:
-    bool connect = true;
+
+    // Pages loaded from disk are read in batches. Their frames enter the
+    // reverse map once the batch is in, so that none is chosen as a victim
+    // while still empty, and a batch ends with its page table, which may be
+    // evicted once unlocked:
+    ClusterNo         slots[KernelSystem::DISK_BATCH];
+    size_t            frames[KernelSystem::DISK_BATCH];
+    PageTableL2Entry *entries[KernelSystem::DISK_BATCH];
+    VirtualAddress    pages[KernelSystem::DISK_BATCH];
+
+    size_t reads = 0;
+    size_t batch = owner->us_read_batch();
 
     for (size_t i = 0; i < size; i += 1) {
 
@@ -1028,20 +1216,10 @@ void KernelProcess::clone_segment_from(KernelProcess *source, size_t index) {
         PageTableL2Entry *ptl2e;       
         PageUnlocker punl1(owner, KernelSystem::NULL_CLUSTER);
       
-        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
-
-        if (ptl1e->status == PageTableL1Entry::Unused) {
-            PageAnte *pa = owner->ks_request_page(PageType::KsPageTable, ptl1e, KernelSystem::NULL_CLUSTER, true);
-            ptl1e->block_disk = (Uint16)owner->ks_page_ordinal(pa);
-            ptl1e->status = PageTableL1Entry::Present;
-            init_page_table(pa);
-            punl1.reset(pa, true);
-            }
-        else {
-            size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
-            punl1.reset(ptind, true);
-            }
+        size_t ptind = page_table_lock(start_addr + i * PAGE_SIZE);
+        punl1.reset(ptind, true);
 
+        ptl1e = access_ptl1(start_addr + i * PAGE_SIZE, status, true);
         ptl2e = access_ptl2(start_addr + i * PAGE_SIZE, ptl1e, status, true);
 
         // Get source descriptors:
@@ -1049,51 +1227,88 @@ void KernelProcess::clone_segment_from(KernelProcess *source, size_t index) {
         PageTableL2Entry *ptl2e_src;
         PageUnlocker punl1_src(owner, KernelSystem::NULL_CLUSTER);
 
+        size_t ptind_src = source->page_table_lock(start_addr + i * PAGE_SIZE);
+        punl1_src.reset(ptind_src, true);
+
         ptl1e_src = source->access_ptl1(start_addr + i * PAGE_SIZE, status, true);
+        ptl2e_src = source->access_ptl2(start_addr + i * PAGE_SIZE, ptl1e_src, status, true);
 
-        if (ptl1e_src->status == PageTableL1Entry::Unused) {
-            HALT("KernelProcess::clone_segment_from - ?????.");
-            }
-        else {
-            size_t ptind = source->page_table_lock(start_addr + i * PAGE_SIZE);
-            punl1_src.reset(ptind, true);
-            }
+        if (kind == SegTableEntry::OccShared) {
 
-        ptl2e_src = source->access_ptl2(start_addr + i * PAGE_SIZE, ptl1e_src, status, true);
+            // The source's frame can't be evicted before it has the new mapper:
+            UniqLock ul_usft = owner->rmap_reserve(2);
 
-        // Copy over:
-        std::memcpy(ptl2e, ptl2e_src, sizeof(SegTableEntry));
+            std::memcpy(ptl2e, ptl2e_src, sizeof(PageTableL2Entry));
 
-        if (kind == SegTableEntry::OccShared || ptl2e_src->get_tbc() == true) {
-            
-            if (connect && kind == SegTableEntry::OccShared) { // Copy shared segment descriptor
+            if (ptl2e->get_valid()) {
 
-                owner->connect_shared_segment(this, ptl2e_src->sseg_ind, entry);
+                owner->rmap_add(ptl2e->block_disk, pid, start + i, ptl2e->get_access());
 
-                connect = false;
+                }
+            else {
+
+                ptl2e->set_seg_ind(entry);
 
                 }
 
+            continue; // Nothing to read in batches
+
+            }
+
+        // Copy over:
+        std::memcpy(ptl2e, ptl2e_src, sizeof(PageTableL2Entry));
+
+        if (ptl2e_src->get_tbc() == true) { // Created on first access, as in the source
+
             }
         else if (!ptl2e_src->get_valid()) { // Load from disk
             
-            PageAnte *upg = owner->us_request_page(PageType::UsUserPage, ptl2e, ptl2e_src->block_disk, true);
+            PageAnte *upg = owner->us_request_page(PageType::UsUserPage, ptl2e, KernelSystem::NULL_CLUSTER, true);
 
-            ptl2e->block_disk = (Uint16)owner->us_page_ordinal(upg);
+            ptl2e->block_disk = (Uint32)owner->us_page_ordinal(upg);
 
             ptl2e->set_dirty(true);
             ptl2e->set_valid(true);
 
+            stat_add(ProcessStat::ClonedPages);
+
+            slots[reads]   = ptl2e_src->block_disk;
+            frames[reads]  = ptl2e->block_disk;
+            entries[reads] = ptl2e;
+            pages[reads]   = start + i;
+
+            reads += 1;
+
             }
         else { // Copy from OM
             
             PageAnte *upg = owner->us_clone_page(ptl2e_src->block_disk, ptl2e);
 
-            ptl2e->block_disk = (Uint16)owner->us_page_ordinal(upg);
+            stat_add(ProcessStat::ClonedPages);
+
+            ptl2e->block_disk = (Uint32)owner->us_page_ordinal(upg);
 
             ptl2e->set_dirty(true);
             ptl2e->set_valid(true);
 
+            owner->rmap_set(ptl2e->block_disk, pid, start + i, ptl2e->get_access());
+
+            }
+
+        bool table_ends = ((start + i + 1) % PAGE_TABLE_SIZE_L2 == 0);
+
+        if (reads > 0 && (reads == batch || table_ends || i == size - 1)) {
+
+            owner->us_read_pages(slots, frames, reads);
+
+            for (size_t j = 0; j < reads; j += 1) {
+
+                owner->rmap_set(frames[j], pid, pages[j], entries[j]->get_access());
+
+                }
+
+            reads = 0;
+
             }
 
         //PRINTLN("Set ptl2e for address " << start_addr + i * PAGE_SIZE);
@@ -1102,3 +1317,50 @@ void KernelProcess::clone_segment_from(KernelProcess *source, size_t index) {
 
     }
 
+
+void KernelProcess::stat_add(ProcessStat::StatEnum stat, Int64 n) {
+
+    stats[stat].fetch_add(n, std::memory_order_relaxed);
+
+    }
+
+// Counters are read one by one, without stopping the kernel
+ProcessStats KernelProcess::get_stats() const {
+
+    Int64 v[ProcessStat::COUNT];
+
+    for (size_t i = 0; i < ProcessStat::COUNT; i += 1) {
+
+        v[i] = stats[i].load(std::memory_order_relaxed);
+
+        if (v[i] < 0) v[i] = 0; // A decrement seen before its increment
+
+        }
+
+    ProcessStats rv;
+
+    rv.resident_pages = (unsigned long long)v[ProcessStat::ResidentPages];
+    rv.table_pages    = (unsigned long long)v[ProcessStat::TablePages];
+    rv.swapped_pages  = (unsigned long long)v[ProcessStat::SwappedPages];
+    rv.major_faults   = (unsigned long long)v[ProcessStat::MajorFaults];
+    rv.minor_faults   = (unsigned long long)v[ProcessStat::MinorFaults];
+    rv.cloned_pages   = (unsigned long long)v[ProcessStat::ClonedPages];
+
+    return rv;
+
+    }
+
+// Shared segment that an unmapped shared entry refers to
+size_t KernelProcess::shared_sseg(const PageTableL2Entry *pte) const {
+
+    return shared_ssegs[pte->get_seg_ind()];
+
+    }
+
+// Page within its shared segment that an address maps through an unmapped
+// shared entry (master table locked by caller)
+size_t KernelProcess::shared_page(VirtualAddress addr, const PageTableL2Entry *pte) const {
+
+    return (size_t)(VmConfig::page(addr) - st_ptr[pte->get_seg_ind()].start_page);
+
+    }
@@ -1,16 +1,36 @@
 #pragma once
 
+#include <atomic>
+
 #include "KernelSystem.hpp"
 #include "HelperStructs.hpp"
-#include "SsegControlBlock.hpp"
 #include "VmDecl.hpp"
+#include "VmGeometry.hpp"
+#include "ObjectPool.hpp"
 
 class KernelSystem;
 
+struct ProcessStat {
+
+    enum StatEnum {
+
+        ResidentPages,
+        TablePages,
+        SwappedPages,
+        MajorFaults,
+        MinorFaults,
+        ClonedPages,
+
+        COUNT
+
+        };
+
+    };
+
 // Temp:
 int main(int, char**);
 
-class KernelProcess {
+class KernelProcess : public gen::Pooled<KernelProcess> {
 
     friend class KernelSystem;
 
@@ -31,19 +51,24 @@ class KernelProcess {
 
         KernelSystem *owner;
 
+        // Accounting - kept up as frames and swap slots change hands, so
+        // that any thread may read it (see ProcessStats):
+        std::atomic<Int64> stats[ProcessStat::COUNT];
+
         // Synchronization:
-        using RecMutex = std::recursive_mutex;
-        using RaiiLock = std::lock_guard<std::recursive_mutex>;
-        using UniqLock = std::unique_lock<std::recursive_mutex>;
+        using RecMutex = KernelMutex;
+        using RaiiLock = std::lock_guard<KernelMutex>;
+        using UniqLock = std::unique_lock<KernelMutex>;
 
-        // Bonus:
-        SsegControlBlock *sscb;
+        // Held while a table of the process moves between memory and swap,
+        // and while rmap_swap_out patches one (see KernelSystem):
+        RecMutex mutex_tables;
 
     public:
     
-        static const size_t MAX_PAGE_TABLES_L1 = 64;
-        static const size_t MAX_SEGMENTS = 192;
-        static const size_t PAGE_TABLE_SIZE_L2 = 256;
+        static const size_t MAX_PAGE_TABLES_L1 = VmConfig::PTL1_ENTRIES;
+        static const size_t MAX_SEGMENTS = VmConfig::SEGMENT_ENTRIES;
+        static const size_t PAGE_TABLE_SIZE_L2 = VmConfig::PTL2_ENTRIES;
 
         static const bool MODE_IN  = true;
         static const bool MODE_OUT = false;
@@ -51,6 +76,10 @@ class KernelProcess {
         PageTableL1Entry *ptl1_ptr;
         SegTableEntry    *st_ptr;
 
+        // Index in sseg_vec of each shared segment in st_ptr (kept apart, as
+        // the segment table has no room for it):
+        Uint32 shared_ssegs[MAX_SEGMENTS];
+
         KernelProcess(KernelSystem *owner_, ProcessId pid_);
 
         ~KernelProcess();
@@ -74,19 +103,28 @@ class KernelProcess {
         void swap_page_table(bool mode, VirtualAddress addr);
         void init_page_table(PageAnte *page);
 
+        PageAnte *table_request(PageTableL1Entry *entry, PageType::TypeEnum type, bool lock);
+        void table_release(PageTableL1Entry *entry, unsigned depth);
+
         static void page_table_evict_children(KernelSystem *system, PageAnte *page, bool destroy);
+        static void directory_evict_children(KernelSystem *system, PageAnte *page);
         void master_table_evict_children(bool destroy);
 
         size_t master_table_lock();
         size_t page_table_lock(VirtualAddress addr);
 
         PageTableL1Entry *access_ptl1(VirtualAddress addr, Status &status, bool visit = false);
+        PageTableL1Entry *walk_ptl1(VirtualAddress addr, bool create);
         PageTableL2Entry *access_ptl2(VirtualAddress addr, PageTableL1Entry *ptl1e, Status &status, bool visit = false);
 
         char *access_phys(VirtualAddress addr, PageTableL2Entry *ptl2e, Status &status, bool visit = false);
 
         void *get_pa(VirtualAddress addr);
 
+        // Accounting:
+        void stat_add(ProcessStat::StatEnum stat, Int64 n = 1);
+        ProcessStats get_stats() const;
+
         // Bonus:
         Status create_shared_segment(VirtualAddress start_addr,
                                      PageNum size, const char* name, AccessType acc_type);
@@ -97,4 +135,7 @@ class KernelProcess {
 
         void clone_segment_from(KernelProcess *source, size_t index);
 
+        size_t shared_sseg(const PageTableL2Entry *pte) const;
+        size_t shared_page(VirtualAddress addr, const PageTableL2Entry *pte) const;
+
     };
@@ -6,6 +6,10 @@
 #include "Macros.hpp"
 #include "PSpecFunc.hpp"
 #include "SsegControlBlock.hpp"
+#include "Platform.hpp"
+#include "FrameScan.hpp"
+#include "Trace.hpp"
+#include "Latency.hpp"
 
 #include "Part.h"
 #include "Process.h"
@@ -13,52 +17,106 @@
 #include <iostream> // Debug
 
 #include <new>
-#include <intrin.h>
 #include <stdexcept>
 #include <random>
+#include <thread>
 #include <cstring>
 
 // Thread safety: Not needed ('Structor)
 KernelSystem::KernelSystem(PhysicalAddress userspc_, PageNum userspc_size_,
                            PhysicalAddress krnlspc_, PageNum krnlspc_size_,
-                           Partition* disk_)
+                           Partition* disk_, bool huge_pages_,
+                           TranslationMode::ModeEnum translation_)
+    : KernelSystem(userspc_, userspc_size_, krnlspc_, krnlspc_size_,
+                   std::vector<SwapArea>(1, SwapArea{ disk_, 0 }), huge_pages_, translation_) {
+
+    }
+
+// Thread safety: Not needed ('Structor)
+KernelSystem::KernelSystem(PhysicalAddress userspc_, PageNum userspc_size_,
+                           PhysicalAddress krnlspc_, PageNum krnlspc_size_,
+                           const std::vector<SwapArea> &swap_areas, bool huge_pages_,
+                           TranslationMode::ModeEnum translation_)
     : userspc(static_cast<char*>(userspc_))
     , krnlspc(static_cast<char*>(krnlspc_))
     , userspc_size(userspc_size_)
     , krnlspc_size(krnlspc_size_)
-    , disk(disk_)
-    , pcb_vec(256) {
+    , huge_pages(huge_pages_)
+    , translation(translation_)
+    , device_rotor(0)
+    , pcb_vec(SSEG_START_IND) // The rest name shared segments
+    , mutex_dvt(LockId::Dvt)
+    , mutex_databus(LockId::Databus)
+    , mutex_kslst(LockId::Kslst)
+    , mutex_uslst(LockId::Uslst)
+    , mutex_pcbvec(LockId::Pcbvec)
+    , mutex_ksft(LockId::Ksft)
+    , mutex_usft(LockId::Usft)
+    , mutex_sseg(LockId::Sseg)
+    , sseg_vec(MAX_SHARED_SEGMENTS) {
 
     ks_reserved = 0;
     us_reserved = 0;
 
-    // Frame Tables:
-    us_ft_size = DIV_CEIL(userspc_size * sizeof(FrameTableEntry), PAGE_SIZE);
-    ks_ft_size = DIV_CEIL(krnlspc_size * sizeof(FrameTableEntry), PAGE_SIZE);
+    // Frame numbers share the 24-bit field of page table entries with swap slots:
+    if (userspc_size >= NULL_CLUSTER) 
+        HALT("KernelSystem::KernelSystem - User space can't have more than " << NULL_CLUSTER - 1 << " pages.");
 
-    ks_ft_ptr = reinterpret_cast<FrameTableEntry*>(krnlspc);
-    us_ft_ptr = ks_ft_ptr + (ks_ft_size * PAGE_SIZE / sizeof(FrameTableEntry));
+    // Frame Tables:
+    us_ft_size = DIV_CEIL(FrameTable::bytes(userspc_size), PAGE_SIZE);
+    ks_ft_size = DIV_CEIL(FrameTable::bytes(krnlspc_size), PAGE_SIZE);
 
     ks_reserved += us_ft_size + ks_ft_size;
 
-    if (ks_reserved > krnlspc_size) 
-        HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + 2 << " pages to be able to work.");
+    if (ks_reserved + KS_MIN_FRAMES > krnlspc_size) 
+        HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + KS_MIN_FRAMES << " pages to be able to work.");
 
-    init_ft_entries();
+    ks_ft.place(krnlspc, krnlspc_size);
+    us_ft.place(krnlspc + ks_ft_size * PAGE_SIZE, userspc_size);
+
+    // Swap devices and their runs of the disk vacancy table:
+    if (swap_areas.empty() || swap_areas.size() > MAX_SWAP_DEVICES)
+        HALT("KernelSystem::KernelSystem - There must be 1 to " << MAX_SWAP_DEVICES << " swap partitions.");
+
+    slot_bits = SLOT_FIELD_BITS;
+
+    while (((size_t)1 << (SLOT_FIELD_BITS - slot_bits)) < swap_areas.size()) slot_bits -= 1;
+
+    slot_mask = ((ClusterNo)1 << slot_bits) - 1;
 
-    // Disk vacancy table:
     dvt_ptr = reinterpret_cast<Uint32*>(krnlspc + ks_reserved * PAGE_SIZE);
 
-    disk_size = MIN(disk->getNumOfClusters(), MAX_CLUSTERS);
+    dvt_entries = 0;
+
+    for (const SwapArea &area : swap_areas) {
+
+        SwapDevice dev;
+
+        dev.disk = area.partition;
+        dev.priority = area.priority;
+
+        // Swap is addressed in page-sized slots of CLUSTERS_PER_PAGE clusters each:
+        dev.size = MIN(dev.disk->getNumOfClusters() / VmConfig::CLUSTERS_PER_PAGE, slot_mask);
+        dev.free = dev.size;
 
-    dvt_entries = DIV_CEIL(disk_size, DVTE_SIZE);
+        dev.map = dev.disk->mapCluster(0);
+        dev.io = (dev.map == nullptr) ? new SwapScheduler(dev.disk) : nullptr;
 
-    dvt_size = DIV_CEIL(dvt_entries * sizeof(Uint32), PAGE_SIZE);
+        dev.dvt_first = dvt_entries;
+        dev.dvt_entries = (dev.size + DVTE_SIZE - 1) / DVTE_SIZE;
+
+        dvt_entries += dev.dvt_entries;
+
+        devices.push_back(dev);
+
+        }
+
+    dvt_size = (dvt_entries * sizeof(Uint32) + PAGE_SIZE - 1) / PAGE_SIZE;
 
     ks_reserved += dvt_size;
 
-    if (ks_reserved > krnlspc_size) 
-        HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + 2 << " pages to be able to work.");
+    if (ks_reserved + KS_MIN_FRAMES > krnlspc_size) 
+        HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + KS_MIN_FRAMES << " pages to be able to work.");
 
     for (size_t i = 0; i < dvt_entries; i += 1) {
         
@@ -66,32 +124,83 @@ KernelSystem::KernelSystem(PhysicalAddress userspc_, PageNum userspc_size_,
         
         }
 
-    if (disk_size % DVTE_SIZE != 0) {
+    for (const SwapDevice &dev : devices) {
+
+        if (dev.size % DVTE_SIZE == 0) continue;
 
-        for (size_t t = 0; t < (DVTE_SIZE - disk_size % DVTE_SIZE); t += 1) {
+        for (size_t t = 0; t < (DVTE_SIZE - dev.size % DVTE_SIZE); t += 1) {
         
-            dvt_ptr[dvt_entries - 1] ^= (1 << t);
+            dvt_ptr[dev.dvt_first + dev.dvt_entries - 1] ^= (1 << t);
 
             }
 
         }
 
     // Origin table:
-    ot_ptr = reinterpret_cast<Uint16*>(krnlspc + ks_reserved * PAGE_SIZE);
+    ot_ptr = reinterpret_cast<Uint32*>(krnlspc + ks_reserved * PAGE_SIZE);
 
-    ot_size = DIV_CEIL(userspc_size * sizeof(Uint16), PAGE_SIZE);
+    ot_size = DIV_CEIL(userspc_size * sizeof(Uint32), PAGE_SIZE);
 
     ks_reserved += ot_size;
 
-    if (ks_reserved > krnlspc_size) 
-        HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + 2 << " pages to be able to work.");
+    if (ks_reserved + KS_MIN_FRAMES > krnlspc_size) 
+        HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + KS_MIN_FRAMES << " pages to be able to work.");
+
+    // Reverse map (one entry per user frame):
+    rmap_ptr = reinterpret_cast<RmapEntry*>(krnlspc + ks_reserved * PAGE_SIZE);
+
+    rmap_size = DIV_CEIL(userspc_size * sizeof(RmapEntry), PAGE_SIZE);
+
+    ks_reserved += rmap_size;
+
+    if (ks_reserved + KS_MIN_FRAMES > krnlspc_size) 
+        HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + KS_MIN_FRAMES << " pages to be able to work.");
+
+    for (size_t i = 0; i < userspc_size; i += 1) {
+
+        rmap_ptr[i].mapped = 0;
+        rmap_ptr[i].chained = 0;
+
+        }
+
+    rmap_pool_head = NULL_CLUSTER;
+    rmap_pool_spare = NULL_CLUSTER;
+    rmap_pool_frames = 0;
+    rmap_pool_free = 0;
 
-    // Make linked list from empty pages:
-    us_empty_count = lst_link_empty_space(userspc, userspc_size, us_empty_lhead, us_empty_ltail);
+    // Inverted page table (bucket chain links per user frame, followed by the bucket anchors):
+    ipt_next = nullptr;
+    ipt_anchors = nullptr;
+    ipt_bits = 1;
+    ipt_size = 0;
 
-    ks_empty_count = lst_link_empty_space(krnlspc + ks_reserved * PAGE_SIZE,
-                                          krnlspc_size - ks_reserved,
-                                          ks_empty_lhead, ks_empty_ltail);
+    if (translation == TranslationMode::Inverted) {
+
+        while (((size_t)1 << ipt_bits) < userspc_size) ipt_bits += 1;
+
+        size_t buckets = (size_t)1 << ipt_bits;
+
+        ipt_next = reinterpret_cast<Uint32*>(krnlspc + ks_reserved * PAGE_SIZE);
+        ipt_anchors = ipt_next + userspc_size;
+
+        ipt_size = DIV_CEIL((userspc_size + buckets) * sizeof(Uint32), PAGE_SIZE);
+
+        ks_reserved += ipt_size;
+
+        if (ks_reserved + KS_MIN_FRAMES > krnlspc_size) 
+            HALT("KernelSystem::KernelSystem - The system needs at least " << ks_reserved + KS_MIN_FRAMES << " pages to be able to work.");
+
+        for (size_t i = 0; i < buckets; i += 1) ipt_anchors[i] = RmapEntry::NIL;
+
+        // Large pages move frames under their mappings, which the IPT doesn't track:
+        huge_pages = false;
+
+        }
+
+    // Make linked lists from empty pages:
+    us_empty.init(userspc, userspc_size);
+
+    ks_empty.init(krnlspc + ks_reserved * PAGE_SIZE, krnlspc_size - ks_reserved);
         /* Kernel space is reduced in order to house frame (and other) tables */
 
     // Other:
@@ -110,17 +219,45 @@ KernelSystem::~KernelSystem() {
     
     delete rng;
 
+#if VM_TRACE_LEVEL > VM_TRACE_OFF
+    trace::dump(VM_TRACE_FILE);
+#endif
+
+    for (SwapDevice &dev : devices) {
+
+        delete dev.io; // Sends out the writes still queued
+
+        }
+
     if (!sseg_map.empty())
         HALT("KernelSystem::~KernelSystem - Not all shared segments were deleted; memory leak!");
 
     }
 
+// Thread safety: Yes (Const after construction)
+KernelSystem::SwapDevice &KernelSystem::slot_device(ClusterNo slot) {
+
+    return devices[slot >> slot_bits];
+
+    }
+
+// Thread safety: Yes (Const after construction)
+bool KernelSystem::slot_valid(ClusterNo slot) const {
+
+    size_t device = slot >> slot_bits;
+
+    return slot != NULL_CLUSTER && device < devices.size() && (slot & slot_mask) < devices[device].size;
+
+    }
+
 // Thread safety: Not needed (Debug)
 bool KernelSystem::dvt_get(ClusterNo cluster) {
 
-    size_t entry = cluster / DVTE_SIZE;
+    ClusterNo local = cluster & slot_mask;
 
-    size_t bit = DVTE_SIZE - cluster % DVTE_SIZE - 1;
+    size_t entry = slot_device(cluster).dvt_first + local / DVTE_SIZE;
+
+    size_t bit = DVTE_SIZE - local % DVTE_SIZE - 1;
 
     return BIT_GET(dvt_ptr[entry], bit);
 
@@ -131,22 +268,57 @@ void KernelSystem::dvt_mark(ClusterNo cluster, bool free) {
 
     RaiiLock rl(mutex_dvt);
 
-    size_t entry = cluster / DVTE_SIZE;
+    SwapDevice &dev = slot_device(cluster);
+
+    ClusterNo local = cluster & slot_mask;
+
+    // A write still queued for a freed slot is of no use (and mustn't land
+    // after the slot is taken again):
+    if (free && dev.io != nullptr) dev.io->discard(local);
+
+    size_t entry = dev.dvt_first + local / DVTE_SIZE;
+
+    size_t bit = DVTE_SIZE - local % DVTE_SIZE - 1;
+
+    if (BIT_GET(dvt_ptr[entry], bit) != free) {
 
-    size_t bit = DVTE_SIZE - cluster % DVTE_SIZE - 1;
+        if (free) dev.free += 1;
+        else dev.free -= 1;
+
+        }
 
     dvt_ptr[entry] = BIT_VAL(dvt_ptr[entry], bit, (Uint32)free);
 
     }
 
 // Thread safety: Yes (mutex_dvt)
+// The slot comes from the highest-priority devices that have room; devices
+// of equal priority take turns, so that swap is striped over them.
 bool KernelSystem::dvt_acquire_cluster(ClusterNo *n) {
 
     RaiiLock rl(mutex_dvt);
 
+    size_t best = devices.size();
+
+    for (size_t k = 0; k < devices.size(); k += 1) {
+
+        size_t d = (device_rotor + k) % devices.size();
+
+        if (devices[d].free == 0) continue;
+
+        if (best == devices.size() || devices[d].priority > devices[best].priority) best = d;
+
+        }
+
+    if (best == devices.size()) return false;
+
+    device_rotor = best + 1;
+
+    SwapDevice &dev = devices[best];
+
     size_t i, found = false;
 
-    for (i = 0; i < dvt_entries; i += 1) {
+    for (i = dev.dvt_first; i < dev.dvt_first + dev.dvt_entries; i += 1) {
         
         if (dvt_ptr[i] != 0) {
             
@@ -157,20 +329,21 @@ bool KernelSystem::dvt_acquire_cluster(ClusterNo *n) {
         
         }
 
-    if (found == false) return false;
+    if (found == false) HALT("KernelSystem::dvt_acquire_cluster - Vacancy table doesn't match free count.");
 
-    unsigned long ind;
+    unsigned ind = plat::bit_scan_reverse(dvt_ptr[i]);
 
-    _BitScanReverse(&ind, dvt_ptr[i]);
+    ClusterNo local = (ClusterNo)((i - dev.dvt_first) * DVTE_SIZE + (DVTE_SIZE - ind - 1));
 
-    *n = i * DVTE_SIZE + (DVTE_SIZE - ind - 1);
+    *n = ((ClusterNo)best << slot_bits) | local;
 
     // Mark as taken:
-    //if (*n == 584)
-    //    PAUSE();
-
     dvt_ptr[i] = BIT_CLR(dvt_ptr[i], ind);
 
+    dev.free -= 1;
+
+    stats.add(StatId::DvtAllocations);
+
     return true;
 
     }
@@ -178,153 +351,159 @@ bool KernelSystem::dvt_acquire_cluster(ClusterNo *n) {
 // Thread safety: Yes (Wrapper)
 void KernelSystem::disk_put(ClusterNo n, const char *buffer) {
 
-    PRINT("Disk_put writing to cluster " << n);
-    PRINTLN(" (ordinal(us/ks) = " << us_page_ordinal(buffer) << " / " << ks_page_ordinal(buffer) << ").");
+    TRACE_WALK(DiskPut, n, buffer);
 
-    if (disk->writeCluster(n, buffer) != 1) {
-        
-        HALT("KernelSystem::disk_put - Partition failure.");
+    SwapDevice &dev = slot_device(n);
+
+    ClusterNo local = n & slot_mask;
+
+    if (dev.map != nullptr) {
+
+        stats.add(StatId::DiskWrites); // Queued writes count when sent (see get_stats)
+
+        char *slot = dev.map + local * PAGE_SIZE;
+
+        if (slot != buffer) std::memcpy(slot, buffer, PAGE_SIZE); // Else patched in place (see disk_image)
+
+        dev.disk->clustersWritten(local * VmConfig::CLUSTERS_PER_PAGE, VmConfig::CLUSTERS_PER_PAGE);
+
+        return;
 
         }
 
+    dev.io->write(local, buffer);
+
     }
 
 // Thread safety: Yes (Wrapper)
 void KernelSystem::disk_get(ClusterNo n, char *buffer) {
 
-    PRINT("Disk_get reading from cluster " << n);
-    PRINTLN(" (ordinal(us/ks) = " << us_page_ordinal(buffer) << " / " << ks_page_ordinal(buffer) << ").");
+    TRACE_WALK(DiskGet, n, buffer);
 
-    if (disk->readCluster(n, buffer) != 1) {
-        
-        HALT("KernelSystem::disk_get - Partition failure.");
+    stats.add(StatId::DiskReads);
 
-        }
+    SwapDevice &dev = slot_device(n);
 
-    }
+    ClusterNo local = n & slot_mask;
 
-// Thread safety: Not needed
-void KernelSystem::init_ft_entries() {
-    
-    for (size_t i = 0; i < krnlspc_size; i += 1) {
-        
-        new (ks_ft_ptr + i) FrameTableEntry();
-        
-        }
+    if (dev.map != nullptr) {
 
-    for (size_t i = 0; i < userspc_size; i += 1) {
+        std::memcpy(buffer, dev.map + local * PAGE_SIZE, PAGE_SIZE);
 
-        new (us_ft_ptr + i) FrameTableEntry();
+        return;
 
         }
-    
+
+    dev.io->read(local, buffer);
+
     }
 
-// Thread safety: Yes (Const)
-bool KernelSystem::access_is_ok(Uint8 requested, Uint8 granted) const {
+// Thread safety: Yes (Wrapper)
+// Writes pages to their swap slots; the schedulers batch them with the rest
+// of their queues.
+void KernelSystem::disk_put_pages(const ClusterNo *slots, char *const *buffers, size_t n) {
 
-    return ((0x8465 & (1 << ((requested << 2) | granted))) != 0);
+    if (n == 0) return;
+
+    TRACE_EVENT(DiskPutPages, n, 0);
+
+    for (size_t i = 0; i < n; i += 1) disk_put(slots[i], buffers[i]);
 
     }
 
-// Thread safety: Not needed (Constructor only)
-size_t KernelSystem::lst_link_empty_space(char *start_addr, PageNum n, PageAnte *&head, PageAnte *&tail) {
-    
-    head = new (start_addr) PageAnte();
+// Thread safety: Yes (Wrapper)
+// Reads pages from their swap slots, device by device and in ascending slot
+// order on each.
+void KernelSystem::disk_get_pages(const ClusterNo *slots, char *const *buffers, size_t n) {
 
-    PageAnte *curr = head;
+    if (n == 0) return;
 
-    for (PageNum i = 1; i < n; i += 1) {
+    TRACE_EVENT(DiskGetPages, n, 0);
 
-        PageAnte *prev = curr;
+    stats.add(StatId::DiskReads, n);
 
-        //std::cout << curr << "\n";
+    ClusterNo local[DISK_BATCH];
+    char     *dest[DISK_BATCH];
 
-        curr->next_empty = new (start_addr + i * PAGE_SIZE) PageAnte();
+    for (size_t d = 0; d < devices.size(); d += 1) {
 
-        curr = curr->next_empty;
+        SwapDevice &dev = devices[d];
 
-        //std::cout << "Diff = " << ((char*)curr - (char*)prev) << "\n";
+        size_t count = 0;
 
-        }
+        for (size_t i = 0; i < n; i += 1) {
 
-    tail = curr;
+            if ((slots[i] >> slot_bits) != d) continue;
 
-    return n;
-    
-    }
+            if (dev.map != nullptr) {
 
-// Thread safety: Not needed (Wrapped)
-PageAnte *KernelSystem::lst_get_empty_page(PageAnte *&head, PageAnte *&tail, size_t &count) {
-    
-    if (count == 0) return nullptr;
+                std::memcpy(buffers[i], dev.map + (slots[i] & slot_mask) * PAGE_SIZE, PAGE_SIZE);
 
-    PageAnte *rv = head;
+                continue;
 
-    if (head != tail) {
+                }
 
-        if (reinterpret_cast<unsigned>(rv->next_empty) == 0xcdcdcdcd) {
-            std::cout << "";
-            }
+            local[count] = slots[i] & slot_mask;
+            dest[count]  = buffers[i];
 
-        head = rv->next_empty;
+            count += 1;
 
-        }
-    else {
+            if (count == DISK_BATCH) {
 
-        head = nullptr;
-        tail = nullptr;
-        
-        }
+                dev.io->read_pages(local, dest, count);
 
-    count -= 1;
+                count = 0;
 
-    return rv;
+                }
 
-    }
+            }
 
-// Thread safety: Not needed (Wrapped)
-void KernelSystem::lst_return_page(PageAnte *page, PageAnte *&head, PageAnte *&tail, size_t &count) {
-    
-    if (head == nullptr) {
-        
-        head = page;
-        tail = page;
-        
-        }
-    else {
-        
-        tail->next_empty = page;
+        if (count > 0) dev.io->read_pages(local, dest, count);
 
-        tail = page;
-        
         }
 
-    page->next_empty = nullptr;
+    }
 
-    count += 1;
+// Thread safety: Yes (Wrapper)
+// Returns the contents of a swap slot: scratch with the slot read into it,
+// or the slot itself if its partition is memory-mapped and the caller has
+// it pinned - no one else may read or free the slot until the changes are
+// kept with disk_put(n, <returned pointer>).
+char *KernelSystem::disk_image(ClusterNo n, char *scratch, bool pinned) {
 
-    }
+    SwapDevice &dev = slot_device(n);
 
-// Thread safety: Yes (mutex_kslst, Wrapper)
-PageAnte *KernelSystem::ks_acquire_page(PageType::TypeEnum new_type, void *new_owner, bool lock) {
+    if (pinned && dev.map != nullptr) return dev.map + (n & slot_mask) * PAGE_SIZE;
 
-    UniqLock ul(mutex_kslst);
+    disk_get(n, scratch);
 
-    PageAnte *rv = lst_get_empty_page(ks_empty_lhead, ks_empty_ltail, ks_empty_count);
+    return scratch;
 
-    if (rv == nullptr) {
+    }
+
+// Thread safety: Yes (Const)
+bool KernelSystem::access_is_ok(Uint8 requested, Uint8 granted) const {
 
-        ks_swap_out( ks_get_victim() );
-        rv = lst_get_empty_page(ks_empty_lhead, ks_empty_ltail, ks_empty_count);
+    return ((0x8465 & (1 << ((requested << 2) | granted))) != 0);
 
-        }
+    }
 
-    ul.unlock();
+// Thread safety: Yes (mutex_kslst on the slow path, Wrapper)
+// Frames come from ks_empty without locking in the common case; only when it
+// runs dry is a page evicted, one thread at a time.
+PageAnte *KernelSystem::ks_acquire_page(PageType::TypeEnum new_type, void *new_owner, bool lock) {
+
+    PageAnte *rv = ks_empty.acquire();
 
     if (rv == nullptr) {
 
-        HALT("KernelSystem::ks_acquire_page - Could not acquire page.");
+        RaiiLock rl(mutex_kslst);
+
+        // Frames cached by other threads go first, then whatever the eviction
+        // frees (unless another thread takes it first):
+        ks_empty.reclaim();
+
+        while ((rv = ks_empty.acquire()) == nullptr) ks_swap_out( ks_get_victim() );
 
         }
 
@@ -334,16 +513,29 @@ PageAnte *KernelSystem::ks_acquire_page(PageType::TypeEnum new_type, void *new_o
 
     ks_ft_update(ks_page_ordinal(rv), flags, new_type, new_owner);
 
+    PCB *pcb = ks_table_process(ks_page_ordinal(rv));
+
+    if (pcb != nullptr) pcb->stat_add(ProcessStat::TablePages);
+
     return rv;
 
     }
 
-// Thread safety: Yes (mutex_kslst)
+// Thread safety: Yes (mutex_ksft, Wrapper)
 void KernelSystem::ks_free_page(size_t ordinal) {
-    
-    RaiiLock rl(mutex_kslst);
 
-    lst_return_page(ks_page_addr(ordinal), ks_empty_lhead, ks_empty_ltail, ks_empty_count);
+    {
+        RaiiLock rl(mutex_ksft);
+
+        PCB *pcb = ks_table_process(ordinal);
+
+        if (pcb != nullptr) pcb->stat_add(ProcessStat::TablePages, -1);
+
+        ks_ft.type[ordinal] = PageType::KsUnused;
+
+        }
+
+    ks_empty.release(ks_page_addr(ordinal));
 
     }
 
@@ -360,47 +552,85 @@ Victim KernelSystem::ks_get_victim() {
 
     place = dice_roll;
 
-    PASS_ON:
+    while (true) {
 
-    if (ks_ft_ptr[place].type == PageType::KsSegTable) {
-        
-        auto *ptl1_ptr = reinterpret_cast<PageTableL1Entry*>(ks_page_addr(place));
+        // Skip to the next unlocked, unreferenced frame:
+        place = fscan::find_clear(ks_ft.flags, ks_ft.ref_history, FT_LOCKED, place, krnlspc_size);
 
-        for (size_t i = 0; i < KernelProcess::MAX_PAGE_TABLES_L1; i += 1) {
-            
-            size_t pg_tbl_l2_block_disk = ptl1_ptr[i].block_disk;
+        if (place == krnlspc_size) {
+
+            place = ks_reserved;
+
+            continue;
+
+            }
+
+        Uint8 type = ks_ft.type[place];
+
+        // Frames freed after the caller found ks_empty dry are skipped too:
+        if (type != PageType::KsUnused) {
+
+            if (type != PageType::KsSegTable && type != PageType::KsPageDir) break;
 
-            if (ptl1_ptr[i].status == PageTableL1Entry::Present &&
-                !ks_ft_ptr[pg_tbl_l2_block_disk].get_locked()) {
-                
-                place = pg_tbl_l2_block_disk;
+            // Tables that map other tables are evicted bottom-up:
+            size_t descendant = ks_victim_descend(place);
+
+            if (descendant != NULL_CLUSTER) {
+
+                place = descendant;
                 break;
 
                 }
-            
+
             }
-        
+
+        place += 1;
+
+        if (place >= krnlspc_size) place = ks_reserved;
+
         }
 
-    if (ks_ft_ptr[place].get_locked()) {
-        
-        while (true) {
-            
-            place += 1;
+    return Victim(place, true, NULL_CLUSTER);
 
-            if (place >= krnlspc_size) place = ks_reserved;
+    }
 
-            if (ks_ft_ptr[place].get_locked()) continue;
+// Thread safety: Not needed (mutex_ksft locked by caller)
+// Returns a present, unlocked table below the given master table or page
+// directory, the table itself if it maps no present tables, or NULL_CLUSTER
+// if a locked table below it keeps it in memory.
+size_t KernelSystem::ks_victim_descend(size_t place) {
 
-            if (ks_ft_ptr[place].type == PageType::KsSegTable) goto PASS_ON;
+    size_t count = (ks_ft.type[place] == PageType::KsSegTable) ? KernelProcess::MAX_PAGE_TABLES_L1
+                                                                    : VmConfig::DIR_ENTRIES;
+
+    auto *entries = reinterpret_cast<PageTableL1Entry*>(ks_page_addr(place));
+
+    bool pinned = false;
+
+    for (size_t i = 0; i < count; i += 1) {
+
+        if (entries[i].status != PageTableL1Entry::Present) continue;
+
+        size_t child = entries[i].block_disk;
+
+        if (ks_ft.get_locked(child)) {
+
+            pinned = true;
+            continue;
 
-            break;
-            
             }
-        
+
+        if (ks_ft.type[child] != PageType::KsPageDir) return child;
+
+        size_t descendant = ks_victim_descend(child);
+
+        if (descendant != NULL_CLUSTER) return descendant;
+
+        pinned = true;
+
         }
 
-    return Victim(place, true, NULL_CLUSTER);
+    return (pinned ? NULL_CLUSTER : place);
 
     }
 
@@ -431,33 +661,55 @@ void KernelSystem::ks_swap_out(Victim victim) {
 
         }
 
-    // Update the state of the victim's owner:
-    Uint8  type = ks_ft_ptr[ordinal].type;
+    Uint8  type = ks_ft.type[ordinal];
+
+    void *owner = ks_ft.owner[ordinal];
+
+    // Swap out child tables first:
+    if (type == PageType::KsPageDir) KernelProcess::directory_evict_children(this, ks_page_addr(ordinal));
 
-    void *owner = ks_ft_ptr[ordinal].owner;
+    if (type == PageType::KsSegTable) static_cast<PCB*>(owner)->master_table_evict_children(false); // PEP
 
+    // The owner is updated and the table written out under the process's
+    // mutex_tables, so that rmap_swap_out finds the table either in its
+    // frame or in its slot:
+    PCB *pcb = ks_table_process(ordinal);
+
+    UniqLock ul_tables;
+
+    if (pcb != nullptr) ul_tables = UniqLock(pcb->mutex_tables);
+
+    // Update the state of the victim's owner:
     switch (type) {  
 
             case PageType::KsPageTable: {
-                // Swap out child pages - PEP
-                KernelProcess::page_table_evict_children(this, ks_page_addr(ordinal), false);
+                // Resident child pages stay, reachable through the reverse map
                 // Update owner:
                 PageTableL1Entry *ptl1e = static_cast<PageTableL1Entry*>(owner);
-                ptl1e->block_disk = (Uint16)cn;
+                ptl1e->block_disk = (Uint32)cn;
                 ptl1e->status = PageTableL1Entry::PagedOut;                
+                stats.add(StatId::EvictPageTables);
+                }
+                break;
+
+            case PageType::KsPageDir: {
+                // Update owner:
+                PageTableL1Entry *ptl1e = static_cast<PageTableL1Entry*>(owner);
+                ptl1e->block_disk = (Uint32)cn;
+                ptl1e->status = PageTableL1Entry::PagedOut;
+                stats.add(StatId::EvictPageDirs);
                 }
                 break;
 
             case PageType::KsSegTable: {
-                PCB *pcb = static_cast<PCB*>(owner);
-                // Swap out child pages - PEP
-                pcb->master_table_evict_children(false);
                 // Update owner:               
                 pcb->mt_disk = cn;
                 pcb->master_table_valid = false;           
+                stats.add(StatId::EvictSegTables);
                 }
                 break;
 
+            case PageType::KsRmapPool:
             case PageType::KsUnused:
             case PageType::KsReserved:
             case PageType::UsUserPage:
@@ -473,11 +725,10 @@ void KernelSystem::ks_swap_out(Victim victim) {
     if (write_back)
         disk_put(cn, reinterpret_cast<char*>(ks_page_addr(ordinal)));
 
-    // Update frame table:
-    ks_ft_ptr[ordinal].type = PageType::KsUnused;
+    if (ul_tables.owns_lock()) ul_tables.unlock();
 
-    // Insert into list of unused pages:
-    PRINT("Swapped out page from frame " << ordinal << " (KS).\n");
+    // Update frame table and insert into list of unused pages:
+    TRACE_EVENT(KsSwapOut, ordinal, 0);
 
     ks_free_page(ordinal);
 
@@ -509,10 +760,39 @@ void KernelSystem::ks_ft_update(PageNum entry, Uint8 flags, PageType::TypeEnum t
 
     RaiiLock rl(mutex_ksft);
 
-    //ks_ft_ptr[entry].ref_history |= FrameTableEntry::REF_TOP;
-    ks_ft_ptr[entry].flags = flags;
-    ks_ft_ptr[entry].type = type;
-    ks_ft_ptr[entry].owner = owner;
+    //ks_ft.ref_history[entry] |= FrameTable::REF_TOP;
+    ks_ft.flags[entry] = flags;
+    ks_ft.type[entry] = type;
+    ks_ft.owner[entry] = owner;
+
+    }
+
+// Thread safety: Yes (mutex_ksft)
+// Process whose page table, directory or master table a frame holds, or
+// nullptr for other frames. The tables above it must be resident, as they
+// are whenever a table is acquired or freed.
+KernelSystem::PCB *KernelSystem::ks_table_process(size_t ordinal) {
+
+    RaiiLock rl(mutex_ksft);
+
+    for (unsigned depth = 0; depth < VmConfig::PT_LEVELS; depth += 1) {
+
+        Uint8 type = ks_ft.type[ordinal];
+
+        const char *owner = static_cast<const char*>(ks_ft.owner[ordinal]);
+
+        if (type == PageType::KsSegTable) return reinterpret_cast<PCB*>(const_cast<char*>(owner));
+
+        if (type != PageType::KsPageTable && type != PageType::KsPageDir) return nullptr;
+
+        // The owner is the entry of the table one level up:
+        if (owner < krnlspc || owner >= krnlspc + krnlspc_size * PAGE_SIZE) return nullptr;
+
+        ordinal = ks_page_ordinal(owner);
+
+        }
+
+    return nullptr;
 
     }
 
@@ -521,30 +801,25 @@ void KernelSystem::ks_visited_page(void *page_ante) {
 
     /*size_t ordinal = ks_page_ordinal(page_ante);
 
-    ks_ft_ptr[ordinal].ref_history |= FrameTableEntry::REF_TOP;*/
+    ks_ft.ref_history[ordinal] |= FrameTable::REF_TOP;*/
 
     }
 
-// Thread safety: Yes (mutex_uslst, Wrapper)
+// Thread safety: Yes (mutex_uslst on the slow path, Wrapper)
+// As ks_acquire_page; a fault that finds a free frame takes no lock until it
+// updates the frame table.
 PageAnte *KernelSystem::us_acquire_page(PageType::TypeEnum new_type, void *new_owner, size_t to_ignore) {
-    
-    UniqLock ul(mutex_uslst);
 
-    PageAnte *rv = lst_get_empty_page(us_empty_lhead, us_empty_ltail, us_empty_count);
+    PageAnte *rv = us_empty.acquire();
 
     if (rv == nullptr) {
-        
-        us_swap_out( us_get_victim(to_ignore) ); // PEP
-        rv = lst_get_empty_page(us_empty_lhead, us_empty_ltail, us_empty_count);
 
-        }
+        RaiiLock rl(mutex_uslst);
 
-    ul.unlock();
+        us_empty.reclaim();
+
+        while ((rv = us_empty.acquire()) == nullptr) us_swap_out( us_get_victim(to_ignore) ); // PEP
 
-    if (rv == nullptr) {
-        
-        HALT("KernelSystem::us_acquire_page - Could not acquire page.");
-        
         }
 
     us_ft_update(us_page_ordinal(rv), FT_NONE, new_type, new_owner);
@@ -553,21 +828,29 @@ PageAnte *KernelSystem::us_acquire_page(PageType::TypeEnum new_type, void *new_o
 
     }
 
-// Thread safety: Yes (mutex_uslst, Wrapper)
+// Thread safety: Yes (mutex_usft, Wrapper)
 void KernelSystem::us_free_page(size_t ordinal) {
 
-    RaiiLock rl(mutex_uslst);
+    {
+        RaiiLock rl(mutex_usft);
 
-    lst_return_page(us_page_addr(ordinal), us_empty_lhead, us_empty_ltail, us_empty_count);
+        rmap_clear(ordinal);
+
+        us_ft.type[ordinal] = PageType::UsUnused;
+
+        }
+
+    us_empty.release(us_page_addr(ordinal));
 
     }
 
 // Thread safety: Yes (mutex_usft)
 Victim KernelSystem::us_get_victim(size_t to_ignore) {
 
-    RaiiLock rl(mutex_usft);
+    UniqLock ul(mutex_usft);
 
     size_t place = us_reserved;
+    size_t scanned = 0;
 
     std::uniform_int_distribution<size_t> distribution(us_reserved, userspc_size - 1);
 
@@ -575,9 +858,44 @@ Victim KernelSystem::us_get_victim(size_t to_ignore) {
 
     place = distribution(*rng);
 
-    if (place == to_ignore) goto RETRY;
+    // Frames still being set up by concurrent faults or clones are passed
+    // over, scanning on from the random pick for at most one lap:
+    for (scanned = 0; place == to_ignore || !rmap_ptr[place].mapped; scanned += 1) {
+
+        if (scanned == userspc_size - us_reserved) {
+
+            // None is mapped yet; the faults mapping them need mutex_usft:
+            ul.unlock();
+
+            std::this_thread::yield();
+
+            ul.lock();
+
+            goto RETRY;
+
+            }
+
+        place = (place + 1 < userspc_size) ? place + 1 : us_reserved;
+
+        }
+
+    // A large page that was accessed since it was last picked gets a second
+    // chance, as evicting one of its frames demotes the whole span:
+    if (us_ft.type[place] == PageType::UsHugePage) {
+
+        size_t base = static_cast<PageTableL1Entry*>(us_ft.owner[place])->block_disk;
+
+        if (us_ft.ref_history[base] & FrameTable::REF_TOP) {
+
+            us_ft.ref_history[base] &= ~FrameTable::REF_TOP;
+
+            goto RETRY;
+
+            }
+
+        }
 
-    return Victim(place, us_ft_ptr[place].get_dirty(), ot_ptr[place]);
+    return Victim(place, us_ft.get_dirty(place), ot_ptr[place]);
 
     }
 
@@ -604,25 +922,52 @@ void KernelSystem::us_swap_out(Victim victim) {
 
         disk_put(cn, reinterpret_cast<char*>(us_page_addr(ordinal)));
 
+        stats.add(StatId::DirtyWritebacks);
+
         }
 
+    stats.add(StatId::EvictUserPages);
+
     // Update the state of the victim's owner:
-    Uint8  type = us_ft_ptr[ordinal].type;
+    Uint8  type = us_ft.type[ordinal];
 
-    void *owner = us_ft_ptr[ordinal].owner;
+    void *owner = us_ft.owner[ordinal];
 
     switch (type) {       
 
+        case PageType::UsHugePage:
+            // Split the mapping so that only this frame leaves memory:
+            us_huge_demote(static_cast<PageTableL1Entry*>(owner));
+            // Fall through
+
         case PageType::UsUserPage: {
-            PageTableL2Entry *pte = static_cast<PageTableL2Entry*>(owner);
-            pte->block_disk = (Uint16)cn;
+            if (rmap_ptr[ordinal].chained) { // Several mappers - all are updated in one pass
+                rmap_swap_out_all(ordinal, cn);
+                break;
+                }
+            PCB *pcb = nullptr;
+            if (rmap_ptr[ordinal].mapped && rmap_ptr[ordinal].pid < SSEG_START_IND) {
+                pcb = pcb_vec.at_index(rmap_ptr[ordinal].pid);
+                if (pcb != nullptr) pcb->stat_add(ProcessStat::SwappedPages);
+                }
+            // The page table can't leave memory while its entry is updated:
+            UniqLock ul_tables;
+            if (pcb != nullptr) ul_tables = UniqLock(pcb->mutex_tables);
+            PageTableL2Entry *pte = us_owner_entry(ordinal);
+            if (pte == nullptr) { // Page table was swapped out meanwhile
+                rmap_swap_out(ordinal, rmap_ptr[ordinal], (Uint32)cn);
+                break;
+                }
+            pte->block_disk = (Uint32)cn;
             pte->set_valid(false);
             pte->set_dirty(false);
             }
             break;
 
         case PageType::KsPageTable:
+        case PageType::KsPageDir:
         case PageType::KsSegTable:
+        case PageType::KsRmapPool:
         case PageType::UsUnused:
         case PageType::UsReserved:
         case PageType::KsUnused:
@@ -633,213 +978,1459 @@ void KernelSystem::us_swap_out(Victim victim) {
    
         }
 
-    // Update frame table:
-    us_ft_ptr[ordinal].type = PageType::UsUnused;
+    // Update frame table:
+    us_ft.type[ordinal] = PageType::UsUnused;
+
+    // Insert into list of unused pages:
+    TRACE_EVENT(UsSwapOut, ordinal, 0);
+
+    us_free_page(ordinal);
+
+    }
+
+// Thread safety: Yes (Const)
+size_t KernelSystem::us_page_ordinal(const void *page_ante) const {
+
+    return ((reinterpret_cast<const char*>(page_ante) - userspc) / PAGE_SIZE);
+
+    }
+
+// Thread safety: Yes (Const)
+bool KernelSystem::us_page_validate(const void *page_ante) const {
+
+    return (((reinterpret_cast<const char*>(page_ante) - userspc) % PAGE_SIZE) == 0);
+
+    }
+
+// Thread safety: Yes (Const)
+PageAnte *KernelSystem::us_page_addr(size_t ordinal) const {
+
+    return reinterpret_cast<PageAnte*>(userspc + ordinal * PAGE_SIZE);
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+void KernelSystem::us_ft_update(PageNum entry, Uint8 flags, PageType::TypeEnum type, void *owner) {
+
+    RaiiLock rl(mutex_usft);
+
+    //us_ft.ref_history[entry] |= FrameTable::REF_TOP;
+    us_ft.flags[entry] = flags;
+    us_ft.type[entry] = type;
+    us_ft.owner[entry] = owner;
+
+    }
+
+// Thread safety: Not needed (Disabled method)
+void KernelSystem::us_visited_page(void *page_ante) {
+
+    /*size_t ordinal = us_page_ordinal(page_ante);
+
+    us_ft.ref_history[ordinal] |= FrameTable::REF_TOP;*/
+
+    }
+
+// Thread safety: Yes (Wrapper)
+PageAnte *KernelSystem::ks_request_page(PageType::TypeEnum new_type, void *new_owner, ClusterNo cluster, bool lock) {
+
+    PageAnte *page = ks_acquire_page(new_type, new_owner, lock);
+
+    if (cluster != NULL_CLUSTER) ks_read_table(page, cluster);
+
+    TRACE_EVENT(KsGrant, ks_page_ordinal(page), new_type);
+
+    return page;
+
+    }
+
+// Thread safety: Yes (Wrapper)
+// Reads a paged-out table into its frame and gives its swap slot back. The
+// tables of a process are read under its mutex_tables, held until the
+// table's entry is updated (see rmap_swap_out).
+void KernelSystem::ks_read_table(PageAnte *page, ClusterNo cluster) {
+
+    LATENCY_TIMER(latency_timer);
+
+    LATENCY_KIND(latency_timer, FaultKernelTable);
+
+    disk_get(cluster, reinterpret_cast<char*>(page));
+
+    dvt_mark(cluster, DVT_FREE);
+
+    stats.add(StatId::TableSwapIns);
+
+    }
+
+// Thread safety: Yes (mutex_usft, Wrapper)
+PageAnte *KernelSystem::us_request_page(PageType::TypeEnum new_type, void *new_owner, ClusterNo cluster, bool clone_override) {
+
+    PageAnte *page = us_acquire_page(new_type, new_owner);
+
+    size_t ordinal = us_page_ordinal(page);
+
+    RaiiLock rl(mutex_usft); // Faults of different shared segments may run side by side
+
+    if (cluster == NULL_CLUSTER){
+        ot_ptr[ordinal] = NULL_CLUSTER;
+        }
+    else {
+        ot_ptr[ordinal] = (Uint32)cluster;
+        disk_get(cluster, reinterpret_cast<char*>(page));
+        stats.add(StatId::PageSwapIns);
+        }
+
+    if (clone_override) ot_ptr[ordinal] = NULL_CLUSTER;
+    
+    TRACE_EVENT(UsGrant, ordinal, new_type);
+
+    return page;
+
+    }
+
+// Thread safety: Yes (mutex_uslst, mutex_usft, Wrapper)
+PageAnte *KernelSystem::us_load_page(PageType::TypeEnum new_type, void *new_owner, void *content) {
+
+    RaiiLock rl1(mutex_uslst);
+    RaiiLock rl2(mutex_usft);
+
+    PageAnte *page = us_acquire_page(new_type, new_owner);
+
+    size_t ordinal = us_page_ordinal(page);
+
+    ot_ptr[ordinal] = NULL_CLUSTER;
+
+    std::memcpy(page, content, PAGE_SIZE);
+
+    TRACE_EVENT(UsGrant, ordinal, new_type);
+
+    return page;
+
+    }
+
+// Thread safety: Yes (Wrapper)
+void KernelSystem::ks_evict_page(size_t ordinal, bool dirty) {
+
+    ClusterNo cluster;
+
+    if (!dvt_acquire_cluster(&cluster)) {
+        
+        HALT("KernelSystem::ks_evict_pace - Disk is full.");
+
+        }
+
+    ks_swap_out( Victim(ordinal, dirty, cluster) );
+
+    // swap_out sets block_disk to appropriate value
+
+    }
+
+// Thread safety: Yes (Wrapper)
+void KernelSystem::us_evict_page(size_t ordinal, bool dirty) {
+
+    ClusterNo cluster = ot_ptr[ordinal];
+
+    us_swap_out( Victim(ordinal, dirty, cluster) );
+
+    // swap_out sets block_disk to appropriate value
+
+    }
+
+// Thread safety: Yes (mutex_ksft, Wrapper)
+// Evicts the tables that a run of L1 entries points to. Page tables are
+// written out together, DISK_BATCH at a time; directories (whose children
+// go first) and large pages are evicted one by one.
+void KernelSystem::ks_evict_tables(PageTableL1Entry *entries, size_t n) {
+
+    RaiiLock rl(mutex_ksft);
+
+    size_t    ordinals[DISK_BATCH];
+    ClusterNo slots[DISK_BATCH];
+    char     *buffers[DISK_BATCH];
+
+    size_t count = 0;
+
+    // Batches are written and their entries updated under the process's
+    // mutex_tables (see ks_swap_out):
+    PCB *pcb = ks_table_process(ks_page_ordinal(entries));
+
+    for (size_t i = 0; i < n; i += 1) {
+
+        PageTableL1Entry *entry = entries + i;
+
+        if (entry->status == PageTableL1Entry::Huge && us_huge_evict(entry)) continue;
+
+        if (entry->status != PageTableL1Entry::Present) continue;
+
+        size_t ordinal = entry->block_disk;
+
+        if (ks_ft.type[ordinal] != PageType::KsPageTable) {
+
+            ks_evict_page(ordinal, true);
+
+            // Above method call evicts the table's children and sets status and block_disk
+
+            continue;
+
+            }
+
+        if (!dvt_acquire_cluster(slots + count)) {
+
+            HALT("KernelSystem::ks_evict_tables - Disk is full.");
+
+            }
+
+        ordinals[count] = ordinal;
+        buffers[count]  = reinterpret_cast<char*>(ks_page_addr(ordinal));
+
+        count += 1;
+
+        if (count == DISK_BATCH) {
+
+            UniqLock ul_tables;
+
+            if (pcb != nullptr) ul_tables = UniqLock(pcb->mutex_tables);
+
+            disk_put_pages(slots, buffers, count);
+
+            for (size_t j = 0; j < count; j += 1) ks_swap_out(Victim(ordinals[j], false, slots[j]));
+
+            count = 0;
+
+            }
+
+        }
+
+    if (count > 0) {
+
+        UniqLock ul_tables;
+
+        if (pcb != nullptr) ul_tables = UniqLock(pcb->mutex_tables);
+
+        disk_put_pages(slots, buffers, count);
+
+        for (size_t j = 0; j < count; j += 1) ks_swap_out(Victim(ordinals[j], false, slots[j]));
+
+        }
+
+    }
+
+// Thread safety: Yes (mutex_usft, Wrapper)
+// Evicts frames like us_evict_page (each victim's cluster is filled in from
+// the origin table), writing them back DISK_BATCH at a time. A batch is all
+// on disk before any of its frames is freed.
+void KernelSystem::us_evict_pages(Victim *victims, size_t n) {
+
+    RaiiLock rl(mutex_usft);
+
+    ClusterNo slots[DISK_BATCH];
+    char     *buffers[DISK_BATCH];
+
+    for (size_t done = 0; done < n; done += DISK_BATCH) {
+
+        size_t end = MIN(n, done + DISK_BATCH);
+
+        size_t count = 0;
+
+        for (size_t i = done; i < end; i += 1) {
+
+            Victim &victim = victims[i];
+
+            victim.cluster = ot_ptr[victim.ordinal];
+
+            if (!victim.dirty && victim.cluster != NULL_CLUSTER) continue; // Clean copy on disk
+
+            if (victim.cluster == NULL_CLUSTER && !dvt_acquire_cluster(&victim.cluster)) {
+
+                HALT("KernelSystem::us_evict_pages - Disk is full.");
+
+                }
+
+            slots[count]   = victim.cluster;
+            buffers[count] = reinterpret_cast<char*>(us_page_addr(victim.ordinal));
+
+            count += 1;
+
+            victim.dirty = false; // Written below
+
+            }
+
+        disk_put_pages(slots, buffers, count);
+
+        stats.add(StatId::DirtyWritebacks, count); // us_swap_out sees them clean
+
+        for (size_t i = done; i < end; i += 1) us_swap_out(victims[i]);
+
+        }
+
+    }
+
+// Thread safety: Yes (mutex_usft, Wrapper)
+// Reads swap slots into frames the caller has acquired, DISK_BATCH at a time.
+// Origin clusters are left to the caller.
+void KernelSystem::us_read_pages(const ClusterNo *slots, const size_t *ordinals, size_t n) {
+
+    RaiiLock rl(mutex_usft);
+
+    char *buffers[DISK_BATCH];
+
+    for (size_t done = 0; done < n; done += DISK_BATCH) {
+
+        size_t end = MIN(n, done + DISK_BATCH);
+
+        for (size_t i = done; i < end; i += 1) {
+
+            buffers[i - done] = reinterpret_cast<char*>(us_page_addr(ordinals[i]));
+
+            }
+
+        disk_get_pages(slots + done, buffers, end - done);
+
+        }
+
+    stats.add(StatId::PageSwapIns, n);
+
+    }
+
+// Thread safety: Yes (Const)
+// How many acquired frames a caller may keep out of the reverse map while
+// their reads are gathered: such frames can't be chosen as victims, so most
+// of user space is left to choose from.
+size_t KernelSystem::us_read_batch() const {
+
+    size_t frames = (userspc_size - us_reserved) / 2;
+
+    if (frames == 0) return 1;
+
+    return MIN(frames, DISK_BATCH);
+
+    }
+
+// Thread safety: Yes (mutex_ksft)
+void KernelSystem::ks_lock_page(size_t ordinal) {
+
+    RaiiLock rl(mutex_ksft);
+
+    ks_ft.set_locked(ordinal, true);
+
+    }
+
+// Thread safety: Yes (mutex_ksft)
+void KernelSystem::ks_unlock_page(size_t ordinal) {
+
+    RaiiLock rl(mutex_ksft);
+
+    ks_ft.set_locked(ordinal, false);
+
+    }
+
+// Thread safety: Yes (mutex_ksft)
+bool KernelSystem::ks_page_locked(size_t ordinal) {
+
+    RaiiLock rl(mutex_ksft);
+
+    return ks_ft.get_locked(ordinal);
+
+    }
+
+// Thread safety: Yes (mutex_ksft)
+// Locks the frame holding the given address unless it's locked already;
+// returns the frame to unlock afterwards, or NULL_CLUSTER (see PageUnlocker)
+size_t KernelSystem::ks_pin_page(const void *page_addr) {
+
+    RaiiLock rl(mutex_ksft);
+
+    size_t ordinal = ks_page_ordinal(page_addr);
+
+    if (ks_ft.get_locked(ordinal)) return NULL_CLUSTER;
+
+    ks_ft.set_locked(ordinal, true);
+
+    return ordinal;
+
+    }
+
+// Thread safety: Yes (Wrapper)
+void KernelSystem::ks_relinquish_page(size_t ordinal) {
+
+    ks_free_page(ordinal);
+
+    }
+
+// Thread safety: Yes (Wrapper)
+void KernelSystem::us_relinquish_page(size_t ordinal) {
+
+    if (ot_ptr[ordinal] != NULL_CLUSTER) {
+
+        dvt_mark(ot_ptr[ordinal], DVT_FREE);
+
+        }
+
+    us_free_page(ordinal);
+
+    }
+
+// Thread safety: Yes (Wrapper)
+void KernelSystem::relinquish_cluster(ClusterNo cluster) {
+
+    if (!slot_valid(cluster))
+        HALT("KernelSystem::relinquish_cluster - Invalid cluster index.");
+
+    dvt_mark(cluster, DVT_FREE);
+
+    }
+
+// Thread safety: Yes (mutex_uslst, mutex_usft)
+PageAnte *KernelSystem::us_acquire_run(size_t n, void *new_owner) {
+
+    RaiiLock rl1(mutex_uslst);
+    RaiiLock rl2(mutex_usft);
+
+    // Find the n-aligned window with the most free frames; windows holding
+    // reserved or large-page frames, or pages still being faulted in, can't
+    // be reclaimed:
+    size_t best = userspc_size;
+    size_t best_free = 0;
+
+    for (size_t w = DIV_CEIL(us_reserved, n) * n; w + n <= userspc_size; w += n) {
+
+        size_t free_count = 0;
+        bool usable = true;
+
+        for (size_t i = 0; i < n; i += 1) {
+
+            Uint8 type = us_ft.type[w + i];
+
+            if (type == PageType::UsUnused) free_count += 1;
+            else if (type != PageType::UsUserPage || !rmap_ptr[w + i].mapped) { usable = false; break; }
+
+            }
+
+        if (usable && free_count > best_free) {
+
+            best = w;
+            best_free = free_count;
+
+            if (free_count == n) break;
+
+            }
+
+        }
+
+    // Too fragmented - reclaiming the window would cost more than it saves:
+    if (best == userspc_size || best_free * 2 < n) return nullptr;
+
+    for (size_t i = 0; i < n; i += 1) {
+
+        if (us_ft.type[best + i] == PageType::UsUserPage)
+            us_evict_page(best + i, us_ft.get_dirty(best + i));
+
+        }
+
+    // Take the window out of the empty pages; faults don't wait for mutex_uslst,
+    // so one of them may have got a frame of it first:
+    if (!us_empty.take_run(best, n)) return nullptr;
+
+    for (size_t i = 0; i < n; i += 1) {
+
+        us_ft_update(best + i, FT_NONE, PageType::UsHugePage, new_owner);
+
+        ot_ptr[best + i] = NULL_CLUSTER;
+
+        }
+
+    return us_page_addr(best);
+
+    }
+
+// Thread safety: Not needed (Master table locked by caller)
+bool KernelSystem::us_huge_eligible(PCB *pcb, VirtualAddress addr, size_t *segment) {
+
+    const size_t n = KernelProcess::PAGE_TABLE_SIZE_L2;
+
+    VirtualAddress first = VmConfig::page(addr) & ~(VirtualAddress)(n - 1);
+
+    for (size_t i = 0; i < KernelProcess::MAX_SEGMENTS; i += 1) {
+
+        SegTableEntry &ste = pcb->st_ptr[i];
+
+        if (ste.get_kind() != SegTableEntry::Occupied) continue;
+
+        if (ste.start_page <= first && ste.start_page + ste.get_length() >= first + n) {
+
+            *segment = i;
+            return true;
+
+            }
+
+        }
+
+    return false;
+
+    }
+
+// Thread safety: Yes (mutex_uslst, mutex_usft, Wrapper)
+bool KernelSystem::us_huge_promote(PCB *pcb, VirtualAddress addr, PageTableL1Entry *ptl1e) {
+
+    const size_t n = KernelProcess::PAGE_TABLE_SIZE_L2;
+
+    size_t segment;
+
+    if (!huge_pages || ptl1e->status != PageTableL1Entry::Present) return false;
+
+    if (n > userspc_size - us_reserved || !us_huge_eligible(pcb, addr, &segment)) return false;
+
+    RaiiLock rl1(mutex_uslst);
+    RaiiLock rl2(mutex_usft);
+
+    size_t pt = ptl1e->block_disk;
+
+    PageUnlocker pin(this, ks_pin_page(ks_page_addr(pt)));
+
+    PageAnte *run = us_acquire_run(n, ptl1e);
+
+    if (run == nullptr) return false;
+
+    // Collapse the page table into the run:
+    auto *ptl2_ptr = reinterpret_cast<PageTableL2Entry*>(ks_page_addr(pt));
+
+    size_t base = us_page_ordinal(run);
+
+    // Swap-ins are gathered and read together (the run's frames aren't
+    // mapped yet, so none of them can be chosen as a victim meanwhile):
+    ClusterNo slots[DISK_BATCH];
+    size_t    ordinals[DISK_BATCH];
+
+    size_t reads = 0;
+
+    for (size_t i = 0; i < n; i += 1) {
+
+        PageTableL2Entry &pte = ptl2_ptr[i];
+
+        char *dst = reinterpret_cast<char*>(us_page_addr(base + i));
+
+        if (pte.get_valid()) { // Migrate resident page, keeping its origin cluster
+
+            size_t src = pte.block_disk;
+
+            std::memcpy(dst, us_page_addr(src), PAGE_SIZE);
+
+            ot_ptr[base + i] = ot_ptr[src];
+            us_ft.set_dirty(base + i, us_ft.get_dirty(src));
+
+            us_free_page(src);
+
+            }
+        else if (!pte.get_tbc()) { // Swap in; the cluster stays as the page's origin
+
+            slots[reads] = pte.block_disk;
+            ordinals[reads] = base + i;
+
+            reads += 1;
+
+            pcb->stat_add(ProcessStat::SwappedPages, -1);
+
+            if (reads == DISK_BATCH) {
+
+                us_read_pages(slots, ordinals, reads);
+
+                reads = 0;
+
+                }
+
+            ot_ptr[base + i] = pte.block_disk;
+
+            }
+        else { // Not created yet; eviction leaves it so unless it is written
+
+            us_ft.set_fresh(base + i, true);
+
+            }
+
+        }
+
+    us_read_pages(slots, ordinals, reads);
+
+    ptl1e->access = static_cast<Uint8>(ptl2_ptr[0].get_access());
+    ptl1e->block_disk = (Uint32)base;
+    ptl1e->status = PageTableL1Entry::Huge;
+
+    us_ft.ref_history[base] = FrameTable::REF_TOP; // Referenced by the fault
+
+    VirtualAddress first = VmConfig::page(addr) & ~(VirtualAddress)(n - 1);
+
+    for (size_t i = 0; i < n; i += 1) {
+
+        rmap_set(base + i, pcb->get_pid(), first + i, static_cast<AccessType>(ptl1e->access));
+
+        }
+
+    pin.unlock();
+    ks_relinquish_page(pt);
+
+    TRACE_EVENT(HugePromote, pt, base);
+
+    return true;
+
+    }
+
+// Thread safety: Yes (mutex_usft, Wrapper)
+void KernelSystem::us_huge_demote(PageTableL1Entry *ptl1e) {
+
+    const size_t n = KernelProcess::PAGE_TABLE_SIZE_L2;
+
+    RaiiLock rl(mutex_usft);
+
+    if (ptl1e->status != PageTableL1Entry::Huge) return; // Demoted by a concurrent eviction
+
+    // Keep the table holding the entry in memory while the new page table is acquired:
+    PageUnlocker pin(this, ks_pin_page(ptl1e));
+
+    PageAnte *page = ks_request_page(PageType::KsPageTable, ptl1e, NULL_CLUSTER, true);
+
+    auto *ptl2_ptr = reinterpret_cast<PageTableL2Entry*>(page);
+
+    size_t base = ptl1e->block_disk;
+
+    for (size_t i = 0; i < n; i += 1) {
+
+        ptl2_ptr[i].block_disk = (Uint32)(base + i);
+        ptl2_ptr[i].flags = ptl1e->access
+                          | (1 << PageTableL2Entry::Valid)
+                          | ((us_ft.get_dirty(base + i) ? 1 : 0) << PageTableL2Entry::Dirty)
+                          | (1 << PageTableL2Entry::InSeg);
+
+        us_ft.type[base + i] = PageType::UsUserPage;
+        us_ft.owner[base + i] = ptl2_ptr + i;
+
+        }
+
+    size_t pt = ks_page_ordinal(page);
+
+    ptl1e->block_disk = (Uint32)pt;
+    ptl1e->status = PageTableL1Entry::Present;
+
+    ks_unlock_page(pt);
+
+    TRACE_EVENT(HugeDemote, base, pt);
+
+    }
+
+// Thread safety: Yes (mutex_usft, Wrapper)
+// Returns false if the span was demoted before the call got to it.
+bool KernelSystem::us_huge_evict(PageTableL1Entry *ptl1e) {
+
+    const size_t n = KernelProcess::PAGE_TABLE_SIZE_L2;
+
+    RaiiLock rl(mutex_usft);
+
+    if (ptl1e->status != PageTableL1Entry::Huge) return false;
+
+    // The page table is built directly in its swap slot, as the master
+    // table that would own a fresh page table frame is itself being evicted:
+    char image[PAGE_SIZE];
+
+    auto *ptl2_ptr = reinterpret_cast<PageTableL2Entry*>(image);
+
+    Victim victims[n];
+
+    size_t count = 0;
+
+    size_t base = ptl1e->block_disk;
+
+    for (size_t i = 0; i < n; i += 1) {
+
+        if (us_ft.get_fresh(base + i) && !us_ft.get_dirty(base + i)) { // Never written - nothing to keep
+
+            ptl2_ptr[i].block_disk = 0;
+            ptl2_ptr[i].flags = ptl1e->access
+                              | (1 << PageTableL2Entry::TBC)
+                              | (1 << PageTableL2Entry::InSeg);
+
+            us_free_page(base + i);
+
+            continue;
+
+            }
+
+        ptl2_ptr[i].block_disk = (Uint32)(base + i);
+        ptl2_ptr[i].flags = ptl1e->access
+                          | (1 << PageTableL2Entry::Valid)
+                          | (1 << PageTableL2Entry::InSeg);
+
+        us_ft.type[base + i] = PageType::UsUserPage;
+        us_ft.owner[base + i] = ptl2_ptr + i;
+
+        victims[count] = Victim(base + i, us_ft.get_dirty(base + i), NULL_CLUSTER);
+
+        count += 1;
+
+        }
+
+    us_evict_pages(victims, count);
+
+    // Above method call clears valid and dirty bits and sets block_disk
+
+    ClusterNo cn;
+
+    if (!dvt_acquire_cluster(&cn)) {
+
+        HALT("KernelSystem::us_huge_evict - Disk is full.");
+
+        }
+
+    disk_put(cn, image);
+
+    ptl1e->block_disk = (Uint32)cn;
+    ptl1e->status = PageTableL1Entry::PagedOut;
+
+    return true;
+
+    }
+
+// Thread safety: Yes (Const)
+size_t KernelSystem::ipt_hash(ProcessId pid, VirtualAddress page) const {
+
+    Uint64 key = ((Uint64)pid << 40) ^ (Uint64)page;
+
+    key *= 0x9E3779B97F4A7C15ull; // Fibonacci hashing
+
+    return (size_t)(key >> (64 - ipt_bits));
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+// Records which page a user frame holds, replacing any previous mappers;
+// with an inverted page table, the frame is also entered into its bucket.
+// Only the slot of the pid is recorded (see pcb_vec).
+void KernelSystem::rmap_set(size_t ordinal, ProcessId pid, VirtualAddress page, AccessType access) {
+
+    pid = (ProcessId)pid_slot(pid);
+
+    RaiiLock rl(mutex_usft);
+
+    rmap_clear(ordinal);
+
+    RmapEntry &rme = rmap_ptr[ordinal];
+
+    rme.page = page;
+    rme.pid = pid;
+    rme.access = static_cast<Uint8>(access);
+    rme.mapped = 1;
+
+    rmap_account(rme, 1);
+
+    if (translation == TranslationMode::Inverted) {
+
+        size_t bucket = ipt_hash(pid, page);
+
+        ipt_next[ordinal] = ipt_anchors[bucket];
+        ipt_anchors[bucket] = (Uint32)ordinal;
+
+        }
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+// Adds a mapper to a frame. The first extra mapper moves the frame's
+// mapping into a list; such frames leave the IPT and are translated
+// through the page tables. The list nodes come from rmap_reserve(2).
+void KernelSystem::rmap_add(size_t ordinal, ProcessId pid, VirtualAddress page, AccessType access) {
+
+    pid = (ProcessId)pid_slot(pid);
+
+    RaiiLock rl(mutex_usft);
+
+    RmapEntry &rme = rmap_ptr[ordinal];
+
+    if (!rme.mapped) {
+
+        rmap_set(ordinal, pid, page, access);
+
+        return;
+
+        }
+
+    if (!rme.chained) {
+
+        ipt_unlink(ordinal);
+
+        Uint32 first = rmap_node_alloc();
+
+        rmap_node(first)->mapping = rme;
+        rmap_node(first)->next = RmapLink::NIL;
+
+        rme.page = first;
+        rme.chained = 1;
+
+        }
+
+    Uint32 h = rmap_node_alloc();
+
+    RmapLink *link = rmap_node(h);
+
+    link->mapping.page = page;
+    link->mapping.pid = pid;
+    link->mapping.access = static_cast<Uint8>(access);
+    link->mapping.mapped = 1;
+    link->mapping.chained = 0;
+
+    rmap_account(link->mapping, 1);
+
+    link->next = (Uint32)rme.page;
+
+    rme.page = h;
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+// Removes one mapper of a frame; a frame left with a single mapper goes
+// back to an inline entry.
+void KernelSystem::rmap_remove(size_t ordinal, ProcessId pid, VirtualAddress page) {
+
+    pid = (ProcessId)pid_slot(pid);
+
+    RaiiLock rl(mutex_usft);
+
+    RmapEntry &rme = rmap_ptr[ordinal];
+
+    if (!rme.chained) {
+
+        if (rme.mapped && rme.pid == pid && rme.page == page) rmap_clear(ordinal);
+
+        return;
+
+        }
+
+    Uint32 head = (Uint32)rme.page;
+
+    for (Uint32 h = head, prev = RmapLink::NIL; h != RmapLink::NIL; prev = h, h = rmap_node(h)->next) {
+
+        const RmapEntry &m = rmap_node(h)->mapping;
+
+        if (m.pid != pid || m.page != page) continue;
+
+        if (prev == RmapLink::NIL) head = rmap_node(h)->next;
+        else rmap_node(prev)->next = rmap_node(h)->next;
+
+        rmap_account(m, -1);
+
+        rmap_node_free(h);
+
+        break;
+
+        }
+
+    if (rmap_node(head)->next == RmapLink::NIL) {
+
+        RmapEntry last = rmap_node(head)->mapping;
+
+        rmap_account(last, -1); // Entered again by rmap_set
+
+        rmap_node_free(head);
+
+        rme.chained = 0;
+        rme.mapped = 0;
+
+        rmap_set(ordinal, (ProcessId)last.pid, last.page, static_cast<AccessType>(last.access));
+
+        }
+    else {
+
+        rme.page = head;
+
+        }
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+size_t KernelSystem::rmap_count(size_t ordinal) {
+
+    RaiiLock rl(mutex_usft);
+
+    if (!rmap_ptr[ordinal].chained) return rmap_ptr[ordinal].mapped;
+
+    size_t count = 0;
+
+    for (Uint32 h = (Uint32)rmap_ptr[ordinal].page; h != RmapLink::NIL; h = rmap_node(h)->next) count += 1;
+
+    return count;
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+// Returns the frame holding the page, or NULL_CLUSTER if it isn't resident
+// or the system doesn't use an IPT.
+size_t KernelSystem::ipt_lookup(ProcessId pid, VirtualAddress page) {
+
+    if (translation != TranslationMode::Inverted) return NULL_CLUSTER;
+
+    pid = (ProcessId)pid_slot(pid);
+
+    RaiiLock rl(mutex_usft);
+
+    for (Uint32 f = ipt_anchors[ipt_hash(pid, page)]; f != RmapEntry::NIL; f = ipt_next[f]) {
+
+        if (rmap_ptr[f].page == page && rmap_ptr[f].pid == pid) return f;
+
+        }
+
+    return NULL_CLUSTER;
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+void KernelSystem::ipt_unlink(size_t ordinal) {
+
+    RaiiLock rl(mutex_usft);
+
+    RmapEntry &rme = rmap_ptr[ordinal];
+
+    if (translation != TranslationMode::Inverted || !rme.mapped || rme.chained) return;
+
+    Uint32 *link = ipt_anchors + ipt_hash((ProcessId)rme.pid, rme.page);
+
+    while (*link != ordinal) link = ipt_next + *link;
+
+    *link = ipt_next[ordinal];
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+void KernelSystem::rmap_clear(size_t ordinal) {
+
+    RaiiLock rl(mutex_usft);
+
+    RmapEntry &rme = rmap_ptr[ordinal];
+
+    if (rme.chained) {
+
+        Uint32 h = (Uint32)rme.page;
+
+        while (h != RmapLink::NIL) {
+
+            Uint32 next = rmap_node(h)->next;
+
+            rmap_account(rmap_node(h)->mapping, -1);
+
+            rmap_node_free(h);
+
+            h = next;
+
+            }
+
+        }
+    else if (rme.mapped) {
+
+        ipt_unlink(ordinal);
+
+        rmap_account(rme, -1);
+
+        }
+
+    rme.mapped = 0;
+    rme.chained = 0;
+
+    }
+
+// Thread safety: Yes (Atomic)
+// Counts a mapping in or out of its process's resident pages; mappings of
+// shared segments belong to no process.
+void KernelSystem::rmap_account(const RmapEntry &mapping, Int64 n) {
+
+    if (mapping.pid >= SSEG_START_IND) return;
+
+    PCB *pcb = pcb_vec.at_index(mapping.pid); // A process releases its frames before leaving pcb_vec
+
+    if (pcb != nullptr) pcb->stat_add(ProcessStat::ResidentPages, n);
+
+    }
+
+// Thread safety: Yes (Const)
+RmapPoolHeader *KernelSystem::rmap_pool_header(size_t frame) const {
+
+    return reinterpret_cast<RmapPoolHeader*>(ks_page_addr(frame));
+
+    }
+
+// Thread safety: Yes (Const)
+RmapLink *KernelSystem::rmap_node(Uint32 handle) const {
+
+    char *frame = reinterpret_cast<char*>(ks_page_addr(handle / RMAP_POOL_NODES));
+
+    return reinterpret_cast<RmapLink*>(frame) + handle % RMAP_POOL_NODES;
+
+    }
+
+// Thread safety: Yes (mutex_usft, Wrapper)
+// Returns holding mutex_usft, with at least the given number of pool nodes
+// free. Pool frames come from kernel space, whose lock goes before
+// mutex_usft, so the caller must not hold it.
+KernelSystem::UniqLock KernelSystem::rmap_reserve(size_t nodes) {
+
+    rmap_pool_trim();
+
+    UniqLock ul(mutex_usft);
+
+    while (rmap_pool_free < nodes) {
+
+        ul.unlock();
+
+        size_t frame = ks_page_ordinal(ks_acquire_page(PageType::KsRmapPool, nullptr, true));
+
+        ul.lock(); // Other threads may have used up the pool meanwhile
+
+        RmapPoolHeader *hdr = rmap_pool_header(frame);
+
+        hdr->live = 0;
+        hdr->free = RmapLink::NIL;
+        hdr->next_frame = (Uint32)rmap_pool_head;
+
+        for (size_t i = RMAP_POOL_NODES - 1; i >= 1; i -= 1) {
+
+            Uint32 h = (Uint32)(frame * RMAP_POOL_NODES + i);
+
+            rmap_node(h)->next = hdr->free;
+            hdr->free = h;
+
+            }
+
+        rmap_pool_head = frame;
+        rmap_pool_frames += 1;
+        rmap_pool_free += RMAP_POOL_NODES - 1;
+
+        }
+
+    return ul;
+
+    }
+
+// Thread safety: Yes (mutex_usft, Wrapper)
+// Gives the pool frames emptied by rmap_node_free back to kernel space;
+// the caller must not hold mutex_usft (see rmap_reserve).
+void KernelSystem::rmap_pool_trim() {
+
+    size_t frame;
+
+    {
+        RaiiLock rl(mutex_usft);
+
+        frame = rmap_pool_spare;
+
+        rmap_pool_spare = NULL_CLUSTER;
+
+        for (size_t f = frame; f != NULL_CLUSTER; f = rmap_pool_header(f)->next_frame) rmap_pool_frames -= 1;
+
+        }
+
+    while (frame != NULL_CLUSTER) {
+
+        size_t next = rmap_pool_header(frame)->next_frame;
+
+        // Stays locked until handed out again, so that it is never picked as a victim:
+        ks_relinquish_page(frame);
+
+        frame = next;
+
+        }
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+// Nodes are taken from the pool set up by rmap_reserve. Pool frames stay
+// locked while any of their nodes is in use, as nodes are addressed by
+// position.
+Uint32 KernelSystem::rmap_node_alloc() {
+
+    RaiiLock rl(mutex_usft);
+
+    size_t frame = rmap_pool_head;
+
+    while (frame != NULL_CLUSTER && rmap_pool_header(frame)->free == RmapLink::NIL) {
+
+        frame = rmap_pool_header(frame)->next_frame;
+
+        }
+
+    if (frame == NULL_CLUSTER) {
+
+        HALT("KernelSystem::rmap_node_alloc - No pool node was reserved.");
+
+        }
+
+    RmapPoolHeader *hdr = rmap_pool_header(frame);
+
+    Uint32 h = hdr->free;
+
+    hdr->free = rmap_node(h)->next;
+    hdr->live += 1;
+
+    rmap_pool_free -= 1;
+
+    return h;
+
+    }
+
+// Thread safety: Yes (mutex_usft)
+// A frame left empty moves to rmap_pool_spare, as mutex_usft may be held by
+// callers further up and kernel space can't be entered under it.
+void KernelSystem::rmap_node_free(Uint32 handle) {
+
+    RaiiLock rl(mutex_usft);
+
+    size_t frame = handle / RMAP_POOL_NODES;
+
+    RmapPoolHeader *hdr = rmap_pool_header(frame);
+
+    rmap_node(handle)->next = hdr->free;
+    hdr->free = handle;
+    hdr->live -= 1;
+
+    rmap_pool_free += 1;
+
+    if (hdr->live != 0) return;
+
+    if (rmap_pool_head == frame) {
+
+        rmap_pool_head = hdr->next_frame;
+
+        }
+    else {
+
+        size_t prev = rmap_pool_head;
+
+        while (rmap_pool_header(prev)->next_frame != frame) prev = rmap_pool_header(prev)->next_frame;
+
+        rmap_pool_header(prev)->next_frame = hdr->next_frame;
+
+        }
+
+    rmap_pool_free -= RMAP_POOL_NODES - 1;
+
+    hdr->next_frame = (Uint32)rmap_pool_spare;
+    rmap_pool_spare = frame;
+
+    }
+
+// Thread safety: Not needed (mutex_usft held by caller)
+// Owner pointers of user pages are only hints: a page table can leave memory
+// while its pages stay resident, and its frame can then be reused. The hint
+// holds while it points at a live entry mapping the frame - at most one
+// such entry exists, as private pages have a single mapper. Entries of
+// shared segments are found through the reverse map instead, since the
+// control block that a hint points into may be gone.
+PageTableL2Entry *KernelSystem::us_owner_entry(size_t ordinal) {
+
+    auto *pte = static_cast<PageTableL2Entry*>(us_ft.owner[ordinal]);
+
+    if (pte == nullptr) return nullptr;
+
+    const char *p = reinterpret_cast<const char*>(pte);
+
+    if (p >= krnlspc && p < krnlspc + krnlspc_size * PAGE_SIZE) {
+
+        if (ks_ft.type[ks_page_ordinal(p)] != PageType::KsPageTable) return nullptr;
+
+        }
+    else { // Entry of a shared segment, or of a table built outside kernel space (see us_huge_evict)
+
+        size_t sseg_ind, page;
+
+        if (rmap_shared_origin(ordinal, &sseg_ind, &page)) {
+
+            ReadLock rl(mutex_sseg);
+
+            SsegControlBlock *sscb = sseg_vec.at_index(sseg_ind);
+
+            if (sscb == nullptr || page >= sscb->pages.size()) return nullptr;
+
+            pte = &(sscb->pages[page]);
+
+            }
+
+        }
+
+    if (pte->get_shared() || !pte->get_valid() || pte->block_disk != ordinal) return nullptr;
+
+    return pte;
+
+    }
+
+// Thread safety: Yes (mutex_usft, mutex_tables of the mapper)
+// Marks an evicted frame as not present in the entry of one of its
+// mappers, whose page table may have left memory. The mapper's tables are
+// walked without bringing them in (which could need more kernel frames than
+// are free): those that are paged out are read into a scratch image (or used
+// in place if the partition is mapped, as no swap-in can read them while
+// mutex_tables is held), and the page table is patched in its swap slot.
+void KernelSystem::rmap_swap_out(size_t ordinal, const RmapEntry &mapping, Uint32 block_disk) {
+
+    RaiiLock rl(mutex_usft);
+
+    if (mapping.pid >= SSEG_START_IND) { // Page of a shared segment - its entry is always at hand
+
+        PageTableL2Entry &pte = sseg_get(mapping.pid - SSEG_START_IND)->pages[(size_t)mapping.page];
+
+        pte.block_disk = block_disk;
+        pte.set_valid(false);
+        pte.set_dirty(false);
+
+        return;
+
+        }
+
+    // A process releases its frames before leaving pcb_vec:
+    PCB *pcb = pcb_vec.at_index(mapping.pid);
+
+    // Keeps the tables from being swapped in or out during the walk; a table
+    // read from its slot is patched and written back before anyone else
+    // reads the slot:
+    RaiiLock rl_tables(pcb->mutex_tables);
+
+    VirtualAddress addr = (VirtualAddress)mapping.page * PAGE_SIZE;
+
+    char image[PAGE_SIZE];
+
+    char *table;
+    ClusterNo slot = NULL_CLUSTER; // Swap slot of the table, if it's paged out
+
+    if (pcb->master_table_valid) {
+
+        table = pcb->master_table;
+
+        }
+    else {
+
+        slot = pcb->mt_disk;
+        table = disk_image(slot, image, true); // Pinned by mutex_tables
+
+        }
+
+    PageTableL1Entry *entry = reinterpret_cast<PageTableL1Entry*>(table) + VmConfig::ptl1_slot(addr);
 
-    // Insert into list of unused pages:
-    PRINT("Swapped out page from frame " << ordinal << " (US).\n");
+    for (unsigned depth = 1; ; depth += 1) {
 
-    us_free_page(ordinal);
+        if (entry->status == PageTableL1Entry::Present) {
 
-    }
+            table = reinterpret_cast<char*>(ks_page_addr(entry->block_disk));
+            slot = NULL_CLUSTER;
 
-// Thread safety: Yes (Const)
-size_t KernelSystem::us_page_ordinal(const void *page_ante) const {
+            }
+        else if (entry->status == PageTableL1Entry::PagedOut) {
 
-    return ((reinterpret_cast<const char*>(page_ante) - userspc) / PAGE_SIZE);
+            slot = entry->block_disk;
+            table = disk_image(slot, image, true);
 
-    }
+            }
+        else {
 
-// Thread safety: Yes (Const)
-bool KernelSystem::us_page_validate(const void *page_ante) const {
+            HALT("KernelSystem::rmap_swap_out - Mapped page has no page table (frame " << ordinal << ").");
 
-    return (((reinterpret_cast<const char*>(page_ante) - userspc) % PAGE_SIZE) == 0);
+            }
 
-    }
+        if (depth > VmConfig::DIR_LEVELS) break;
 
-// Thread safety: Yes (Const)
-PageAnte *KernelSystem::us_page_addr(size_t ordinal) const {
+        entry = reinterpret_cast<PageTableL1Entry*>(table) + VmConfig::dir_slot(addr, depth);
 
-    return reinterpret_cast<PageAnte*>(userspc + ordinal * PAGE_SIZE);
+        }
+
+    PageTableL2Entry *pte = reinterpret_cast<PageTableL2Entry*>(table) + VmConfig::ptl2_slot(addr);
+
+    pte->block_disk = block_disk;
+    pte->set_valid(false);
+    pte->set_dirty(false);
+
+    if (slot != NULL_CLUSTER) disk_put(slot, table);
 
     }
 
-// Thread safety: Yes (mutex_usft)
-void KernelSystem::us_ft_update(PageNum entry, Uint8 flags, PageType::TypeEnum type, void *owner) {
+// Thread safety: Yes (mutex_usft, Wrapper)
+// Evicts a frame with several mappers. For a page of a shared segment, only
+// the segment's own process records the swap slot; the processes connected
+// to the segment go back to referring to the segment's page.
+void KernelSystem::rmap_swap_out_all(size_t ordinal, ClusterNo cn) {
 
     RaiiLock rl(mutex_usft);
 
-    //us_ft_ptr[entry].ref_history |= FrameTableEntry::REF_TOP;
-    us_ft_ptr[entry].flags = flags;
-    us_ft_ptr[entry].type = type;
-    us_ft_ptr[entry].owner = owner;
+    size_t sseg_ind;
 
-    }
+    bool shared = rmap_shared_origin(ordinal, &sseg_ind);
 
-// Thread safety: Not needed (Disabled method)
-void KernelSystem::us_visited_page(void *page_ante) {
+    for (Uint32 h = (Uint32)rmap_ptr[ordinal].page; h != RmapLink::NIL; h = rmap_node(h)->next) {
 
-    /*size_t ordinal = us_page_ordinal(page_ante);
+        const RmapEntry &m = rmap_node(h)->mapping;
 
-    us_ft_ptr[ordinal].ref_history |= FrameTableEntry::REF_TOP;*/
+        bool origin = !shared || m.pid >= SSEG_START_IND;
+
+        rmap_swap_out(ordinal, m, origin ? (Uint32)cn : (Uint32)shared_user_entry(sseg_ind, m));
+
+        }
 
     }
 
-// Thread safety: Yes (Wrapper)
-PageAnte *KernelSystem::ks_request_page(PageType::TypeEnum new_type, void *new_owner, ClusterNo cluster, bool lock) {
+// Thread safety: Yes (mutex_usft)
+// Finds the shared segment a frame belongs to among its mappers, and the
+// page of the segment it holds
+bool KernelSystem::rmap_shared_origin(size_t ordinal, size_t *sseg_ind, size_t *page) {
 
-    PageAnte *page = ks_acquire_page(new_type, new_owner, lock);
+    RaiiLock rl(mutex_usft);
 
-    if (cluster != NULL_CLUSTER) {
-        
-        disk_get(cluster, reinterpret_cast<char*>(page));
+    const RmapEntry &rme = rmap_ptr[ordinal];
+
+    if (!rme.mapped) return false;
+
+    if (!rme.chained) {
 
-        dvt_mark(cluster, DVT_FREE);
+        if (rme.pid < SSEG_START_IND) return false;
+
+        *sseg_ind = rme.pid - SSEG_START_IND;
+
+        if (page != nullptr) *page = (size_t)rme.page;
+
+        return true;
 
         }
 
-    PRINT( "System gave page " << ks_page_ordinal(page) << " (KS) to user process; Type = " << new_type << ".\n");
+    for (Uint32 h = (Uint32)rme.page; h != RmapLink::NIL; h = rmap_node(h)->next) {
 
-    return page;
+        const RmapEntry &m = rmap_node(h)->mapping;
 
-    }
+        if (m.pid >= SSEG_START_IND) {
 
-// Thread safety: Yes (Wrapper)
-PageAnte *KernelSystem::us_request_page(PageType::TypeEnum new_type, void *new_owner, ClusterNo cluster, bool clone_override) {
+            *sseg_ind = m.pid - SSEG_START_IND;
 
-    PageAnte *page = us_acquire_page(new_type, new_owner);
+            if (page != nullptr) *page = (size_t)m.page;
 
-    size_t ordinal = us_page_ordinal(page);
+            return true;
 
-    if (cluster == NULL_CLUSTER){
-        ot_ptr[ordinal] = NULL_CLUSTER;
-        }
-    else {
-        ot_ptr[ordinal] = (Uint16)cluster;
-        disk_get(cluster, reinterpret_cast<char*>(page));
-        }
+            }
 
-    if (clone_override) ot_ptr[ordinal] = NULL_CLUSTER;
-    
-    PRINT( "System gave page " << ordinal << " (US) to user process; Type = " << new_type << ".\n");
+        }
 
-    return page;
+    return false;
 
     }
 
-// Thread safety: Yes (mutex_uslst, mutex_usft, Wrapper)
-PageAnte *KernelSystem::us_load_page(PageType::TypeEnum new_type, void *new_owner, void *content) {
+// Thread safety: Yes (mutex_sseg, shared)
+// The lookup itself doesn't need the lock; it keeps the segment from being
+// destroyed before it is pinned by the returned pointer.
+KernelSystem::SscbPtr KernelSystem::sseg_get(size_t sseg_ind) {
 
-    RaiiLock rl1(mutex_uslst);
-    RaiiLock rl2(mutex_usft);
+    ReadLock rl(mutex_sseg);
 
-    PageAnte *page = us_acquire_page(new_type, new_owner);
+    SsegControlBlock *sscb = sseg_vec.at_index(sseg_ind);
 
-    size_t ordinal = us_page_ordinal(page);
+    if (sscb == nullptr) HALT("KernelSystem::sseg_get - No shared segment with index " << sseg_ind << ".");
 
-    ot_ptr[ordinal] = NULL_CLUSTER;
+    return sscb->shared_from_this();
 
-    std::memcpy(page, content, PAGE_SIZE);
+    }
 
-    PRINT( "System gave page " << ordinal << " (US) to user process; Type = " << new_type << ".\n");
+// Thread safety: Yes (SsegControlBlock::mutex_pages, mutex_usft, Wrapper)
+// Brings in a page of a shared segment and maps its frame into the entry of
+// the faulting process
+void KernelSystem::shared_segment_pf(PCB *user, VirtualAddress addr, PageTableL2Entry *pte) {
 
-    return page;
+    size_t sseg_ind = user->shared_sseg(pte);
 
-    }
+    size_t page = user->shared_page(addr, pte);
 
-// Thread safety: Yes (Wrapper)
-void KernelSystem::ks_evict_page(size_t ordinal, bool dirty) {
+    SscbPtr sscb = sseg_get(sseg_ind);
 
-    ClusterNo cluster;
+    RaiiLock rl(sscb->mutex_pages); // Faults on other segments aren't held up
 
-    if (!dvt_acquire_cluster(&cluster)) {
-        
-        HALT("KernelSystem::ks_evict_pace - Disk is full.");
+    if (sscb->deleted) HALT("KernelSystem::shared_segment_pf - Segment " << sseg_ind << " was deleted.");
 
-        }
+    PageTableL2Entry *spte = &(sscb->pages[page]);
 
-    ks_swap_out( Victim(ordinal, dirty, cluster) );
+    bool major = false;
 
-    // swap_out sets block_disk to appropriate value
+    while (true) {
 
-    }
+        if (!spte->get_valid()) { // Same as for a private page
 
-// Thread safety: Yes (Wrapper)
-void KernelSystem::us_evict_page(size_t ordinal, bool dirty) {
+            ClusterNo cluster = spte->get_tbc() ? NULL_CLUSTER : (ClusterNo)spte->block_disk;
 
-    ClusterNo cluster = ot_ptr[ordinal];
+            major = (cluster != NULL_CLUSTER);
 
-    us_swap_out( Victim(ordinal, dirty, cluster) );
+            PageAnte *temp = us_request_page(PageType::UsUserPage, spte, cluster);
 
-    // swap_out sets block_disk to appropriate value
+            spte->block_disk = (Uint32)us_page_ordinal(temp);
 
-    }
+            spte->set_valid(true);
+            spte->set_dirty(false);
+            spte->set_tbc(false);
 
-// Thread safety: Yes (mutex_ksft)
-void KernelSystem::ks_lock_page(size_t ordinal) {
+            rmap_set(spte->block_disk, (ProcessId)(SSEG_START_IND + sseg_ind), page, sscb->access);
 
-    RaiiLock rl(mutex_ksft);
+            }
 
-    ks_ft_ptr[ordinal].set_locked(true);
+        // The frame can't be evicted until the new mapping is in its reverse map
+        // (which takes up to two pool nodes):
+        UniqLock ul_usft = rmap_reserve(2);
 
-    }
+        if (!spte->get_valid()) continue; // Evicted again by another fault
 
-// Thread safety: Yes (mutex_ksft)
-void KernelSystem::ks_unlock_page(size_t ordinal) {
+        pte->block_disk = spte->block_disk;
 
-    RaiiLock rl(mutex_ksft);
+        pte->set_valid(true);
+        pte->set_dirty(false);
 
-    ks_ft_ptr[ordinal].set_locked(false);
+        rmap_add(pte->block_disk, user->get_pid(), VmConfig::page(addr), pte->get_access());
 
-    }
+        user->stat_add(major ? ProcessStat::MajorFaults : ProcessStat::MinorFaults);
 
-// Thread safety: Yes (Wrapper)
-void KernelSystem::ks_relinquish_page(size_t ordinal) {
+        return;
 
-    ks_free_page(ordinal);
+        }
 
     }
 
-// Thread safety: Yes (Wrapper)
-void KernelSystem::us_relinquish_page(size_t ordinal) {
+// Thread safety: Yes (SsegControlBlock::mutex_users, Wrapper)
+// Index in its segment table of a process's connection to a shared segment
+// that a mapping of one of the segment's frames belongs to. A process stays
+// among the users until it maps none of the segment's frames.
+size_t KernelSystem::shared_user_entry(size_t sseg_ind, const RmapEntry &mapping) {
 
-    if (ot_ptr[ordinal] != NULL_CLUSTER) {
+    SscbPtr sscb = sseg_get(sseg_ind);
 
-        dvt_mark(ot_ptr[ordinal], DVT_FREE);
+    PCB *pcb = pcb_vec.at_index(mapping.pid);
 
-        }
+    std::lock_guard<std::mutex> lg(sscb->mutex_users);
 
-    us_free_page(ordinal);
+    for (PcbAndIndex *user = sscb->users; user != nullptr; user = user->next) {
 
-    }
+        if (user->pcb == pcb && mapping.page >= user->start && mapping.page < user->start + sscb->pages.size()) {
 
-// Thread safety: Yes (Wrapper)
-void KernelSystem::relinquish_cluster(ClusterNo cluster) {
+            return user->index;
 
-    if (cluster == NULL_CLUSTER || cluster >= disk_size)
-        HALT("KernelSystem::relinquish_cluster - Invalid cluster index.");
+            }
 
-    dvt_mark(cluster, DVT_FREE);
+        }
+
+    HALT("KernelSystem::shared_user_entry - Mapper of page " << mapping.page << " is not a user of segment " << sseg_ind << ".");
 
     }
 
-// Thread safety: Yes (mutex_sseg, Wrapper)
-void KernelSystem::shared_segment_pf(size_t sseg_ind, VirtualAddress addr) {
+// Thread safety: Yes (mutex_usft)
+// Drops a process's direct mapping of a shared page, if it has one
+void KernelSystem::shared_entry_unmap(PCB *pcb, VirtualAddress page, PageTableL2Entry *pte) {
+
+    RaiiLock rl(mutex_usft);
 
-    RaiiLock rl(mutex_sseg);
+    if (!pte->get_valid()) return;
 
-    PCB *pcb = sseg_vec[sseg_ind];
+    rmap_remove(pte->block_disk, pcb->get_pid(), page);
 
-    pcb->page_fault(addr);
+    pte->set_valid(false);
 
     }
 
-// Thread safety: Yes (mutex_sseg, Wrapper)
+// Thread safety: Yes (mutex_sseg, shared)
 bool KernelSystem::shared_segment_find(const char *name, size_t *index) {
 
-    RaiiLock rl(mutex_sseg);
+    ReadLock rl(mutex_sseg);
 
-    auto iter = sseg_map.find( std::string(name) );
+    auto iter = sseg_map.find( SsegName(name) );
 
     if (iter == sseg_map.end()) return false;
 
@@ -849,96 +2440,158 @@ bool KernelSystem::shared_segment_find(const char *name, size_t *index) {
 
     }
 
-// Thread safety: Yes (mutex_sseg, Wrapper)
-Status KernelSystem::create_shared_segment(PageNum size, const char *name, AccessType acc_type) {
+// Thread safety: Yes (mutex_sseg)
+// Finds the shared segment with the given name, or creates it if there is none
+Status KernelSystem::create_shared_segment(PageNum size, const char *name, AccessType acc_type, size_t *index) {
 
-    RaiiLock rl(mutex_sseg);
+    if (shared_segment_find(name, index)) return OK;
 
-    // Assume segment with same name doesn't already exist ...
+    SscbPtr sscb = std::allocate_shared<SsegControlBlock>(gen::PoolAllocator<SsegControlBlock>(), name, size, acc_type);
 
-    if (sseg_count == MAX_SHARED_SEGMENTS) return TRAP;
+    WriteLock wl(mutex_sseg);
 
-    // Insert data into all relevant data structures:
+    auto iter = sseg_map.find( SsegName(name) );
 
-    SsegControlBlock *sscb = new SsegControlBlock();
+    if (iter != sseg_map.end()) { // Created by someone else meanwhile
 
-    sseg_map.emplace(std::string(name), sscb); // sseg_map
+        *index = (*iter).second.get()->sseg_vec_index;
 
-    Process *dummy = create_process(); // pcb_vec
+        return OK;
 
-    PCB *pcb = dummy->pProcess;  
+        }
 
-    size_t index = sseg_vec.insert(pcb); // sseg_vec
-    
-    // Other:
-    sscb->dummy = dummy;
-    sscb->sseg_vec_index = index;
+    if (sseg_count == MAX_SHARED_SEGMENTS) return TRAP;
 
-    pcb->sscb = sscb;
+    // Insert data into all relevant data structures:
+
+    sscb->sseg_vec_index = sseg_vec.index_of( sseg_vec.insert(sscb.get()) ); // sseg_vec
+
+    sseg_map.emplace(SsegName(sscb->name.get()), sscb); // sseg_map, keyed by the interned name
 
     sseg_count += 1;
 
-    return dummy->createSegment(0, size, acc_type);
+    *index = sscb->sseg_vec_index;
+
+    return OK;
 
     }
 
-// Thread safety: Yes (mutex_sseg, Wrapper)
+// Thread safety: Yes (mutex_sseg, SsegControlBlock::mutex_pages, Wrapper)
 Status KernelSystem::delete_shared_segment(const char *name) {
 
-    RaiiLock rl(mutex_sseg);
+    SscbPtr sscb;
+
+    {
 
-    // Assume segment with the name exists ...
+        WriteLock wl(mutex_sseg);
 
-    SsegControlBlock *sscb = sseg_map[std::string(name)].get();
+        auto iter = sseg_map.find( SsegName(name) );
 
-    for (auto iter = (sscb->users).begin(); iter != (sscb->users).end(); iter = std::next(iter)) {
+        if (iter == sseg_map.end()) return TRAP;
 
-        PCB *pcb = (*iter).pcb;
-        size_t index = (*iter).index;
+        sscb = (*iter).second;
 
-        pcb->delete_segment_ind(index, false);
+        sseg_map.erase(iter);
 
         }
 
-    sscb->users.clear();
+    {
+
+        // Waits for faults in progress:
+        RaiiLock rl(sscb->mutex_pages);
+
+        // A user leaves the list only once its pages are gone (see
+        // shared_user_entry):
+        while (true) {
+
+            PcbAndIndex *user;
+
+            {
+
+                std::lock_guard<std::mutex> lg(sscb->mutex_users);
+
+                user = sscb->users;
+
+                }
+
+            if (user == nullptr) break;
+
+            user->pcb->delete_segment_ind(user->index, false);
+
+            {
+
+                std::lock_guard<std::mutex> lg(sscb->mutex_users);
+
+                sscb->users_unlink(user);
+
+                }
+
+            delete user;
+
+            }
+
+        // Release the segment's own pages:
+        for (size_t i = 0; i < sscb->pages.size(); i += 1) {
+
+            PageTableL2Entry &spte = sscb->pages[i];
+
+            if (spte.get_valid()) {
+
+                us_relinquish_page(spte.block_disk);
+
+                }
+            else if (!spte.get_tbc()) {
+
+                relinquish_cluster(spte.block_disk);
 
-    delete (sscb->dummy);
+                }
+
+            spte.reset();
+
+            }
+
+        sscb->deleted = true;
+
+        }
+
+    // The index stays valid until the users' entries are gone:
+    WriteLock wl(mutex_sseg);
 
-    sseg_vec.mark_empty( sscb->sseg_vec_index );
+    sseg_vec.erase( sseg_vec.handle_of(sscb->sseg_vec_index) );
 
-    sseg_map.erase(std::string(name));
+    sseg_count -= 1;
 
     return OK;
 
     }
 
-// Thread safety: Yes (mutex_sseg, Wrapper)
+// Thread safety: Yes (SsegControlBlock::mutex_users, Wrapper)
 void KernelSystem::connect_shared_segment(PCB * pcb, size_t sscb_index, size_t local_index) {
 
-    RaiiLock rl(mutex_sseg);
+    SscbPtr sscb = sseg_get(sscb_index);
 
-    SsegControlBlock *sscb = sseg_vec[sscb_index]->sscb;
+    std::lock_guard<std::mutex> lg(sscb->mutex_users);
 
-    sscb->users.push_back(PcbAndIndex(pcb, local_index));
+    sscb->users_push(new PcbAndIndex(pcb, local_index, pcb->st_ptr[local_index].start_page));
 
     }
 
-// Thread safety: Yes (mutex_sseg, Wrapper)
-size_t KernelSystem::disconnect_shared_segment(PCB *pcb, size_t sscb_index) {
+// Thread safety: Yes (SsegControlBlock::mutex_users, Wrapper)
+void KernelSystem::disconnect_shared_segment(PCB *pcb, size_t sscb_index, size_t local_index) {
 
-    RaiiLock rl(mutex_sseg);
+    SscbPtr sscb = sseg_get(sscb_index);
 
-    SsegControlBlock *sscb = sseg_vec[sscb_index]->sscb;
+    std::lock_guard<std::mutex> lg(sscb->mutex_users);
 
-    for (auto iter = (sscb->users).begin(); iter != (sscb->users).end(); iter = std::next(iter)) {
+    for (PcbAndIndex *user = sscb->users; user != nullptr; user = user->next) {
 
-        if ((*iter).pcb == pcb) {
+        if (user->pcb == pcb && user->index == local_index) {
 
-            size_t rv = (*iter).index;
+            sscb->users_unlink(user);
 
-            sscb->users.erase(iter);
+            delete user;
 
-            return rv;
+            return;
 
             }
 
@@ -948,14 +2601,18 @@ size_t KernelSystem::disconnect_shared_segment(PCB *pcb, size_t sscb_index) {
 
     }
 
-// Thread safety: Yes (mutex_sseg, Wrapper)
-void *KernelSystem::shared_segment_pa(size_t sseg_ind, VirtualAddress addr) {
+// Thread safety: Yes (SsegControlBlock::mutex_pages, Wrapper)
+void *KernelSystem::shared_segment_pa(size_t sseg_ind, size_t page, size_t offset) {
 
-    RaiiLock rl(mutex_sseg);
+    SscbPtr sscb = sseg_get(sseg_ind);
 
-    PCB *pcb = sseg_vec[sseg_ind];
+    RaiiLock rl(sscb->mutex_pages);
 
-    return pcb->get_pa(addr);
+    const PageTableL2Entry &spte = sscb->pages[page];
+
+    if (!spte.get_valid()) return nullptr;
+
+    return reinterpret_cast<char*>(us_page_addr(spte.block_disk)) + offset;
 
     }
 
@@ -966,16 +2623,20 @@ Process *KernelSystem::clone_process(ProcessId pid) {
     RaiiLock rl2(mutex_uslst);
     RaiiLock rl3(mutex_usft);
 
-    PCB *source = pcb_vec.at(pid);
+    PCB *source = pcb_vec.get(pid);
+
+    if (source == nullptr) return nullptr; // Stale or unknown pid
 
     source->master_table_lock();
 
     // Make and connect PCB and Process objects:
-    size_t index = pcb_vec.insert(nullptr);
+    ProcessId new_pid = pcb_vec.insert(nullptr);
+
+    if (new_pid == PcbMap::NIL) HALT("KernelSystem::clone_process - Out of process IDs.");
 
-    PCB *pcb = new PCB(this, index);
+    PCB *pcb = new PCB(this, new_pid);
 
-    pcb_vec[index] = pcb;
+    pcb_vec.assign(new_pid, pcb);
 
     Process *proc = new Process(0);
 
@@ -1023,7 +2684,7 @@ PageAnte *KernelSystem::us_clone_page(size_t index, void *owner_of_clone) {
 
     std::memcpy(page, source, PAGE_SIZE);
 
-    PRINT( "System gave page " << ordinal << " (US) to user process; Cloned page " << index <<".\n");
+    TRACE_EVENT(UsClone, ordinal, index);
 
     return page;
 
@@ -1035,13 +2696,15 @@ Process *KernelSystem::create_process() {
     // Make and connect PCB and Process objects:
     UniqLock ul(mutex_pcbvec);
 
-    size_t index = pcb_vec.insert(nullptr);
+    ProcessId pid = pcb_vec.insert(nullptr);
 
-    ul.unlock();
+    if (pid == PcbMap::NIL) HALT("KernelSystem::create_process - Out of process IDs.");
+
+    PCB *pcb = new PCB(this, pid);
 
-    PCB *pcb = new PCB(this, index);
+    pcb_vec.assign(pid, pcb);
 
-    pcb_vec[index] = pcb;
+    ul.unlock();
 
     Process *proc = new Process(0);
 
@@ -1067,14 +2730,41 @@ void KernelSystem::process_deleted(ProcessId pid) {
 
     RaiiLock rl(mutex_pcbvec);
 
-    pcb_vec.mark_empty(pid); // PEP
+    pcb_vec.erase(pid); // PEP
 
     }
 
-// Thread safety: Not needed 'cause it doesn't do anything
+// Thread safety: Yes (SwapScheduler, Partition::flushClusters)
+// Sends out queued swap writes whose deadline has passed, and writes back the
+// swap slots changed in memory-mapped partitions since the last call.
 Time KernelSystem::periodic_job() {
 
-    return 0; 
+    Time period = 0;
+
+    for (SwapDevice &dev : devices) {
+
+        Time next;
+
+        if (dev.io != nullptr) {
+
+            dev.io->dispatch_expired();
+
+            next = SwapScheduler::WRITE_DEADLINE;
+
+            }
+        else {
+
+            if (dev.disk->flushClusters() != 1) HALT("KernelSystem::periodic_job - Partition failure.");
+
+            next = DISK_FLUSH_PERIOD;
+
+            }
+
+        if (period == 0 || next < period) period = next;
+
+        }
+
+    return period;
     
     }
 
@@ -1083,28 +2773,52 @@ Status KernelSystem::access(ProcessId pid, VirtualAddress address, AccessType ty
 
     //PRINT("Process with PID " << pid << " called access (addr = " << address << ", type = " << type << "): ");
 
-    RaiiLock rl(mutex_databus);
+    UniqLock ul(mutex_databus, std::try_to_lock);
 
-    PCB *pcb;
+    if (!ul.owns_lock()) {
 
-    if (pid < SSEG_START_IND) { // Normal access
+        stats.add(StatId::LockWaits);
 
-        pcb = pcb_vec[pid];
+        ul.lock();
 
         }
-    else {
-        
-        pid -= SSEG_START_IND;
 
-        pcb = sseg_vec[pid];
+    stats.add(StatId::Accesses);
 
-        }
+    PCB *pcb = pcb_vec.get(pid); // Doesn't lock
+
+    if (pcb == nullptr) return TRAP; // Stale or unknown pid
 
     Status status;
     PageTableL1Entry *ptl1e;
     PageTableL2Entry *ptl2e;
     char *phys;
 
+    size_t frame = ipt_lookup(pcb->get_pid(), VmConfig::page(address));
+
+    if (frame != NULL_CLUSTER) { // Resident page found in the IPT - tables aren't needed
+
+        if (!ignore_access && !access_is_ok(type, rmap_ptr[frame].access)) { return TRAP; }
+
+        us_visited_page(us_page_addr(frame));
+
+        if (type == WRITE) {
+
+            RaiiLock rl(mutex_usft);
+
+            // Evicted since the lookup - a fault brings it back, so that the write isn't lost:
+            if (ipt_lookup(pcb->get_pid(), VmConfig::page(address)) != frame) return PAGE_FAULT;
+
+            us_ft.set_dirty(frame, true);
+
+            }
+
+        stats.add(StatId::IptHits);
+
+        return OK;
+
+        }
+
     pcb->master_table_lock();
     PageUnlocker punl(this, pcb->master_table);
 
@@ -1112,41 +2826,60 @@ Status KernelSystem::access(ProcessId pid, VirtualAddress address, AccessType ty
         return status;
         }
 
-    if ((ptl2e = pcb->access_ptl2(address, ptl1e, status, true)) == nullptr) {
-        return status;
-        }
-
-    if (!ignore_access && !access_is_ok(type, ptl2e->get_access())) { return TRAP; }
+    if (ptl1e->status == PageTableL1Entry::Huge) { // Access to large page
 
-    if (!ptl2e->get_shared()) { // Access to normal segment
+        if (!ignore_access && !access_is_ok(type, ptl1e->access)) { return TRAP; }
 
-        if ((phys = pcb->access_phys(address, ptl2e, status, true)) == nullptr) {
-            return status;
-            }
+        mutex_usft.lock();
 
-        if (type == WRITE) {
-        
-            ptl2e->set_dirty(true);
+        // A concurrent eviction may have demoted the span since it was checked:
+        if (ptl1e->status == PageTableL1Entry::Huge) {
 
-            mutex_usft.lock();
+            // The mapping's reference bit is kept with its first frame:
+            us_ft.ref_history[ptl1e->block_disk] |= FrameTable::REF_TOP;
 
-            us_ft_ptr[us_page_ordinal(phys)].set_dirty(true); // PEP
+            if (type == WRITE) us_ft.set_dirty(ptl1e->block_disk + VmConfig::ptl2_slot(address), true);
 
             mutex_usft.unlock();
 
+            stats.add(StatId::WalkHits);
+
+            return OK;
+
             }
 
-        return OK;
+        mutex_usft.unlock();
+
+        }
+
+    if ((ptl2e = pcb->access_ptl2(address, ptl1e, status, true)) == nullptr) {
+        return status;
+        }
+
+    if (!ignore_access && !access_is_ok(type, ptl2e->get_access())) { return TRAP; }
 
+    // Shared pages are mapped directly while valid, like private ones:
+    if ((phys = pcb->access_phys(address, ptl2e, status, true)) == nullptr) {
+        return status;
         }
-    else { // Access to shared segment
 
-        VirtualAddress sseg_addr = ((VirtualAddress)ptl2e->block_disk * PAGE_SIZE) + (address & 0x03FF); // PEP
+    if (type == WRITE) {
+
+        RaiiLock rl(mutex_usft);
+
+        // Evicted since the walk, which leaves a swap slot in block_disk:
+        if (!ptl2e->get_valid()) return PAGE_FAULT;
+
+        ptl2e->set_dirty(true);
+
+        us_ft.set_dirty(ptl2e->block_disk, true); // PEP
 
-        return access(SSEG_START_IND + ptl2e->sseg_ind, sseg_addr, type, true);
-        
         }
 
+    stats.add(StatId::WalkHits);
+
+    return OK;
+
     }
 
 // Thread safety: Not needed (Debug method)
@@ -1156,6 +2889,44 @@ void KernelSystem::test() {
     
     }
 
+// Thread safety: Yes (Atomic, scheduler mutexes; see VmStats)
+VmStats KernelSystem::get_stats() const {
+
+    VmStats rv;
+
+    rv.accesses          = stats.get(StatId::Accesses);
+    rv.ipt_hits          = stats.get(StatId::IptHits);
+    rv.walk_hits         = stats.get(StatId::WalkHits);
+    rv.faults_zero_fill  = stats.get(StatId::FaultsZeroFill);
+    rv.faults_swap_in    = stats.get(StatId::FaultsSwapIn);
+    rv.faults_shared     = stats.get(StatId::FaultsShared);
+    rv.table_swap_ins    = stats.get(StatId::TableSwapIns);
+    rv.page_swap_ins     = stats.get(StatId::PageSwapIns);
+    rv.evict_user_pages  = stats.get(StatId::EvictUserPages);
+    rv.evict_page_tables = stats.get(StatId::EvictPageTables);
+    rv.evict_page_dirs   = stats.get(StatId::EvictPageDirs);
+    rv.evict_seg_tables  = stats.get(StatId::EvictSegTables);
+    rv.dirty_writebacks  = stats.get(StatId::DirtyWritebacks);
+    rv.dvt_allocations   = stats.get(StatId::DvtAllocations);
+    rv.disk_reads        = stats.get(StatId::DiskReads);
+    rv.disk_writes       = stats.get(StatId::DiskWrites);
+    rv.lock_waits        = stats.get(StatId::LockWaits);
+
+    // Writes through a scheduler count once they reach the partition, so
+    // that dropped and overwritten ones don't:
+    for (const SwapDevice &dev : devices) {
+
+        if (dev.io != nullptr) rv.disk_writes += dev.io->get_counters().written;
+
+        }
+
+    // Write-backs are counted before their evictions:
+    rv.clean_drops = (rv.evict_user_pages > rv.dirty_writebacks) ? rv.evict_user_pages - rv.dirty_writebacks : 0;
+
+    return rv;
+
+    }
+
 // Thread safety: Not needed (Debug method)
 void KernelSystem::diag() {
     
@@ -1165,14 +2936,21 @@ void KernelSystem::diag() {
     #define PRINT(text) std::cout << text
     #define PRINTLN(text) std::cout << text << "\n"
 
+    size_t ks_empty_count = ks_empty.count();
+    size_t us_empty_count = us_empty.count();
+
     PRINTLN("Kernel System diagnostics:");
     PRINTLN("");
 
     PRINTLN("Kernel Space:");
     PRINTLN("  Address: "  << (void*)krnlspc );
     PRINTLN("  Reserved: " << ks_reserved << " / " << krnlspc_size);
+    PRINTLN("  Reverse map: " << rmap_size << " pages (+ " << rmap_pool_frames << " pool)");
+    if (translation == TranslationMode::Inverted)
+        PRINTLN("  Inverted page table: " << ipt_size << " pages");
     PRINTLN("  In use: " << (krnlspc_size - ks_empty_count) << " / "  << krnlspc_size);
     PRINTLN("  Free: " << 100*(ks_empty_count)/krnlspc_size << "%");
+    PRINTLN("  Swap-ins: " << stats.get(StatId::TableSwapIns));
     PRINTLN("");
 
     PRINTLN("User Space:");
@@ -1180,7 +2958,50 @@ void KernelSystem::diag() {
     PRINTLN("  Reserved: " << us_reserved << " / " << userspc_size);
     PRINTLN("  In use: " << (userspc_size - us_empty_count) << " / "  << userspc_size);
     PRINTLN("  Free: " << 100*(us_empty_count)/userspc_size << "%");
+    PRINTLN("  Dirty: " << fscan::count_set(us_ft.flags, FT_DIRTY, userspc_size)
+            << " (frame scans: " << fscan::level_name(fscan::level()) << ")");
+    PRINTLN("  Swap-ins: " << stats.get(StatId::PageSwapIns));
+    PRINTLN("");
+
+    PRINTLN("Swap:");
+    for (size_t d = 0; d < devices.size(); d += 1) {
+        const SwapDevice &dev = devices[d];
+        PRINTLN("  Device " << d << " (priority " << dev.priority << "): "
+                << (dev.size - dev.free) << " / " << dev.size << " slots in use"
+                << (dev.map != nullptr ? ", memory-mapped" : ""));
+        if (dev.io == nullptr) continue;
+        SwapScheduler::Counters io = dev.io->get_counters();
+        PRINTLN("    Write requests: " << io.requests << " (" << io.written << " slots)");
+        PRINTLN("    Reads served from the queue: " << io.read_hits);
+        PRINTLN("    Writes dropped: " << io.discarded);
+        }
+    PRINTLN("");
+
+    VmStats st = get_stats();
+
+    PRINTLN("Statistics:");
+    PRINTLN("  Accesses: " << st.accesses << " (" << st.ipt_hits << " through the IPT, "
+            << st.walk_hits << " through page tables, " << st.lock_waits << " waited for the bus)");
+    PRINTLN("  Page faults: " << st.faults_zero_fill << " zero-fill, " << st.faults_swap_in << " swap-in, "
+            << st.faults_shared << " shared");
+    PRINTLN("  Evictions: " << st.evict_user_pages << " user pages (" << st.dirty_writebacks << " written back), "
+            << st.evict_page_tables << " page tables, " << st.evict_page_dirs << " directories, "
+            << st.evict_seg_tables << " master tables");
+    PRINTLN("  Disk: " << st.disk_reads << " pages read, " << st.disk_writes << " written, "
+            << st.dvt_allocations << " slots allocated");
+    PRINTLN("");
+
+    #if VM_LATENCY
+    PRINTLN("Latency:");
+    latency::dump(std::cout);
+    PRINTLN("");
+    #endif
+
+    #if VM_LOCK_PROFILE
+    PRINTLN("Locks:");
+    lockprof::dump(std::cout);
     PRINTLN("");
+    #endif
     
     #pragma pop_macro("PRINTLN")
     #pragma pop_macro("PRINT") 
@@ -1,16 +1,25 @@
 #pragma once
 
 #include <mutex>
+#include <shared_mutex>
 #include <memory>
 #include <unordered_map>
 #include <random>
+#include <vector>
 
 #include "VmDecl.hpp"
 #include "IntegralTypes.hpp"
-#include "ConsVec.hpp"
+#include "SlotMap.hpp"
 #include "HelperStructs.hpp"
+#include "VmGeometry.hpp"
 #include "Part.h"
 #include "SsegControlBlock.hpp"
+#include "SwapScheduler.hpp"
+#include "FreeFrameStore.hpp"
+#include "KernelMutex.hpp"
+#include "StatCounters.hpp"
+#include "VmStats.h"
+#include "System.h"
 
 class Partition;
 class Process;
@@ -28,31 +37,23 @@ class KernelSystem {
         PageNum userspc_size;      
         PageNum krnlspc_size;
 
-        Partition *disk;
-
         // Empty page management:
-        PageAnte *us_empty_lhead;
-        PageAnte *us_empty_ltail;
-
-        size_t us_empty_count;
-
-        PageAnte *ks_empty_lhead;
-        PageAnte *ks_empty_ltail;
-
-        size_t ks_empty_count;
-
-        size_t lst_link_empty_space(char *start_addr, PageNum n, PageAnte *&head, PageAnte *&tail);      
-        PageAnte *lst_get_empty_page(PageAnte *&head, PageAnte *&tail, size_t &count);
-        void lst_return_page(PageAnte *page, PageAnte *&head, PageAnte *&tail, size_t &count);
+        FreeFrameStore us_empty;
+        FreeFrameStore ks_empty;
 
         // Page management - other:
         static const int BITSCAN_MAX_DIFFERENCE = 1;
 
+        // Cloning keeps a whole table path of both processes locked at once:
+        static const size_t KS_MIN_FRAMES = 2 * VmConfig::PT_LEVELS;
+
         PageAnte *ks_acquire_page(PageType::TypeEnum new_type, void *new_owner, bool lock);
         void ks_free_page(size_t ordinal);
         Victim ks_get_victim();
+        size_t ks_victim_descend(size_t place);
         void ks_swap_out(Victim victim);       
         void ks_ft_update(PageNum entry, Uint8 flags, PageType::TypeEnum type, void *owner);        
+        PCB *ks_table_process(size_t ordinal);
 
         PageNum ks_reserved;
 
@@ -64,28 +65,103 @@ class KernelSystem {
 
         PageNum us_reserved;
 
+        // Large pages:
+        bool huge_pages;
+
+        PageAnte *us_acquire_run(size_t n, void *new_owner);
+        bool us_huge_eligible(PCB *pcb, VirtualAddress addr, size_t *segment);
+
+        // Reverse map and inverted page table:
+        TranslationMode::ModeEnum translation;
+
+        RmapEntry *rmap_ptr;
+
+        Uint32 *ipt_next;
+        Uint32 *ipt_anchors;
+
+        unsigned ipt_bits;
+
+        PageNum rmap_size;
+        PageNum ipt_size;
+
+        size_t ipt_hash(ProcessId pid, VirtualAddress page) const;
+        void ipt_unlink(size_t ordinal);
+        void rmap_clear(size_t ordinal);
+        void rmap_account(const RmapEntry &mapping, Int64 n);
+        void rmap_swap_out(size_t ordinal, const RmapEntry &mapping, Uint32 block_disk);
+        void rmap_swap_out_all(size_t ordinal, ClusterNo cn);
+        bool rmap_shared_origin(size_t ordinal, size_t *sseg_ind, size_t *page = nullptr);
+
+        // Reverse map pool (mapping lists of frames with several mappers):
+        static const size_t RMAP_POOL_NODES = PAGE_SIZE / sizeof(RmapLink); // Including the header
+
+        size_t rmap_pool_head;
+        size_t rmap_pool_spare; // Empty frames waiting to go back to kernel space
+        size_t rmap_pool_frames;
+        size_t rmap_pool_free;  // Free nodes in the frames at rmap_pool_head
+
+        RmapPoolHeader *rmap_pool_header(size_t frame) const;
+        RmapLink *rmap_node(Uint32 handle) const;
+        Uint32 rmap_node_alloc();
+        void rmap_node_free(Uint32 handle);
+
+        PageTableL2Entry *us_owner_entry(size_t ordinal);
+
         // Frame tables:
-        FrameTableEntry *us_ft_ptr;
-        FrameTableEntry *ks_ft_ptr;
+        FrameTable us_ft;
+        FrameTable ks_ft;
 
         PageNum us_ft_size;
         PageNum ks_ft_size;
 
         // Origin table:
-        Uint16 *ot_ptr;
+        Uint32 *ot_ptr;
 
         size_t ot_entries;
 
         PageNum ot_size;
 
-        // Disk vacancy table:
-        // 1 = free, 0 = ocuppied
+        // Swap devices:
+        // A swap slot is a device index above slot_bits bits of slot number
+        // on that device, and each device has its own run of the disk
+        // vacancy table (1 = free, 0 = ocuppied).
+        struct SwapDevice {
+
+            Partition *disk;
+
+            // Slots of a memory-mapped partition are used in place (see
+            // Partition::mapCluster) and written back from periodic_job;
+            // others are reached through the swap I/O scheduler, which
+            // queues and orders writes:
+            char *map;
+            SwapScheduler *io;
+
+            ClusterNo size; // In page-sized swap slots
+            ClusterNo free;
+
+            size_t dvt_first;
+            size_t dvt_entries;
+
+            int priority;
+
+            };
+
+        std::vector<SwapDevice> devices;
+
+        size_t device_rotor; // Where the search for a device to stripe onto starts
+
+        // Only as many device bits as there are devices to name are taken
+        // from the slot number, so a single device keeps all 24 bits:
+        unsigned slot_bits;
+        ClusterNo slot_mask; // Slot number on its device
+
+        SwapDevice &slot_device(ClusterNo slot);
+        bool slot_valid(ClusterNo slot) const;
+
         static const size_t DVTE_SIZE = 32;
         
         Uint32 *dvt_ptr;
 
-        ClusterNo disk_size;
-
         size_t dvt_entries;
 
         PageNum dvt_size;
@@ -96,14 +172,26 @@ class KernelSystem {
 
         void disk_put(ClusterNo n, const char *buffer);
         void disk_get(ClusterNo n, char *buffer);
+        void disk_put_pages(const ClusterNo *slots, char *const *buffers, size_t n);
+        void disk_get_pages(const ClusterNo *slots, char *const *buffers, size_t n);
+        char *disk_image(ClusterNo n, char *scratch, bool pinned);
+
+        static const Time DISK_FLUSH_PERIOD = 50000; // Microseconds
 
         // User processes:
-        gen::ConsVec<PCB*> pcb_vec;
+        // A pid is a slot index (which is what the reverse map records) with
+        // the slot's generation above RmapEntry::PID_BITS. Lookups don't lock;
+        // inserting and erasing take mutex_pcbvec.
+        typedef gen::SlotMap<PCB, RmapEntry::PID_BITS> PcbMap;
+
+        PcbMap pcb_vec;
+
+        static size_t pid_slot(ProcessId pid) { return PcbMap::index_of(pid); }
 
         // Synchronization:
-        using RecMutex = std::recursive_mutex;
-        using RaiiLock = std::lock_guard<std::recursive_mutex>;
-        using UniqLock = std::unique_lock<std::recursive_mutex>;
+        using RecMutex = KernelMutex;
+        using RaiiLock = std::lock_guard<KernelMutex>;
+        using UniqLock = std::unique_lock<KernelMutex>;
 
         RecMutex mutex_dvt;
         RecMutex mutex_databus;
@@ -112,39 +200,68 @@ class KernelSystem {
         RecMutex mutex_pcbvec;
         RecMutex mutex_ksft;
         RecMutex mutex_usft;
-        RecMutex mutex_sseg;
+
+        // Guards sseg_map and changes to sseg_vec only; each shared segment has its own
+        // locks (see SsegControlBlock):
+        using RwMutex   = KernelRwMutex;
+        using ReadLock  = std::shared_lock<RwMutex>;
+        using WriteLock = std::unique_lock<RwMutex>;
+
+        RwMutex mutex_sseg;
 
         // Other:
         std::default_random_engine *rng;
 
-        void init_ft_entries();
         bool access_is_ok(Uint8 requested, Uint8 granted) const;
 
         // Bonus:
-        std::unordered_map<std::string, std::unique_ptr<SsegControlBlock>> sseg_map;
-        gen::ConsVec<PCB*> sseg_vec;
+        typedef std::shared_ptr<SsegControlBlock> SscbPtr;
+
+        std::unordered_map<SsegName, SscbPtr, SsegName::Hash> sseg_map;
+        gen::SlotMap<SsegControlBlock, RmapEntry::PID_BITS> sseg_vec; // Indexed without generations
+
+        SscbPtr sseg_get(size_t sseg_ind);
 
         size_t sseg_count;
 
+        // Statistics:
+        StatCounters stats;
+
     public:
 
-        static const Uint8 FT_DIRTY  = (1 << FrameTableEntry::Dirty);
-        static const Uint8 FT_SHARED = (1 << FrameTableEntry::Shared);
-        static const Uint8 FT_LOCKED = (1 << FrameTableEntry::Locked);
+        static const Uint8 FT_DIRTY  = (1 << FrameTable::Dirty);
+        static const Uint8 FT_SHARED = (1 << FrameTable::Shared);
+        static const Uint8 FT_LOCKED = (1 << FrameTable::Locked);
         static const Uint8 FT_NONE   = (0);
     
-        static const ClusterNo NULL_CLUSTER = 0xFFFF;
-        static const ClusterNo MAX_CLUSTERS = 0x10000 - 1;
+        // Swap slots are stored in 24 bits (see PageTableL2Entry), the top
+        // ones naming the device when there are several. The last slot of
+        // each device is left out so that no slot is NULL_CLUSTER:
+        static const ClusterNo NULL_CLUSTER = 0xFFFFFF;
+        static const unsigned  SLOT_FIELD_BITS = 24;
+        static const unsigned  MAX_DEVICE_BITS = 3;
+        static const size_t    MAX_SWAP_DEVICES = (size_t)1 << MAX_DEVICE_BITS;
+
+        // Pages gathered per batch by evictions and page-ins:
+        static const size_t DISK_BATCH = 64;
 
         static const bool DVT_FREE   = true;
         static const bool DVT_IN_USE = false;
 
         static const Uint16 SSEG_START_IND = 60000;
-        static const size_t MAX_SHARED_SEGMENTS = 256;
+        // Frames of shared segments are entered into the reverse map under
+        // pids from SSEG_START_IND up:
+        static const size_t MAX_SHARED_SEGMENTS = ((size_t)1 << RmapEntry::PID_BITS) - SSEG_START_IND;
 
         KernelSystem(PhysicalAddress userspc_, PageNum userspc_size_,
                      PhysicalAddress krnlspc_, PageNum krnlspc_size_,
-                     Partition* disk_);
+                     Partition* disk_, bool huge_pages_ = false,
+                     TranslationMode::ModeEnum translation_ = TranslationMode::PageTables);
+
+        KernelSystem(PhysicalAddress userspc_, PageNum userspc_size_,
+                     PhysicalAddress krnlspc_, PageNum krnlspc_size_,
+                     const std::vector<SwapArea> &swap_areas, bool huge_pages_ = false,
+                     TranslationMode::ModeEnum translation_ = TranslationMode::PageTables);
 
         ~KernelSystem();
 
@@ -158,6 +275,10 @@ class KernelSystem {
         void test();
         void diag();
 
+        // Statistics:
+        VmStats get_stats() const;
+        void stat_add(StatId::IdEnum id, Uint64 n = 1) { stats.add(id, n); }
+
         // Utility:
         size_t ks_page_ordinal(const void *page_ante) const;
         bool ks_page_validate(const void *page_ante) const;
@@ -170,28 +291,52 @@ class KernelSystem {
         void us_visited_page(void *page_ante);
 
         PageAnte *ks_request_page(PageType::TypeEnum new_type, void *new_owner, ClusterNo cluster = NULL_CLUSTER, bool lock = false);
+        void ks_read_table(PageAnte *page, ClusterNo cluster);
         PageAnte *us_request_page(PageType::TypeEnum new_type, void *new_owner, ClusterNo cluster = NULL_CLUSTER, bool clone_override = false);
         PageAnte *us_load_page(PageType::TypeEnum new_type, void *new_owner, void *content);
 
         void ks_evict_page(size_t ordinal, bool dirty);
         void us_evict_page(size_t ordinal, bool dirty);
 
+        void ks_evict_tables(PageTableL1Entry *entries, size_t n);
+        void us_evict_pages(Victim *victims, size_t n);
+        void us_read_pages(const ClusterNo *slots, const size_t *ordinals, size_t n);
+        size_t us_read_batch() const;
+
         void ks_lock_page(size_t ordinal);
         void ks_unlock_page(size_t ordinal);
+        bool ks_page_locked(size_t ordinal);
+        size_t ks_pin_page(const void *page_addr);
 
         void ks_relinquish_page(size_t ordinal);
         void us_relinquish_page(size_t ordinal);
 
         void relinquish_cluster(ClusterNo cluster);
 
+        // Large pages:
+        bool us_huge_promote(PCB *pcb, VirtualAddress addr, PageTableL1Entry *ptl1e);
+        void us_huge_demote(PageTableL1Entry *ptl1e);
+        bool us_huge_evict(PageTableL1Entry *ptl1e);
+
+        // Reverse map and inverted page table:
+        void   rmap_set(size_t ordinal, ProcessId pid, VirtualAddress page, AccessType access);
+        void   rmap_add(size_t ordinal, ProcessId pid, VirtualAddress page, AccessType access);
+        void   rmap_remove(size_t ordinal, ProcessId pid, VirtualAddress page);
+        UniqLock rmap_reserve(size_t nodes);
+        void   rmap_pool_trim();
+        size_t rmap_count(size_t ordinal);
+        size_t ipt_lookup(ProcessId pid, VirtualAddress page);
+
         // Bonus:
-        void   shared_segment_pf(size_t sseg_ind, VirtualAddress addr);
+        void   shared_segment_pf(PCB *user, VirtualAddress addr, PageTableL2Entry *pte);
+        size_t shared_user_entry(size_t sseg_ind, const RmapEntry &mapping);
+        void   shared_entry_unmap(PCB *pcb, VirtualAddress page, PageTableL2Entry *pte);
         bool   shared_segment_find(const char *name, size_t *index);
-        Status create_shared_segment(PageNum size, const char *name, AccessType acc_type);
+        Status create_shared_segment(PageNum size, const char *name, AccessType acc_type, size_t *index);
         Status delete_shared_segment(const char *name);
         void   connect_shared_segment(PCB *pcb, size_t sscb_index, size_t local_index);
-        size_t disconnect_shared_segment(PCB *pcb, size_t sscb_index);
-        void  *shared_segment_pa(size_t sseg_ind, VirtualAddress addr);
+        void   disconnect_shared_segment(PCB *pcb, size_t sscb_index, size_t local_index);
+        void  *shared_segment_pa(size_t sseg_ind, size_t page, size_t offset);
 
         Process  *clone_process(ProcessId pid);
         PageAnte *us_clone_page(size_t index, void *owner_of_clone);
@@ -0,0 +1,186 @@
+#include "Latency.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace latency { // Start Latency namespace
+
+    namespace {
+
+        // Written by its own thread only; the atomics let merge() read them
+        // while they change.
+        struct ThreadHistograms {
+
+            std::atomic<Uint64> counts[LatencyId::COUNT][BUCKETS];
+            std::atomic<Uint64> max[LatencyId::COUNT];
+
+            ThreadHistograms() {
+
+                for (size_t i = 0; i < LatencyId::COUNT; i += 1) {
+
+                    for (size_t b = 0; b < BUCKETS; b += 1) counts[i][b].store(0, std::memory_order_relaxed);
+
+                    max[i].store(0, std::memory_order_relaxed);
+
+                    }
+
+                }
+
+            };
+
+        // Histograms outlive their threads, so that a merge sees them all:
+        struct Registry {
+
+            std::mutex mutex;
+
+            std::vector<std::unique_ptr<ThreadHistograms>> threads;
+
+            };
+
+        Registry &registry() {
+
+            static Registry *reg = new Registry(); // Never destroyed, like ObjectPool
+
+            return *reg;
+
+            }
+
+        ThreadHistograms *thread_histograms() {
+
+            thread_local ThreadHistograms *hist = nullptr;
+
+            if (hist == nullptr) {
+
+                Registry &reg = registry();
+
+                std::lock_guard<std::mutex> lg(reg.mutex);
+
+                reg.threads.emplace_back(new ThreadHistograms());
+
+                hist = reg.threads.back().get();
+
+                }
+
+            return hist;
+
+            }
+
+        }
+
+    Histogram::Histogram()
+        : total(0)
+        , max(0) {
+
+        for (size_t b = 0; b < BUCKETS; b += 1) counts[b] = 0;
+
+        }
+
+    void Histogram::add(const Histogram &other) {
+
+        for (size_t b = 0; b < BUCKETS; b += 1) counts[b] += other.counts[b];
+
+        total += other.total;
+
+        if (other.max > max) max = other.max;
+
+        }
+
+    Uint64 Histogram::percentile(double q) const {
+
+        if (total == 0) return 0;
+
+        Uint64 rank = (Uint64)(q * (double)total);
+
+        if (rank >= total) rank = total - 1;
+
+        Uint64 seen = 0;
+
+        for (size_t b = 0; b < BUCKETS; b += 1) {
+
+            seen += counts[b];
+
+            if (seen > rank) return (bucket_top(b) < max) ? bucket_top(b) : max;
+
+            }
+
+        return max;
+
+        }
+
+    Uint64 now() {
+
+        return (Uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        }
+
+    void record(LatencyId::IdEnum id, Uint64 ns) {
+
+        ThreadHistograms *hist = thread_histograms();
+
+        std::atomic<Uint64> &count = hist->counts[id][bucket_of(ns)];
+
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+        if (ns > hist->max[id].load(std::memory_order_relaxed)) hist->max[id].store(ns, std::memory_order_relaxed);
+
+        }
+
+    Histogram merge(LatencyId::IdEnum id) {
+
+        Histogram rv;
+
+        Registry &reg = registry();
+
+        std::lock_guard<std::mutex> lg(reg.mutex);
+
+        for (auto &hist : reg.threads) {
+
+            for (size_t b = 0; b < BUCKETS; b += 1) {
+
+                Uint64 n = hist->counts[id][b].load(std::memory_order_relaxed);
+
+                rv.counts[b] += n;
+                rv.total     += n;
+
+                }
+
+            Uint64 max = hist->max[id].load(std::memory_order_relaxed);
+
+            if (max > rv.max) rv.max = max;
+
+            }
+
+        return rv;
+
+        }
+
+    void dump(std::ostream &out) {
+
+        out << "  " << std::left << std::setw(20) << "Histogram" << std::right
+            << std::setw(10) << "Count" << std::setw(12) << "p50 (ns)" << std::setw(12) << "p99"
+            << std::setw(12) << "p999" << std::setw(14) << "Max" << "\n";
+
+        for (Uint32 id = 0; id < LatencyId::COUNT; id += 1) {
+
+            Histogram hist = merge(static_cast<LatencyId::IdEnum>(id));
+
+            if (hist.total == 0) continue;
+
+            out << "  " << std::left << std::setw(20) << LatencyId::name(id) << std::right
+                << std::setw(10) << hist.total
+                << std::setw(12) << hist.percentile(0.5)
+                << std::setw(12) << hist.percentile(0.99)
+                << std::setw(12) << hist.percentile(0.999)
+                << std::setw(14) << hist.max << "\n";
+
+            }
+
+        }
+
+    } // End Latency namespace
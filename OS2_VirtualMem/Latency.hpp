@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+
+#include "IntegralTypes.hpp"
+#include "Platform.hpp"
+
+// Latency histograms of fault handling and of waits for the kernel's
+// mutexes, enabled at compile time. Each thread records into histograms of
+// its own, without locking; merge() adds up those of all threads and dump()
+// prints percentiles. With VM_LATENCY off the timers below expand to
+// nothing and no clock is read.
+#ifndef VM_LATENCY
+#define VM_LATENCY 0
+#endif
+
+#if VM_LATENCY
+#define LATENCY_TIMER(timer)     latency::Timer timer
+#define LATENCY_KIND(timer, id)  timer.set(LatencyId::id)
+#else
+#define LATENCY_TIMER(timer)     do { } while (false)
+#define LATENCY_KIND(timer, id)  do { } while (false)
+#endif
+
+struct LatencyId {
+
+    enum IdEnum {
+
+        // Fault handling, by kind:
+        FaultZeroFill,
+        FaultSwapIn,
+        FaultShared,
+        FaultKernelTable,
+
+        // Waits for kernel mutexes (uncontended acquisitions count as 0):
+        WaitDvt,
+        WaitDatabus,
+        WaitKslst,
+        WaitUslst,
+        WaitPcbvec,
+        WaitKsft,
+        WaitUsft,
+        WaitSsegPages, // All shared segments together
+        WaitSseg,
+        WaitTables,    // All processes together
+
+        COUNT
+
+        };
+
+    static const char *name(Uint32 id) {
+
+        static const char *NAMES[COUNT + 1] = {
+
+            "fault_zero_fill",
+            "fault_swap_in",
+            "fault_shared",
+            "fault_kernel_table",
+            "wait_dvt",
+            "wait_databus",
+            "wait_kslst",
+            "wait_uslst",
+            "wait_pcbvec",
+            "wait_ksft",
+            "wait_usft",
+            "wait_sseg_pages",
+            "wait_sseg",
+            "wait_tables",
+            "unknown"
+
+            };
+
+        return NAMES[(id < COUNT) ? id : (Uint32)COUNT];
+
+        }
+
+    };
+
+namespace latency { // Start Latency namespace
+
+    // Log-linear buckets, as in HDR histograms: values (in nanoseconds)
+    // below 2^SUB_BITS have a bucket each, and every power of two above is
+    // split into 2^(SUB_BITS - 1) buckets, so a value is known to within
+    // 1/16. Values from 2^MAX_BITS up go to the last bucket.
+    static const unsigned SUB_BITS = 5;
+    static const unsigned MAX_BITS = 40; // About 18 minutes
+
+    static const size_t SUB_HALF = (size_t)1 << (SUB_BITS - 1);
+    static const size_t BUCKETS  = (MAX_BITS - SUB_BITS + 2) * SUB_HALF;
+
+    inline size_t bucket_of(Uint64 ns) {
+
+        if (ns >= ((Uint64)1 << MAX_BITS)) ns = ((Uint64)1 << MAX_BITS) - 1;
+
+        if (ns < ((Uint64)1 << SUB_BITS)) return (size_t)ns;
+
+        Uint32 high = (Uint32)(ns >> 32);
+
+        unsigned top = high ? 32 + plat::bit_scan_reverse(high) : plat::bit_scan_reverse((Uint32)ns);
+
+        unsigned shift = top - SUB_BITS + 1;
+
+        return shift * SUB_HALF + (size_t)(ns >> shift);
+
+        }
+
+    // Highest value that falls into a bucket:
+    inline Uint64 bucket_top(size_t bucket) {
+
+        if (bucket < ((size_t)1 << SUB_BITS)) return bucket;
+
+        size_t shift = bucket / SUB_HALF - 1;
+
+        return ((Uint64)(bucket - shift * SUB_HALF + 1) << shift) - 1;
+
+        }
+
+    struct Histogram {
+
+        Uint64 counts[BUCKETS];
+
+        Uint64 total; // Values recorded
+        Uint64 max;
+
+        Histogram();
+
+        void add(const Histogram &other);
+
+        // Value at or below which the fraction q of the recorded values
+        // lies, rounded up to the top of its bucket:
+        Uint64 percentile(double q) const;
+
+        };
+
+    Uint64 now(); // Nanoseconds, steady clock
+
+    void record(LatencyId::IdEnum id, Uint64 ns);
+
+    // Sums the histograms of all threads, including those that have exited.
+    // Values being recorded meanwhile may be left out.
+    Histogram merge(LatencyId::IdEnum id);
+
+    // Prints count, p50, p99, p999 and max of every histogram with values:
+    void dump(std::ostream &out);
+
+    // Times a scope and records it into the histogram set last, if any:
+    class Timer {
+
+        public:
+
+            Timer() : start(now()), id(LatencyId::COUNT) { }
+
+            ~Timer() { if (id != LatencyId::COUNT) record(id, now() - start); }
+
+            void set(LatencyId::IdEnum id_) { id = id_; }
+
+        private:
+
+            Uint64 start;
+
+            LatencyId::IdEnum id;
+
+        };
+
+    } // End Latency namespace
@@ -0,0 +1,211 @@
+#include "LockProfile.hpp"
+#include "Latency.hpp"
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace lockprof { // Start Lock Profile namespace
+
+    namespace {
+
+        // Counters are written by their own thread only; the atomics let
+        // merge() read them while they change. Depths and start times are
+        // the thread's own business.
+        struct ThreadLocks {
+
+            std::atomic<Uint64> acquisitions[LockId::COUNT];
+            std::atomic<Uint64> contended[LockId::COUNT];
+            std::atomic<Uint64> wait_ns[LockId::COUNT];
+            std::atomic<Uint64> hold_ns[LockId::COUNT];
+
+            std::atomic<Uint64> edges[LockId::COUNT][LockId::COUNT];
+
+            size_t depth[LockId::COUNT];
+            Uint64 since[LockId::COUNT];
+
+            ThreadLocks() {
+
+                for (size_t i = 0; i < LockId::COUNT; i += 1) {
+
+                    acquisitions[i].store(0, std::memory_order_relaxed);
+                    contended[i].store(0, std::memory_order_relaxed);
+                    wait_ns[i].store(0, std::memory_order_relaxed);
+                    hold_ns[i].store(0, std::memory_order_relaxed);
+
+                    for (size_t j = 0; j < LockId::COUNT; j += 1) edges[i][j].store(0, std::memory_order_relaxed);
+
+                    depth[i] = 0;
+                    since[i] = 0;
+
+                    }
+
+                }
+
+            };
+
+        void bump(std::atomic<Uint64> &counter, Uint64 n) {
+
+            counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+
+            }
+
+        // Counters outlive their threads, so that a merge sees them all:
+        struct Registry {
+
+            std::mutex mutex;
+
+            std::vector<std::unique_ptr<ThreadLocks>> threads;
+
+            };
+
+        Registry &registry() {
+
+            static Registry *reg = new Registry(); // Never destroyed, like ObjectPool
+
+            return *reg;
+
+            }
+
+        ThreadLocks *thread_locks() {
+
+            thread_local ThreadLocks *locks = nullptr;
+
+            if (locks == nullptr) {
+
+                Registry &reg = registry();
+
+                std::lock_guard<std::mutex> lg(reg.mutex);
+
+                reg.threads.emplace_back(new ThreadLocks());
+
+                locks = reg.threads.back().get();
+
+                }
+
+            return locks;
+
+            }
+
+        }
+
+    void acquired(LockId::IdEnum id, Uint64 wait_ns, bool contended) {
+
+        ThreadLocks *tl = thread_locks();
+
+        if (tl->depth[id]++ > 0) return; // Recursive
+
+        for (size_t held = 0; held < LockId::COUNT; held += 1) {
+
+            if (tl->depth[held] > 0 && held != (size_t)id) bump(tl->edges[held][id], 1);
+
+            }
+
+        bump(tl->acquisitions[id], 1);
+
+        if (contended) {
+
+            bump(tl->contended[id], 1);
+            bump(tl->wait_ns[id], wait_ns);
+
+            }
+
+        tl->since[id] = latency::now();
+
+        }
+
+    void released(LockId::IdEnum id) {
+
+        ThreadLocks *tl = thread_locks();
+
+        if (tl->depth[id] == 0 || --tl->depth[id] > 0) return;
+
+        bump(tl->hold_ns[id], latency::now() - tl->since[id]);
+
+        }
+
+    Profile merge() {
+
+        Profile rv;
+
+        for (size_t i = 0; i < LockId::COUNT; i += 1) {
+
+            rv.locks[i].acquisitions = 0;
+            rv.locks[i].contended    = 0;
+            rv.locks[i].wait_ns      = 0;
+            rv.locks[i].hold_ns      = 0;
+
+            for (size_t j = 0; j < LockId::COUNT; j += 1) rv.edges[i][j] = 0;
+
+            }
+
+        Registry &reg = registry();
+
+        std::lock_guard<std::mutex> lg(reg.mutex);
+
+        for (auto &tl : reg.threads) {
+
+            for (size_t i = 0; i < LockId::COUNT; i += 1) {
+
+                rv.locks[i].acquisitions += tl->acquisitions[i].load(std::memory_order_relaxed);
+                rv.locks[i].contended    += tl->contended[i].load(std::memory_order_relaxed);
+                rv.locks[i].wait_ns      += tl->wait_ns[i].load(std::memory_order_relaxed);
+                rv.locks[i].hold_ns      += tl->hold_ns[i].load(std::memory_order_relaxed);
+
+                for (size_t j = 0; j < LockId::COUNT; j += 1) {
+
+                    rv.edges[i][j] += tl->edges[i][j].load(std::memory_order_relaxed);
+
+                    }
+
+                }
+
+            }
+
+        return rv;
+
+        }
+
+    void dump(std::ostream &out) {
+
+        Profile prof = merge();
+
+        out << "  " << std::left << std::setw(16) << "Lock" << std::right
+            << std::setw(12) << "Acquired" << std::setw(12) << "Contended"
+            << std::setw(14) << "Wait (us)" << std::setw(14) << "Hold (us)" << "\n";
+
+        for (Uint32 id = 0; id < LockId::COUNT; id += 1) {
+
+            const LockCounters &lc = prof.locks[id];
+
+            if (lc.acquisitions == 0) continue;
+
+            out << "  " << std::left << std::setw(16) << LockId::name(id) << std::right
+                << std::setw(12) << lc.acquisitions
+                << std::setw(12) << lc.contended
+                << std::setw(14) << lc.wait_ns / 1000
+                << std::setw(14) << lc.hold_ns / 1000 << "\n";
+
+            }
+
+        out << "  Lock order (held -> taken):\n";
+
+        for (Uint32 a = 0; a < LockId::COUNT; a += 1) {
+
+            for (Uint32 b = 0; b < LockId::COUNT; b += 1) {
+
+                if (prof.edges[a][b] == 0) continue;
+
+                out << "    " << LockId::name(a) << " -> " << LockId::name(b) << ": " << prof.edges[a][b]
+                    << ((prof.edges[b][a] != 0) ? " (also taken in the other order)" : "") << "\n";
+
+                }
+
+            }
+
+        }
+
+    } // End Lock Profile namespace
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+
+#include "IntegralTypes.hpp"
+
+// Contention profile of the kernel's mutexes, enabled at compile time (see
+// KernelMutex). Each thread counts acquisitions, contended acquisitions,
+// time spent waiting and time spent holding per lock, and the lock-order
+// edges it takes: an edge A -> B is counted whenever B is first locked while
+// A is held. Counting is per thread and without locking; merge() adds the
+// threads up. Mutexes of the same kind (the page mutexes of shared
+// segments, the table mutexes of processes) are profiled as one lock.
+#ifndef VM_LOCK_PROFILE
+#define VM_LOCK_PROFILE 0
+#endif
+
+struct LockId {
+
+    enum IdEnum {
+
+        Dvt,
+        Databus,
+        Kslst,
+        Uslst,
+        Pcbvec,
+        Ksft,
+        Usft,
+        SsegPages,
+        Sseg,
+        Tables,
+
+        COUNT
+
+        };
+
+    static const char *name(Uint32 id) {
+
+        static const char *NAMES[COUNT + 1] = {
+
+            "mutex_dvt",
+            "mutex_databus",
+            "mutex_kslst",
+            "mutex_uslst",
+            "mutex_pcbvec",
+            "mutex_ksft",
+            "mutex_usft",
+            "mutex_pages",
+            "mutex_sseg",
+            "mutex_tables",
+            "unknown"
+
+            };
+
+        return NAMES[(id < COUNT) ? id : (Uint32)COUNT];
+
+        }
+
+    };
+
+namespace lockprof { // Start Lock Profile namespace
+
+    struct LockCounters {
+
+        Uint64 acquisitions; // Outermost ones; recursive re-locks aren't counted
+        Uint64 contended;    // Found the lock taken by another thread
+        Uint64 wait_ns;
+        Uint64 hold_ns;
+
+        };
+
+    struct Profile {
+
+        LockCounters locks[LockId::COUNT];
+
+        Uint64 edges[LockId::COUNT][LockId::COUNT]; // [held][taken]
+
+        };
+
+    // Called by the mutexes: after an acquisition (with the time waited for
+    // it) and before a release.
+    void acquired(LockId::IdEnum id, Uint64 wait_ns, bool contended);
+    void released(LockId::IdEnum id);
+
+    // Sums the counters of all threads, including those that have exited.
+    // Locks held meanwhile have no hold time yet.
+    Profile merge();
+
+    // Prints the counters of every lock that was taken, then the lock-order
+    // edges, marking pairs of locks taken in both orders:
+    void dump(std::ostream &out);
+
+    } // End Lock Profile namespace
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <mutex>
+#include <new>
+#include <cstddef>
+
+namespace gen { // Start Generic namespace
+
+    // Fixed-size blocks for objects of type T, carved out of slabs of
+    // SlabObjects blocks. Freed blocks go to a free list and are handed out
+    // again first; slabs are kept for the life of the program. There is one
+    // pool per type, shared by all threads.
+    template<class T, size_t SlabObjects = 64>
+    class ObjectPool {
+
+        private:
+
+            union Block {
+
+                Block *next;
+
+                alignas(T) unsigned char storage[sizeof(T)];
+
+                };
+
+            struct Slab {
+
+                Slab *next;
+
+                Block blocks[SlabObjects];
+
+                };
+
+            std::mutex mutex;
+
+            Block *free_head;
+
+            Slab *slab_head;
+
+            ObjectPool()
+                : free_head(nullptr)
+                , slab_head(nullptr) {
+
+                }
+
+        public:
+
+            ObjectPool(const ObjectPool &other) = delete;
+            ObjectPool& operator=(const ObjectPool &other) = delete;
+
+            ~ObjectPool() {
+
+                while (slab_head != nullptr) {
+
+                    Slab *next = slab_head->next;
+
+                    delete slab_head;
+
+                    slab_head = next;
+
+                    }
+
+                }
+
+            // Never destroyed, so objects may be freed during static
+            // destruction:
+            static ObjectPool &instance() {
+
+                static ObjectPool *pool = new ObjectPool();
+
+                return *pool;
+
+                }
+
+            void *allocate() {
+
+                std::lock_guard<std::mutex> lg(mutex);
+
+                if (free_head == nullptr) {
+
+                    Slab *slab = new Slab;
+
+                    slab->next = slab_head;
+                    slab_head = slab;
+
+                    for (size_t i = 0; i < SlabObjects; i += 1) {
+
+                        slab->blocks[i].next = free_head;
+
+                        free_head = slab->blocks + i;
+
+                        }
+
+                    }
+
+                Block *block = free_head;
+
+                free_head = block->next;
+
+                return block->storage;
+
+                }
+
+            void deallocate(void *ptr) {
+
+                if (ptr == nullptr) return;
+
+                Block *block = reinterpret_cast<Block*>(ptr);
+
+                std::lock_guard<std::mutex> lg(mutex);
+
+                block->next = free_head;
+
+                free_head = block;
+
+                }
+
+        };
+
+    // Gives a class pooled new and delete. Objects of derived classes that
+    // are larger than T go to the general-purpose heap.
+    template<class T>
+    struct Pooled {
+
+        static void *operator new(size_t size) {
+
+            if (size != sizeof(T)) return ::operator new(size);
+
+            return ObjectPool<T>::instance().allocate();
+
+            }
+
+        static void operator delete(void *ptr, size_t size) {
+
+            if (size != sizeof(T)) { ::operator delete(ptr); return; }
+
+            ObjectPool<T>::instance().deallocate(ptr);
+
+            }
+
+        };
+
+    // Allocator for std::allocate_shared and containers: single objects
+    // come from the pool of their type, arrays from the heap.
+    template<class T>
+    struct PoolAllocator {
+
+        typedef T value_type;
+
+        PoolAllocator() = default;
+
+        template<class U>
+        PoolAllocator(const PoolAllocator<U> &) { }
+
+        T *allocate(size_t n) {
+
+            if (n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+
+            return static_cast<T*>(ObjectPool<T>::instance().allocate());
+
+            }
+
+        void deallocate(T *ptr, size_t n) {
+
+            if (n != 1) { ::operator delete(ptr); return; }
+
+            ObjectPool<T>::instance().deallocate(ptr);
+
+            }
+
+        template<class U>
+        bool operator==(const PoolAllocator<U> &other) const { return true; }
+
+        template<class U>
+        bool operator!=(const PoolAllocator<U> &other) const { return false; }
+
+        };
+
+    } // End Generic namespace
@@ -0,0 +1,789 @@
+// Partition for POSIX systems; on Windows it comes from part.lib, and only
+// the extensions are defined here.
+#include "Part.h"
+
+#if defined(_WIN32)
+
+char *Partition::mapCluster(ClusterNo) {
+
+    return nullptr;
+
+    }
+
+void Partition::clustersWritten(ClusterNo, ClusterNo) {
+
+    }
+
+int Partition::flushClusters() {
+
+    return 1;
+
+    }
+
+int Partition::readClusters(const ClusterIo *io, ClusterNo count) {
+
+    for (ClusterNo i = 0; i < count; i += 1) {
+
+        if (readCluster(io[i].cluster, io[i].buffer) != 1) return 0;
+
+        }
+
+    return 1;
+
+    }
+
+int Partition::writeClusters(const ClusterIo *io, ClusterNo count) {
+
+    for (ClusterNo i = 0; i < count; i += 1) {
+
+        if (writeCluster(io[i].cluster, io[i].buffer) != 1) return 0;
+
+        }
+
+    return 1;
+
+    }
+
+int Partition::readClusters(ClusterNo first, ClusterNo count, char *buffer) {
+
+    for (ClusterNo i = 0; i < count; i += 1) {
+
+        if (readCluster(first + i, buffer + i * ClusterSize) != 1) return 0;
+
+        }
+
+    return 1;
+
+    }
+
+int Partition::writeClusters(ClusterNo first, ClusterNo count, const char *buffer) {
+
+    for (ClusterNo i = 0; i < count; i += 1) {
+
+        if (writeCluster(first + i, buffer + i * ClusterSize) != 1) return 0;
+
+        }
+
+    return 1;
+
+    }
+
+#else
+
+#include "Platform.hpp"
+#include "IntegralTypes.hpp"
+#include "Macros.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+// A partition is a regular file, described by its .ini file the same way as
+// for part.lib: the first line names the file and the second gives its size
+// in clusters (anything after the number is a comment). An optional third
+// line chooses how the file is accessed:
+//   pread  - pread/pwrite through the page cache (the default)
+//   direct - O_DIRECT; falls back to pread where the file system refuses it
+//   mmap   - the file is mapped; clusters are copied to and from it, or
+//            used in place through mapCluster, and written back to the file
+//            in batches by flushClusters
+// A missing file is created and a short one extended, and relative paths are
+// taken from the working directory. Calls return 1 on success and 0 on
+// failure, like those of part.lib.
+
+struct PartitionMode {
+
+    enum ModeEnum {
+
+        Pread,
+        Direct,
+        Mmap
+
+        };
+
+    };
+
+class PartitionImpl {
+
+    public:
+
+        // O_DIRECT transfers must be aligned to the device's logical block;
+        // clusters are read and written within blocks of this size:
+        static const size_t DIRECT_ALIGN = 4096;
+
+        // Clusters per preadv/pwritev call (well below IOV_MAX), and per
+        // direct transfer:
+        static const int VECTOR_MAX = 64;
+
+        // A direct transfer of VECTOR_MAX clusters spans at most this much,
+        // counting the partial blocks at either end:
+        static const size_t DIRECT_SPAN = VECTOR_MAX * ClusterSize + 2 * DIRECT_ALIGN;
+
+        // Direct writes lock every block they touch, by block number modulo
+        // BLOCK_LOCKS, so that read-modify-writes of one block don't race:
+        static const size_t BLOCK_LOCKS = 64;
+
+        int fd;
+
+        ClusterNo clusters;
+
+        PartitionMode::ModeEnum mode;
+
+        char *map;
+        size_t file_size;
+
+        // Mmap mode: one bit per page of the mapping written since the last
+        // flush.
+        size_t os_page;
+        size_t dirty_words;
+        std::unique_ptr<std::atomic<Uint64>[]> dirty;
+
+        void mark_dirty(size_t offset, size_t size);
+        bool flush();
+
+        std::mutex block_locks[BLOCK_LOCKS]; // Direct mode
+
+        PartitionImpl()
+            : fd(-1)
+            , clusters(0)
+            , mode(PartitionMode::Pread)
+            , map(nullptr)
+            , file_size(0)
+            , os_page(0)
+            , dirty_words(0) { }
+
+        bool open_file(const std::string &path);
+
+        bool read_at(char *buffer, size_t size, off_t offset);
+        bool write_at(const char *buffer, size_t size, off_t offset);
+        bool vector_at(struct iovec *iov, int iovcnt, off_t offset, bool write);
+        bool direct_run(const ClusterIo *io, ClusterNo n, bool write);
+        bool direct_range(ClusterNo first, ClusterNo count, char *buffer, bool write);
+
+        bool transfer(const ClusterIo *io, ClusterNo count, bool write);
+
+    };
+
+// Thread safety: Not needed ('Structor)
+bool PartitionImpl::open_file(const std::string &path) {
+
+    int flags = O_RDWR | O_CREAT;
+
+    if (mode == PartitionMode::Direct) {
+
+    #if defined(O_DIRECT)
+        fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+
+        if (fd < 0 && errno == EINVAL) {
+
+            std::cerr << "Partition - O_DIRECT isn't supported for " << path << "; using pread.\n";
+
+            mode = PartitionMode::Pread;
+
+            }
+    #else
+        mode = PartitionMode::Pread;
+    #endif
+
+        }
+
+    if (fd < 0) fd = ::open(path.c_str(), flags, 0644);
+
+    if (fd < 0) return false;
+
+    file_size = (size_t)clusters * ClusterSize;
+    file_size = (file_size + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) return false;
+
+    if ((size_t)st.st_size < file_size && ftruncate(fd, (off_t)file_size) != 0) return false;
+
+    if (mode == PartitionMode::Mmap && file_size > 0) {
+
+        void *addr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (addr == MAP_FAILED) return false;
+
+        map = static_cast<char*>(addr);
+
+        os_page = (size_t)sysconf(_SC_PAGESIZE);
+
+        dirty_words = DIV_CEIL(DIV_CEIL(file_size, os_page), 64);
+
+        dirty.reset(new std::atomic<Uint64>[dirty_words]);
+
+        for (size_t i = 0; i < dirty_words; i += 1) dirty[i].store(0, std::memory_order_relaxed);
+
+        }
+
+    return true;
+
+    }
+
+// Thread safety: Yes (Atomic)
+void PartitionImpl::mark_dirty(size_t offset, size_t size) {
+
+    for (size_t p = offset / os_page; p <= (offset + size - 1) / os_page; p += 1) {
+
+        dirty[p / 64].fetch_or((Uint64)1 << (p % 64), std::memory_order_relaxed);
+
+        }
+
+    }
+
+// Thread safety: Yes (Atomic)
+// Writes back the pages marked dirty, one msync per run of adjacent pages.
+bool PartitionImpl::flush() {
+
+    bool ok = true;
+
+    size_t run_start = 0, run_len = 0;
+
+    for (size_t w = 0; w < dirty_words; w += 1) {
+
+        Uint64 bits = (dirty[w].load(std::memory_order_relaxed) != 0)
+                    ? dirty[w].exchange(0, std::memory_order_acq_rel) : 0;
+
+        for (size_t b = 0; b < 64; b += 1) {
+
+            size_t p = w * 64 + b;
+
+            if ((bits >> b) & 1) {
+
+                if (run_len == 0) run_start = p;
+
+                run_len += 1;
+
+                }
+            else if (run_len > 0) {
+
+                ok = (msync(map + run_start * os_page, run_len * os_page, MS_SYNC) == 0) && ok;
+
+                run_len = 0;
+
+                }
+
+            }
+
+        }
+
+    if (run_len > 0) {
+
+        ok = (msync(map + run_start * os_page, run_len * os_page, MS_SYNC) == 0) && ok;
+
+        }
+
+    return ok;
+
+    }
+
+// Thread safety: Yes (pread is)
+bool PartitionImpl::read_at(char *buffer, size_t size, off_t offset) {
+
+    while (size > 0) {
+
+        ssize_t n = ::pread(fd, buffer, size, offset);
+
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n <= 0) return false;
+
+        buffer += n;
+        size   -= (size_t)n;
+        offset += n;
+
+        }
+
+    return true;
+
+    }
+
+// Thread safety: Yes (pwrite is)
+bool PartitionImpl::write_at(const char *buffer, size_t size, off_t offset) {
+
+    while (size > 0) {
+
+        ssize_t n = ::pwrite(fd, buffer, size, offset);
+
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n <= 0) return false;
+
+        buffer += n;
+        size   -= (size_t)n;
+        offset += n;
+
+        }
+
+    return true;
+
+    }
+
+// Thread safety: Yes (preadv/pwritev are)
+// Moves whole vectors, resuming after short transfers; iov is used up.
+bool PartitionImpl::vector_at(struct iovec *iov, int iovcnt, off_t offset, bool write) {
+
+    while (iovcnt > 0) {
+
+        ssize_t n = write ? ::pwritev(fd, iov, iovcnt, offset) : ::preadv(fd, iov, iovcnt, offset);
+
+        if (n < 0 && errno == EINTR) continue;
+
+        if (n <= 0) return false;
+
+        offset += n;
+
+        size_t done = (size_t)n;
+
+        while (iovcnt > 0 && done >= iov->iov_len) {
+
+            done -= iov->iov_len;
+
+            iov += 1;
+            iovcnt -= 1;
+
+            }
+
+        if (iovcnt > 0) {
+
+            iov->iov_base = static_cast<char*>(iov->iov_base) + done;
+            iov->iov_len -= done;
+
+            }
+
+        }
+
+    return true;
+
+    }
+
+namespace {
+
+    struct BounceFree {
+
+        void operator()(char *bounce) const { plat::aligned_free(bounce); }
+
+        };
+
+    // Aligned staging area of direct transfers, one per thread:
+    thread_local std::unique_ptr<char, BounceFree> direct_bounce;
+
+    }
+
+// Thread safety: Yes (Thread-local bounce buffer, block_locks for writes)
+// Moves n consecutive clusters, starting with io[0].cluster, through the
+// thread's bounce buffer in one transfer of the whole aligned blocks that
+// cover them. Writes first read the blocks at either end if the run only
+// covers part of them.
+bool PartitionImpl::direct_run(const ClusterIo *io, ClusterNo n, bool write) {
+
+    if (!direct_bounce) direct_bounce.reset(static_cast<char*>(plat::aligned_malloc(DIRECT_SPAN, DIRECT_ALIGN)));
+
+    char *bounce = direct_bounce.get();
+
+    if (bounce == nullptr) return false;
+
+    size_t lo = (size_t)io[0].cluster * ClusterSize;
+    size_t hi = lo + (size_t)n * ClusterSize;
+
+    size_t first_block = lo / DIRECT_ALIGN * DIRECT_ALIGN;
+    size_t end_block   = DIV_CEIL(hi, DIRECT_ALIGN) * DIRECT_ALIGN;
+    size_t span        = end_block - first_block;
+
+    if (!write) {
+
+        if (!read_at(bounce, span, (off_t)first_block)) return false;
+
+        for (ClusterNo i = 0; i < n; i += 1) std::memcpy(io[i].buffer, bounce + (lo - first_block) + i * ClusterSize, ClusterSize);
+
+        return true;
+
+        }
+
+    // The span has fewer blocks than there are locks, so each lock is taken
+    // once, in index order:
+    Uint64 locks = 0;
+
+    for (size_t b = first_block / DIRECT_ALIGN; b < end_block / DIRECT_ALIGN; b += 1) locks |= (Uint64)1 << (b % BLOCK_LOCKS);
+
+    for (size_t l = 0; l < BLOCK_LOCKS; l += 1) if (locks & ((Uint64)1 << l)) block_locks[l].lock();
+
+    bool ok = true;
+
+    if (lo != first_block) ok = read_at(bounce, DIRECT_ALIGN, (off_t)first_block);
+
+    if (ok && hi != end_block && (lo == first_block || span > DIRECT_ALIGN)) {
+
+        ok = read_at(bounce + span - DIRECT_ALIGN, DIRECT_ALIGN, (off_t)(end_block - DIRECT_ALIGN));
+
+        }
+
+    if (ok) {
+
+        for (ClusterNo i = 0; i < n; i += 1) std::memcpy(bounce + (lo - first_block) + i * ClusterSize, io[i].buffer, ClusterSize);
+
+        ok = write_at(bounce, span, (off_t)first_block);
+
+        }
+
+    for (size_t l = BLOCK_LOCKS; l > 0; l -= 1) if (locks & ((Uint64)1 << (l - 1))) block_locks[l - 1].unlock();
+
+    return ok;
+
+    }
+
+// Thread safety: Yes (See direct_run)
+// Moves count clusters from first to or from one buffer, VECTOR_MAX at a time.
+bool PartitionImpl::direct_range(ClusterNo first, ClusterNo count, char *buffer, bool write) {
+
+    ClusterIo io[VECTOR_MAX];
+
+    for (ClusterNo done = 0; done < count; ) {
+
+        ClusterNo n = MIN(count - done, (ClusterNo)VECTOR_MAX);
+
+        for (ClusterNo i = 0; i < n; i += 1) {
+
+            io[i].cluster = first + done + i;
+            io[i].buffer  = buffer + (size_t)(done + i) * ClusterSize;
+
+            }
+
+        if (!direct_run(io, n, write)) return false;
+
+        done += n;
+
+        }
+
+    return true;
+
+    }
+
+// Thread safety: Yes (pread and the mapping are; see direct_run)
+// Pread mode gathers each run of consecutive clusters into one vectored call,
+// and direct mode into one transfer of whole blocks; mapped clusters are
+// copied.
+bool PartitionImpl::transfer(const ClusterIo *io, ClusterNo count, bool write) {
+
+    for (ClusterNo i = 0; i < count; i += 1) {
+
+        if (io[i].cluster >= clusters) return false;
+
+        }
+
+    switch (mode) {
+
+        case PartitionMode::Mmap:
+
+            for (ClusterNo i = 0; i < count; i += 1) {
+
+                size_t offset = (size_t)io[i].cluster * ClusterSize;
+
+                if (write) {
+
+                    std::memcpy(map + offset, io[i].buffer, ClusterSize);
+
+                    mark_dirty(offset, ClusterSize);
+
+                    }
+                else {
+
+                    std::memcpy(io[i].buffer, map + offset, ClusterSize);
+
+                    }
+
+                }
+
+            return true;
+
+        default:
+            break;
+
+        }
+
+    struct iovec iov[VECTOR_MAX];
+
+    ClusterNo i = 0;
+
+    while (i < count) {
+
+        ClusterNo first = io[i].cluster;
+
+        int n = 0;
+
+        if (mode == PartitionMode::Direct) {
+
+            do { n += 1; } while (i + n < count && n < VECTOR_MAX && io[i + n].cluster == first + (ClusterNo)n);
+
+            if (!direct_run(io + i, (ClusterNo)n, write)) return false;
+
+            i += n;
+
+            continue;
+
+            }
+
+        do {
+
+            iov[n].iov_base = io[i].buffer;
+            iov[n].iov_len = ClusterSize;
+
+            n += 1;
+            i += 1;
+
+            } while (i < count && n < VECTOR_MAX && io[i].cluster == first + (ClusterNo)n);
+
+        if (!vector_at(iov, n, (off_t)((size_t)first * ClusterSize), write)) return false;
+
+        }
+
+    return true;
+
+    }
+
+// Thread safety: Not needed ('Structor)
+Partition::Partition(const char *ini_path) {
+
+    myImpl = new PartitionImpl();
+
+    std::ifstream ini(ini_path);
+
+    std::string path, line;
+
+    if (!ini || !std::getline(ini, path)) {
+
+        std::cerr << "Partition - Can't read " << ini_path << ".\n";
+
+        return;
+
+        }
+
+    while (!path.empty() && (path.back() == '\r' || path.back() == ' ')) path.pop_back();
+
+    std::getline(ini, line);
+
+    myImpl->clusters = std::strtoul(line.c_str(), nullptr, 10);
+
+    if (std::getline(ini, line)) {
+
+        std::istringstream words(line);
+        std::string mode;
+
+        words >> mode;
+
+        if (mode == "direct") myImpl->mode = PartitionMode::Direct;
+        else if (mode == "mmap") myImpl->mode = PartitionMode::Mmap;
+
+        }
+
+    if (!myImpl->open_file(path)) {
+
+        std::cerr << "Partition - Can't open " << path << ": " << std::strerror(errno) << ".\n";
+
+        myImpl->clusters = 0;
+
+        }
+
+    }
+
+// Thread safety: Yes (Const)
+ClusterNo Partition::getNumOfClusters() const {
+
+    return myImpl->clusters;
+
+    }
+
+// Thread safety: Yes (See PartitionImpl::direct_run)
+int Partition::readCluster(ClusterNo cluster, char *buffer) {
+
+    if (cluster >= myImpl->clusters) return 0;
+
+    size_t offset = (size_t)cluster * ClusterSize;
+
+    switch (myImpl->mode) {
+
+        case PartitionMode::Mmap:
+
+            std::memcpy(buffer, myImpl->map + offset, ClusterSize);
+
+            return 1;
+
+        case PartitionMode::Direct: {
+
+            ClusterIo io = { cluster, buffer };
+
+            return myImpl->direct_run(&io, 1, false) ? 1 : 0;
+
+            }
+
+        default:
+
+            return myImpl->read_at(buffer, ClusterSize, (off_t)offset) ? 1 : 0;
+
+        }
+
+    }
+
+// Thread safety: Yes (See PartitionImpl::direct_run)
+int Partition::writeCluster(ClusterNo cluster, const char *buffer) {
+
+    if (cluster >= myImpl->clusters) return 0;
+
+    size_t offset = (size_t)cluster * ClusterSize;
+
+    switch (myImpl->mode) {
+
+        case PartitionMode::Mmap:
+
+            std::memcpy(myImpl->map + offset, buffer, ClusterSize);
+
+            myImpl->mark_dirty(offset, ClusterSize);
+
+            return 1;
+
+        case PartitionMode::Direct: { // Read-modify-write of the enclosing block
+
+            ClusterIo io = { cluster, const_cast<char*>(buffer) };
+
+            return myImpl->direct_run(&io, 1, true) ? 1 : 0;
+
+            }
+
+        default:
+
+            return myImpl->write_at(buffer, ClusterSize, (off_t)offset) ? 1 : 0;
+
+        }
+
+    }
+
+// Thread safety: Yes (See PartitionImpl::transfer)
+int Partition::readClusters(const ClusterIo *io, ClusterNo count) {
+
+    return myImpl->transfer(io, count, false) ? 1 : 0;
+
+    }
+
+// Thread safety: Yes (See PartitionImpl::transfer)
+int Partition::writeClusters(const ClusterIo *io, ClusterNo count) {
+
+    return myImpl->transfer(io, count, true) ? 1 : 0;
+
+    }
+
+// Thread safety: Yes (See PartitionImpl::direct_run)
+int Partition::readClusters(ClusterNo first, ClusterNo count, char *buffer) {
+
+    if (first >= myImpl->clusters || count > myImpl->clusters - first) return 0;
+
+    size_t offset = (size_t)first * ClusterSize;
+
+    switch (myImpl->mode) {
+
+        case PartitionMode::Mmap:
+
+            std::memcpy(buffer, myImpl->map + offset, (size_t)count * ClusterSize);
+
+            return 1;
+
+        case PartitionMode::Direct:
+
+            return myImpl->direct_range(first, count, buffer, false) ? 1 : 0;
+
+        default:
+
+            return myImpl->read_at(buffer, (size_t)count * ClusterSize, (off_t)offset) ? 1 : 0;
+
+        }
+
+    }
+
+// Thread safety: Yes (See PartitionImpl::direct_run)
+int Partition::writeClusters(ClusterNo first, ClusterNo count, const char *buffer) {
+
+    if (first >= myImpl->clusters || count > myImpl->clusters - first) return 0;
+
+    size_t offset = (size_t)first * ClusterSize;
+
+    switch (myImpl->mode) {
+
+        case PartitionMode::Mmap:
+
+            std::memcpy(myImpl->map + offset, buffer, (size_t)count * ClusterSize);
+
+            myImpl->mark_dirty(offset, (size_t)count * ClusterSize);
+
+            return 1;
+
+        case PartitionMode::Direct:
+
+            return myImpl->direct_range(first, count, const_cast<char*>(buffer), true) ? 1 : 0;
+
+        default:
+
+            return myImpl->write_at(buffer, (size_t)count * ClusterSize, (off_t)offset) ? 1 : 0;
+
+        }
+
+    }
+
+// Thread safety: Yes (Const)
+char *Partition::mapCluster(ClusterNo cluster) {
+
+    if (myImpl->map == nullptr || cluster >= myImpl->clusters) return nullptr;
+
+    return myImpl->map + (size_t)cluster * ClusterSize;
+
+    }
+
+// Thread safety: Yes (Atomic)
+void Partition::clustersWritten(ClusterNo first, ClusterNo count) {
+
+    if (myImpl->map == nullptr || count == 0) return;
+
+    myImpl->mark_dirty((size_t)first * ClusterSize, (size_t)count * ClusterSize);
+
+    }
+
+// Thread safety: Yes (Atomic)
+int Partition::flushClusters() {
+
+    if (myImpl->map == nullptr) return 1;
+
+    return myImpl->flush() ? 1 : 0;
+
+    }
+
+// Thread safety: Not needed ('Structor)
+Partition::~Partition() {
+
+    if (myImpl->map != nullptr) {
+
+        myImpl->flush();
+
+        munmap(myImpl->map, myImpl->file_size);
+
+        }
+
+    if (myImpl->fd >= 0) ::close(myImpl->fd);
+
+    delete myImpl;
+
+    }
+
+#endif
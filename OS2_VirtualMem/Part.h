@@ -4,6 +4,15 @@ typedef unsigned long ClusterNo;
 
 const unsigned long ClusterSize = 1024;
 
+// One cluster of a vectored transfer. Writes only read from the buffer (as
+// with struct iovec, one type serves both directions).
+struct ClusterIo {
+
+    ClusterNo cluster;
+    char *buffer;
+
+    };
+
 class PartitionImpl;
 
 class Partition {
@@ -17,5 +26,22 @@ class Partition {
         virtual int readCluster(ClusterNo, char *buffer);
         virtual int writeCluster(ClusterNo, const char *buffer);
         virtual ~Partition();
+
+        // Extensions (Part.cpp); not virtual, so part.lib's layout is kept.
+        // A memory-mapped partition exposes its clusters, which lie one after
+        // another in the mapping; others return nullptr. Clusters written
+        // through the mapping are reported and written back by flushClusters.
+        char *mapCluster(ClusterNo);
+        void clustersWritten(ClusterNo first, ClusterNo count);
+        int flushClusters();
+
+        // Several clusters per call: a list of (cluster, buffer) pairs, or a
+        // range of clusters to or from one contiguous buffer. Runs of
+        // consecutive clusters are moved with one vectored system call where
+        // the backend allows it. Fail (0) if any cluster is out of range.
+        int readClusters(const ClusterIo *io, ClusterNo count);
+        int writeClusters(const ClusterIo *io, ClusterNo count);
+        int readClusters(ClusterNo first, ClusterNo count, char *buffer);
+        int writeClusters(ClusterNo first, ClusterNo count, const char *buffer);
     
     };
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#include <malloc.h>
+#endif
+
+#include "IntegralTypes.hpp"
+
+// The few compiler- and OS-specific calls the simulator makes, so that it
+// builds with MSVC as well as with GCC/Clang on Linux.
+namespace plat { // Start Platform namespace
+
+    // Index of the highest set bit; value must not be 0.
+    inline unsigned bit_scan_reverse(Uint32 value) {
+
+    #if defined(_MSC_VER)
+        unsigned long ind;
+
+        _BitScanReverse(&ind, value);
+
+        return (unsigned)ind;
+    #else
+        return 31u - (unsigned)__builtin_clz(value);
+    #endif
+
+        }
+
+    // Index of the lowest set bit; value must not be 0.
+    inline unsigned bit_scan_forward(Uint32 value) {
+
+    #if defined(_MSC_VER)
+        unsigned long ind;
+
+        _BitScanForward(&ind, value);
+
+        return (unsigned)ind;
+    #else
+        return (unsigned)__builtin_ctz(value);
+    #endif
+
+        }
+
+    // Whether the processor and the OS support AVX2; false off x86.
+    inline bool cpu_has_avx2() {
+
+    #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        int regs[4];
+
+        __cpuid(regs, 0);
+
+        if (regs[0] < 7) return false;
+
+        __cpuid(regs, 1);
+
+        bool osxsave = (regs[2] & (1 << 27)) != 0;
+        bool avx     = (regs[2] & (1 << 28)) != 0;
+
+        if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) return false; // YMM state saved by the OS
+
+        __cpuidex(regs, 7, 0);
+
+        return (regs[1] & (1 << 5)) != 0;
+    #elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+        return __builtin_cpu_supports("avx2") != 0;
+    #else
+        return false;
+    #endif
+
+        }
+
+    // Small number of the calling thread, in order of first call.
+    inline size_t thread_index() {
+
+        static std::atomic<size_t> threads(0);
+
+        thread_local size_t index = threads.fetch_add(1, std::memory_order_relaxed);
+
+        return index;
+
+        }
+
+    // Alignment must be a power of two.
+    inline void *aligned_malloc(size_t size, size_t alignment) {
+
+    #if defined(_MSC_VER)
+        return _aligned_malloc(size, alignment);
+    #else
+        void *ptr = nullptr;
+
+        if (posix_memalign(&ptr, alignment, size) != 0) return nullptr;
+
+        return ptr;
+    #endif
+
+        }
+
+    inline void aligned_free(void *ptr) {
+
+    #if defined(_MSC_VER)
+        _aligned_free(ptr);
+    #else
+        std::free(ptr);
+    #endif
+
+        }
+
+    } // End Platform namespace
@@ -1,6 +1,7 @@
 
 #include "Process.h"
 #include "KernelProcess.hpp"
+#include "ObjectPool.hpp"
 
 Process::Process(ProcessId pid) {
 
@@ -14,6 +15,22 @@ Process::~Process() {
 
     }
 
+void *Process::operator new(size_t size) {
+
+    if (size != sizeof(Process)) return ::operator new(size);
+
+    return gen::ObjectPool<Process>::instance().allocate();
+
+    }
+
+void Process::operator delete(void *ptr, size_t size) {
+
+    if (size != sizeof(Process)) { ::operator delete(ptr); return; }
+
+    gen::ObjectPool<Process>::instance().deallocate(ptr);
+
+    }
+
 ProcessId Process::getProcessId() const {
     
     return pProcess->get_pid();
@@ -58,6 +75,12 @@ void Process::blockIfThrashing() {
 
     }
 
+ProcessStats Process::getStats() const {
+
+    return pProcess->get_stats();
+
+    }
+
 Status Process::createSharedSegment(VirtualAddress startAddress, PageNum segmentSize, const char * name, AccessType flags) {
 
     return pProcess->create_shared_segment(startAddress, segmentSize, name, flags);
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstddef>
+
 #include "vm_declarations.h"
+#include "VmStats.h"
 
 class KernelProcess;
 class System;
@@ -25,6 +28,10 @@ class Process {
 
         ~Process();
 
+        // Process objects are pooled:
+        static void *operator new(size_t size);
+        static void operator delete(void *ptr, size_t size);
+
         ProcessId getProcessId() const;
 
         Status createSegment(VirtualAddress startAddress, PageNum segmentSize,
@@ -41,6 +48,9 @@ class Process {
 
         void blockIfThrashing();
 
+        // Memory use and fault counts of the process (see ProcessStats):
+        ProcessStats getStats() const;
+
         // Bonus:
         Status createSharedSegment(VirtualAddress startAddress,
                                    PageNum segmentSize, const char* name, AccessType flags);
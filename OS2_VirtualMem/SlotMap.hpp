@@ -0,0 +1,271 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+#include "IntegralTypes.hpp"
+
+namespace gen { // Start Generic namespace
+
+    // Maps handles to pointers. A handle is a slot index in its low IndexBits
+    // and the slot's generation above them; the generation is bumped when the
+    // slot is freed, so a stale handle finds nothing instead of the slot's
+    // next occupant. Slots live in chunks that are never moved or freed while
+    // the map exists, so get() and at_index() are wait-free and may run
+    // concurrently with insert/assign/erase. Those must be serialized by the
+    // caller.
+    template<class T, unsigned IndexBits, unsigned ChunkBits = 10>
+    class SlotMap {
+
+        public:
+
+            static const Uint32 NIL = 0xFFFFFFFF;
+
+            static const Uint32 INDEX_MASK = ((Uint32)1 << IndexBits) - 1;
+            static const Uint32 GEN_MASK   = ~INDEX_MASK >> IndexBits;
+
+            static const size_t CHUNK_SIZE = (size_t)1 << ChunkBits;
+
+            static_assert(IndexBits > ChunkBits && IndexBits < 32, "SlotMap - bad IndexBits.");
+
+        private:
+
+            struct Slot {
+
+                // Generation << 1 | live; the pointer is only meaningful
+                // while the stamp matches the handle being looked up.
+                std::atomic<Uint32> stamp;
+                std::atomic<T*> ptr;
+
+                Uint32 next_free;
+
+                };
+
+            const size_t max_slots;
+
+            std::unique_ptr<std::atomic<Slot*>[]> chunks;
+
+            size_t fresh;     // Slots below this index have been handed out
+            size_t live;
+
+            Uint32 free_head; // Free slots are reused first in, first out so
+            Uint32 free_tail; // that generations of a busy map wrap slowly
+
+            Slot *slot(size_t index) const {
+
+                Slot *chunk = chunks[index >> ChunkBits].load(std::memory_order_acquire);
+
+                if (chunk == nullptr) return nullptr;
+
+                return chunk + (index & (CHUNK_SIZE - 1));
+
+                }
+
+            static Uint32 make_stamp(Uint32 gen, bool is_live) {
+
+                return (gen << 1) | (is_live ? 1 : 0);
+
+                }
+
+        public:
+
+            // The index with all IndexBits set is never handed out, so no
+            // handle equals NIL:
+            explicit SlotMap(size_t max_slots_)
+                : max_slots(max_slots_ < INDEX_MASK ? max_slots_ : INDEX_MASK)
+                , chunks(new std::atomic<Slot*>[(max_slots + CHUNK_SIZE - 1) >> ChunkBits])
+                , fresh(0)
+                , live(0)
+                , free_head(NIL)
+                , free_tail(NIL) {
+
+                for (size_t i = 0; i < (max_slots + CHUNK_SIZE - 1) >> ChunkBits; i += 1) {
+
+                    chunks[i].store(nullptr, std::memory_order_relaxed);
+
+                    }
+
+                }
+
+            SlotMap(const SlotMap &other) = delete;
+            SlotMap& operator=(const SlotMap &other) = delete;
+
+            ~SlotMap() {
+
+                for (size_t i = 0; i < (max_slots + CHUNK_SIZE - 1) >> ChunkBits; i += 1) {
+
+                    delete[] chunks[i].load(std::memory_order_relaxed);
+
+                    }
+
+                }
+
+            static size_t index_of(Uint32 handle) {
+
+                return handle & INDEX_MASK;
+
+                }
+
+            // Returns NIL when all slots are taken.
+            Uint32 insert(T *value) {
+
+                size_t index;
+
+                if (free_head != NIL) {
+
+                    index = free_head;
+
+                    free_head = slot(index)->next_free;
+
+                    if (free_head == NIL) free_tail = NIL;
+
+                    }
+                else {
+
+                    if (fresh == max_slots) return NIL;
+
+                    index = fresh;
+
+                    if ((index & (CHUNK_SIZE - 1)) == 0) {
+
+                        Slot *chunk = new Slot[CHUNK_SIZE];
+
+                        for (size_t i = 0; i < CHUNK_SIZE; i += 1) {
+
+                            chunk[i].stamp.store(make_stamp(0, false), std::memory_order_relaxed);
+                            chunk[i].ptr.store(nullptr, std::memory_order_relaxed);
+                            chunk[i].next_free = NIL;
+
+                            }
+
+                        chunks[index >> ChunkBits].store(chunk, std::memory_order_release);
+
+                        }
+
+                    fresh += 1;
+
+                    }
+
+                Slot *s = slot(index);
+
+                Uint32 gen = s->stamp.load(std::memory_order_relaxed) >> 1;
+
+                s->ptr.store(value, std::memory_order_release);
+                s->stamp.store(make_stamp(gen, true), std::memory_order_release);
+
+                live += 1;
+
+                return (gen << IndexBits) | (Uint32)index;
+
+                }
+
+            // Replaces the pointer of a live handle (e.g. one inserted as
+            // nullptr to learn its handle first).
+            void assign(Uint32 handle, T *value) {
+
+                Slot *s = slot(index_of(handle));
+
+                s->ptr.store(value, std::memory_order_release);
+
+                }
+
+            bool erase(Uint32 handle) {
+
+                size_t index = index_of(handle);
+
+                if (index >= fresh) return false;
+
+                Slot *s = slot(index);
+
+                Uint32 stamp = s->stamp.load(std::memory_order_relaxed);
+
+                if (stamp != make_stamp(handle >> IndexBits, true)) return false;
+
+                // The new stamp is published before the pointer changes, so a
+                // reader that sees a later pointer also sees the new stamp:
+                s->stamp.store(make_stamp(((stamp >> 1) + 1) & GEN_MASK, false), std::memory_order_release);
+                s->ptr.store(nullptr, std::memory_order_release);
+
+                s->next_free = NIL;
+
+                if (free_tail == NIL) free_head = (Uint32)index;
+                else slot(free_tail)->next_free = (Uint32)index;
+
+                free_tail = (Uint32)index;
+
+                live -= 1;
+
+                return true;
+
+                }
+
+            // Wait-free; returns nullptr if the handle is stale or unknown.
+            T *get(Uint32 handle) const {
+
+                size_t index = index_of(handle);
+
+                if (index >= max_slots) return nullptr;
+
+                Slot *s = slot(index);
+
+                if (s == nullptr) return nullptr;
+
+                Uint32 expected = make_stamp(handle >> IndexBits, true);
+
+                if (s->stamp.load(std::memory_order_acquire) != expected) return nullptr;
+
+                T *value = s->ptr.load(std::memory_order_acquire);
+
+                if (s->stamp.load(std::memory_order_acquire) != expected) return nullptr;
+
+                return value;
+
+                }
+
+            // Wait-free; ignores generations (for indices kept by the kernel
+            // itself, which are never stale).
+            T *at_index(size_t index) const {
+
+                if (index >= max_slots) return nullptr;
+
+                Slot *s = slot(index);
+
+                if (s == nullptr) return nullptr;
+
+                return s->ptr.load(std::memory_order_acquire);
+
+                }
+
+            // Returns NIL if the slot is free.
+            Uint32 handle_of(size_t index) const {
+
+                if (index >= max_slots) return NIL;
+
+                Slot *s = slot(index);
+
+                if (s == nullptr) return NIL;
+
+                Uint32 stamp = s->stamp.load(std::memory_order_acquire);
+
+                if ((stamp & 1) == 0) return NIL;
+
+                return ((stamp >> 1) << IndexBits) | (Uint32)index;
+
+                }
+
+            size_t size() const {
+
+                return live;
+
+                }
+
+            size_t capacity() const {
+
+                return max_slots;
+
+                }
+
+        };
+
+    } // End Generic namespace
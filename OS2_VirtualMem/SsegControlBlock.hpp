@@ -1,27 +1,162 @@
 #pragma once
 
-#include <list>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstring>
+
+#include "IntegralTypes.hpp"
+#include "HelperStructs.hpp"
+#include "KernelMutex.hpp"
+#include "ObjectPool.hpp"
 
 class KernelProcess;
-class Process;
 
-struct PcbAndIndex {
-    
+// A user of a shared segment: the process, and the index and first page of
+// the segment in its segment table. Links into the segment's list of users.
+struct PcbAndIndex : gen::Pooled<PcbAndIndex> {
+
     KernelProcess *pcb;
     size_t index;
+    VirtualAddress start;
 
-    PcbAndIndex(KernelProcess *pcb_, size_t index_)
+    PcbAndIndex *prev;
+    PcbAndIndex *next;
+
+    PcbAndIndex(KernelProcess *pcb_, size_t index_, VirtualAddress start_)
         : pcb(pcb_)
-        , index(index_) { }
-    
+        , index(index_)
+        , start(start_)
+        , prev(nullptr)
+        , next(nullptr) { }
+
+    };
+
+// Name of a shared segment as a key of the registry. Keys in the registry
+// point to the name interned in the segment's control block; a lookup wraps
+// the caller's string as it is, so finding a segment doesn't allocate.
+struct SsegName {
+
+    const char *str;
+    size_t len;
+    size_t hash;
+
+    explicit SsegName(const char *str_)
+        : str(str_)
+        , len(std::strlen(str_)) {
+
+        // FNV-1a:
+        Uint64 h = 14695981039346656037ull;
+
+        for (size_t i = 0; i < len; i += 1) {
+
+            h ^= static_cast<unsigned char>(str[i]);
+            h *= 1099511628211ull;
+
+            }
+
+        hash = (size_t)h;
+
+        }
+
+    bool operator==(const SsegName &other) const {
+
+        return (len == other.len && std::memcmp(str, other.str, len) == 0);
+
+        }
+
+    struct Hash {
+
+        size_t operator()(const SsegName &name) const {
+
+            return name.hash;
+
+            }
+
+        };
+
     };
 
-struct SsegControlBlock {
+// A shared segment doesn't need a process of its own: it keeps one entry per
+// page in the format of a leaf page table entry (frame while valid, swap slot
+// otherwise), and its frames are entered into the reverse map under the pid
+// KernelSystem::SSEG_START_IND + sseg_vec_index.
+struct SsegControlBlock : std::enable_shared_from_this<SsegControlBlock> {
 
-    Process *dummy;
+    std::unique_ptr<char[]> name; // Interned
 
     size_t sseg_vec_index;
 
-    std::list<PcbAndIndex> users;
-    
-    };
\ No newline at end of file
+    AccessType access;
+
+    std::vector<PageTableL2Entry> pages; // Never resized, so entries stay put
+
+    PcbAndIndex *users; // Intrusive, doubly linked
+
+    // Synchronization:
+    // mutex_pages serializes faults on the segment's pages and its deletion;
+    // it is taken before any of the kernel's mutexes. mutex_users guards only
+    // the list of users and nothing is locked while holding it.
+    KernelMutex mutex_pages;
+    std::mutex mutex_users;
+
+    bool deleted;
+
+    SsegControlBlock(const char *name_, PageNum size, AccessType access_)
+        : name(new char[std::strlen(name_) + 1])
+        , sseg_vec_index(0)
+        , access(access_)
+        , pages(size)
+        , users(nullptr)
+        , mutex_pages(LockId::SsegPages)
+        , deleted(false) {
+
+        std::strcpy(name.get(), name_);
+
+        for (size_t i = 0; i < size; i += 1) {
+
+            pages[i].reset();
+
+            pages[i].set_inseg(true);
+            pages[i].set_tbc(true);
+            pages[i].set_access(access_);
+
+            }
+
+        }
+
+    ~SsegControlBlock() {
+
+        while (users != nullptr) {
+
+            PcbAndIndex *next = users->next;
+
+            delete users;
+
+            users = next;
+
+            }
+
+        }
+
+    void users_push(PcbAndIndex *user) {
+
+        user->prev = nullptr;
+        user->next = users;
+
+        if (users != nullptr) users->prev = user;
+
+        users = user;
+
+        }
+
+    void users_unlink(PcbAndIndex *user) {
+
+        if (user->prev != nullptr) user->prev->next = user->next;
+        else users = user->next;
+
+        if (user->next != nullptr) user->next->prev = user->prev;
+
+        }
+
+    };
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+#include "IntegralTypes.hpp"
+#include "Platform.hpp"
+
+struct StatId {
+
+    enum IdEnum {
+
+        Accesses,
+        IptHits,
+        WalkHits,
+        FaultsZeroFill,
+        FaultsSwapIn,
+        FaultsShared,
+        TableSwapIns,
+        PageSwapIns,
+        EvictUserPages,
+        EvictPageTables,
+        EvictPageDirs,
+        EvictSegTables,
+        DirtyWritebacks,
+        DvtAllocations,
+        DiskReads,
+        DiskWrites,
+        LockWaits,
+
+        COUNT
+
+        };
+
+    };
+
+// Event counters, sharded by thread so that threads counting at the same
+// time mostly touch different cache lines. Threads beyond SHARDS share
+// shards, hence the atomic adds; reading sums the shards without locking.
+class StatCounters {
+
+    public:
+
+        static const size_t SHARDS = 16;
+
+        // Thread safety: Not needed ('Structor)
+        StatCounters() {
+
+            // Owners are allocated with plain new, which need not honour
+            // the shards' alignment, so they are lined up here by hand:
+            std::uintptr_t base = reinterpret_cast<std::uintptr_t>(storage);
+
+            shards = reinterpret_cast<Shard*>((base + alignof(Shard) - 1) / alignof(Shard) * alignof(Shard));
+
+            for (size_t s = 0; s < SHARDS; s += 1) {
+
+                new (&shards[s]) Shard;
+
+                for (size_t i = 0; i < STRIDE; i += 1) shards[s].count[i].store(0, std::memory_order_relaxed);
+
+                }
+
+            }
+
+        StatCounters(const StatCounters &other) = delete;
+        StatCounters& operator=(const StatCounters &other) = delete;
+
+        // Thread safety: Yes (Atomic)
+        void add(StatId::IdEnum id, Uint64 n = 1) {
+
+            shards[plat::thread_index() % SHARDS].count[id].fetch_add(n, std::memory_order_relaxed);
+
+            }
+
+        // Thread safety: Yes (Atomic; a snapshot that may miss adds in flight)
+        Uint64 get(StatId::IdEnum id) const {
+
+            Uint64 rv = 0;
+
+            for (size_t s = 0; s < SHARDS; s += 1) rv += shards[s].count[id].load(std::memory_order_relaxed);
+
+            return rv;
+
+            }
+
+    private:
+
+        // Counters per shard, rounded up to whole cache lines and aligned
+        // to one so that neighbouring shards never share a line:
+        static const size_t STRIDE = (StatId::COUNT + 7) / 8 * 8;
+
+        struct alignas(64) Shard {
+
+            std::atomic<Uint64> count[STRIDE];
+
+            };
+
+        unsigned char storage[(SHARDS + 1) * sizeof(Shard)]; // One spare for alignment
+        Shard *shards;
+
+    };
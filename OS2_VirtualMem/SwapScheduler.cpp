@@ -0,0 +1,269 @@
+#include "SwapScheduler.hpp"
+#include "Macros.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+const Time SwapScheduler::WRITE_DEADLINE;
+
+// Thread safety: Not needed ('Structor)
+SwapScheduler::SwapScheduler(Partition *disk_)
+    : disk(disk_)
+    , pool(new char[QUEUE_PAGES * PAGE_SIZE])
+    , head(0)
+    , oldest(Clock::now()) {
+
+    free_buffers.reserve(QUEUE_PAGES);
+
+    queued.resize(QUEUE_PAGES);
+
+    for (size_t i = QUEUE_PAGES; i > 0; i -= 1) free_buffers.push_back((Uint32)(i - 1));
+
+    counters.requests  = 0;
+    counters.written   = 0;
+    counters.read_hits = 0;
+    counters.discarded = 0;
+
+    }
+
+// Thread safety: Not needed ('Structor)
+SwapScheduler::~SwapScheduler() {
+
+    flush();
+
+    }
+
+// Thread safety: Yes (Const)
+char *SwapScheduler::buffer(Uint32 index) const {
+
+    return pool.get() + (size_t)index * PAGE_SIZE;
+
+    }
+
+// Thread safety: Yes (mutex, held by the caller)
+// Writes what is queued on entry in elevator order, one request at a time.
+// The lock is let go between requests so that waiting reads get in; writes
+// queued meanwhile are left for the next batch, and keep their age.
+void SwapScheduler::dispatch(std::unique_lock<std::mutex> &lock) {
+
+    ClusterIo io[REQUEST_PAGES * VmConfig::CLUSTERS_PER_PAGE];
+
+    size_t budget = pending.size();
+
+    while (budget > 0 && !pending.empty()) {
+
+        auto it = pending.lower_bound(head);
+
+        if (it == pending.end()) it = pending.begin(); // Sweep again from the lowest slot
+
+        auto first = it;
+
+        ClusterNo count = 0;
+
+        size_t pages = 0;
+
+        while (it != pending.end() && pages < REQUEST_PAGES && pages < budget) {
+
+            for (size_t j = 0; j < VmConfig::CLUSTERS_PER_PAGE; j += 1, count += 1) {
+
+                io[count].cluster = it->first * VmConfig::CLUSTERS_PER_PAGE + j;
+                io[count].buffer  = buffer(it->second) + j * ClusterSize;
+
+                }
+
+            head = it->first + 1;
+
+            pages += 1;
+
+            ++it;
+
+            }
+
+        if (disk->writeClusters(io, count) != 1) {
+
+            HALT("SwapScheduler::dispatch - Partition failure.");
+
+            }
+
+        for (auto e = first; e != it; ++e) free_buffers.push_back(e->second);
+
+        pending.erase(first, it);
+
+        counters.requests += 1;
+        counters.written  += pages;
+
+        budget -= pages;
+
+        lock.unlock();
+        lock.lock();
+
+        }
+
+    oldest = Clock::now();
+
+    for (auto &e : pending) oldest = MIN(oldest, queued[e.second]);
+
+    }
+
+// Thread safety: Yes (mutex)
+void SwapScheduler::write(ClusterNo slot, const char *page) {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto it = pending.find(slot);
+
+    if (it != pending.end()) { // Not sent yet - the new contents go instead
+
+        std::memcpy(buffer(it->second), page, PAGE_SIZE);
+
+        return;
+
+        }
+
+    while (free_buffers.empty()) dispatch(lock);
+
+    Uint32 index = free_buffers.back();
+
+    free_buffers.pop_back();
+
+    std::memcpy(buffer(index), page, PAGE_SIZE);
+
+    queued[index] = Clock::now();
+
+    if (pending.empty()) oldest = queued[index];
+
+    pending.emplace(slot, index);
+
+    if (Clock::now() - oldest >= std::chrono::microseconds(WRITE_DEADLINE)) dispatch(lock);
+
+    }
+
+// Thread safety: Yes (mutex)
+void SwapScheduler::read(ClusterNo slot, char *page) {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto it = pending.find(slot);
+
+    if (it != pending.end()) {
+
+        std::memcpy(page, buffer(it->second), PAGE_SIZE);
+
+        counters.read_hits += 1;
+
+        return;
+
+        }
+
+    lock.unlock(); // The slot's last write, if any, has reached the partition
+
+    if (disk->readClusters(slot * VmConfig::CLUSTERS_PER_PAGE, VmConfig::CLUSTERS_PER_PAGE, page) != 1) {
+
+        HALT("SwapScheduler::read - Partition failure.");
+
+        }
+
+    }
+
+// Thread safety: Yes (mutex)
+// Slots that go to the partition are read in ascending order, REQUEST_PAGES
+// per request.
+void SwapScheduler::read_pages(const ClusterNo *slots, char *const *pages, size_t n) {
+
+    ClusterIo io[REQUEST_PAGES * VmConfig::CLUSTERS_PER_PAGE];
+
+    for (size_t done = 0; done < n; done += REQUEST_PAGES) {
+
+        size_t end = MIN(n, done + REQUEST_PAGES);
+
+        ClusterNo count = 0;
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        for (size_t i = done; i < end; i += 1) {
+
+            auto it = pending.find(slots[i]);
+
+            if (it != pending.end()) {
+
+                std::memcpy(pages[i], buffer(it->second), PAGE_SIZE);
+
+                counters.read_hits += 1;
+
+                continue;
+
+                }
+
+            for (size_t j = 0; j < VmConfig::CLUSTERS_PER_PAGE; j += 1, count += 1) {
+
+                io[count].cluster = slots[i] * VmConfig::CLUSTERS_PER_PAGE + j;
+                io[count].buffer  = pages[i] + j * ClusterSize;
+
+                }
+
+            }
+
+        lock.unlock();
+
+        std::sort(io, io + count, [](const ClusterIo &a, const ClusterIo &b) { return a.cluster < b.cluster; });
+
+        if (count > 0 && disk->readClusters(io, count) != 1) {
+
+            HALT("SwapScheduler::read_pages - Partition failure.");
+
+            }
+
+        }
+
+    }
+
+// Thread safety: Yes (mutex)
+// Called before a slot is freed; its pending write, if any, is dropped.
+void SwapScheduler::discard(ClusterNo slot) {
+
+    std::lock_guard<std::mutex> lg(mutex);
+
+    auto it = pending.find(slot);
+
+    if (it == pending.end()) return;
+
+    free_buffers.push_back(it->second);
+
+    pending.erase(it);
+
+    counters.discarded += 1;
+
+    }
+
+// Thread safety: Yes (mutex)
+// Sends a batch out if the oldest queued write has reached its deadline.
+bool SwapScheduler::dispatch_expired() {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (pending.empty() || Clock::now() - oldest < std::chrono::microseconds(WRITE_DEADLINE)) return false;
+
+    dispatch(lock);
+
+    return true;
+
+    }
+
+// Thread safety: Yes (mutex)
+void SwapScheduler::flush() {
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!pending.empty()) dispatch(lock);
+
+    }
+
+// Thread safety: Yes (mutex)
+SwapScheduler::Counters SwapScheduler::get_counters() {
+
+    std::lock_guard<std::mutex> lg(mutex);
+
+    return counters;
+
+    }
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "VmDecl.hpp"
+#include "IntegralTypes.hpp"
+#include "VmGeometry.hpp"
+#include "Part.h"
+
+// Stage between the kernel and its partition, in page-sized swap slots.
+//
+// Writes are copied into a queue and reach the partition later, in batches
+// sent in slot order from where the previous batch ended (a circular
+// elevator); each request carries up to REQUEST_PAGES slots, and runs of
+// adjacent slots in it become single vectored transfers. A batch goes out
+// when the queue is full or its oldest write is WRITE_DEADLINE old, and the
+// queue is drained by flush().
+//
+// Reads never queue: a slot with a pending write is served from the queue,
+// any other straight from the partition, so a page-in waits behind at most
+// the one write request in progress. Writes to slots that are freed before
+// they go out are dropped (see discard).
+class SwapScheduler {
+
+    public:
+
+        static const size_t QUEUE_PAGES   = 128;
+        static const size_t REQUEST_PAGES = 64;
+
+        static const Time WRITE_DEADLINE = 20000; // Microseconds
+
+        struct Counters {
+
+            size_t requests;   // Write requests sent to the partition
+            size_t written;    // Slots they carried
+            size_t read_hits;  // Reads served from the queue
+            size_t discarded;  // Writes dropped as their slots were freed
+
+            };
+
+    private:
+
+        typedef std::chrono::steady_clock Clock;
+
+        Partition *disk;
+
+        std::unique_ptr<char[]> pool; // QUEUE_PAGES buffers
+        std::vector<Uint32> free_buffers;
+
+        std::map<ClusterNo, Uint32> pending; // Slot -> buffer
+
+        ClusterNo head; // Slot after the last one written
+
+        std::vector<Clock::time_point> queued; // Per buffer, when its write was queued
+        Clock::time_point oldest; // Of the pending writes
+
+        Counters counters;
+
+        std::mutex mutex;
+
+        char *buffer(Uint32 index) const;
+        void dispatch(std::unique_lock<std::mutex> &lock);
+
+    public:
+
+        explicit SwapScheduler(Partition *disk_);
+
+        SwapScheduler(const SwapScheduler &other) = delete;
+        SwapScheduler& operator=(const SwapScheduler &other) = delete;
+
+        ~SwapScheduler();
+
+        void write(ClusterNo slot, const char *page);
+
+        void read(ClusterNo slot, char *page);
+        void read_pages(const ClusterNo *slots, char *const *pages, size_t n);
+
+        void discard(ClusterNo slot);
+
+        bool dispatch_expired();
+        void flush();
+
+        Counters get_counters();
+
+    };
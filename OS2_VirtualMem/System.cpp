@@ -13,6 +13,16 @@ System::System(PhysicalAddress processVMSpace, PageNum processVMSpaceSize,
     
     }
 
+System::System(PhysicalAddress processVMSpace, PageNum processVMSpaceSize,
+               PhysicalAddress pmtSpace, PageNum pmtSpaceSize,
+               const SwapArea *swapAreas, size_t swapAreaCount) {
+
+    pSystem = new KernelSystem(processVMSpace, processVMSpaceSize,
+                               pmtSpace, pmtSpaceSize,
+                               std::vector<SwapArea>(swapAreas, swapAreas + swapAreaCount));
+
+    }
+
 System::~System() {
     
     delete pSystem;
@@ -43,6 +53,12 @@ Process *System::cloneProcess(ProcessId pid) {
 
     }
 
+VmStats System::getStats() const {
+
+    return pSystem->get_stats();
+
+    }
+
 void System::test() {
     
     pSystem->test();
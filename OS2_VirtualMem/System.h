@@ -1,12 +1,25 @@
 #pragma once
 
+#include <cstddef>
+
 #include "vm_declarations.h"
+#include "VmStats.h"
 
 class Partition;
 class Process;
 class KernelProcess;
 class KernelSystem;
 
+// A swap partition and its priority. Slots are taken from the devices of
+// the highest priority that still have room, spread over them in turn.
+struct SwapArea {
+
+    Partition *partition;
+
+    int priority;
+
+    };
+
 class System {
 
     private:
@@ -22,6 +35,11 @@ class System {
                PhysicalAddress pmtSpace, PageNum pmtSpaceSize,
                Partition* partition);
 
+        // Swap over several partitions (see SwapArea):
+        System(PhysicalAddress processVMSpace, PageNum processVMSpaceSize,
+               PhysicalAddress pmtSpace, PageNum pmtSpaceSize,
+               const SwapArea *swapAreas, size_t swapAreaCount);
+
         ~System();
 
         Process *createProcess();
@@ -33,6 +51,9 @@ class System {
 
         // Bonus
         Process* cloneProcess(ProcessId pid);
+
+        // Counters since the system was created (see VmStats):
+        VmStats getStats() const;
         
         // Temp
         void test();
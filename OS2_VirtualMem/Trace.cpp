@@ -0,0 +1,117 @@
+#include "Trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace trace { // Start Trace namespace
+
+    namespace {
+
+        // Written by its own thread only; head counts every record ever
+        // written, so the ring holds the last RING_RECORDS of them.
+        struct Ring {
+
+            TraceRecord records[RING_RECORDS];
+
+            std::atomic<Uint64> head;
+
+            Uint32 thread;
+
+            };
+
+        // Rings outlive their threads, so that a dump sees them all:
+        struct Registry {
+
+            std::mutex mutex;
+
+            std::vector<std::unique_ptr<Ring>> rings;
+
+            };
+
+        Registry &registry() {
+
+            static Registry *reg = new Registry(); // Never destroyed, like ObjectPool
+
+            return *reg;
+
+            }
+
+        Ring *thread_ring() {
+
+            thread_local Ring *ring = nullptr;
+
+            if (ring == nullptr) {
+
+                Registry &reg = registry();
+
+                std::lock_guard<std::mutex> lg(reg.mutex);
+
+                reg.rings.emplace_back(new Ring());
+
+                ring = reg.rings.back().get();
+
+                ring->head.store(0, std::memory_order_relaxed);
+                ring->thread = (Uint32)(reg.rings.size() - 1);
+
+                }
+
+            return ring;
+
+            }
+
+        }
+
+    void record(TraceEvent::EventEnum event, Uint64 a, Uint64 b) {
+
+        Ring *ring = thread_ring();
+
+        Uint64 head = ring->head.load(std::memory_order_relaxed);
+
+        TraceRecord &rec = ring->records[head & (RING_RECORDS - 1)];
+
+        rec.time   = (Uint64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch()).count();
+        rec.event  = (Uint32)event;
+        rec.thread = ring->thread;
+        rec.arg[0] = a;
+        rec.arg[1] = b;
+
+        ring->head.store(head + 1, std::memory_order_release);
+
+        }
+
+    long long dump(const char *path) {
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+        if (!out) return -1;
+
+        Registry &reg = registry();
+
+        std::lock_guard<std::mutex> lg(reg.mutex);
+
+        std::vector<TraceRecord> all;
+
+        for (auto &ring : reg.rings) {
+
+            Uint64 head  = ring->head.load(std::memory_order_acquire);
+            Uint64 first = (head > RING_RECORDS) ? head - RING_RECORDS : 0;
+
+            for (Uint64 i = first; i < head; i += 1) all.push_back(ring->records[i & (RING_RECORDS - 1)]);
+
+            }
+
+        Uint64 header[2] = { FILE_MAGIC, (Uint64)all.size() };
+
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(all.data()), (std::streamsize)(all.size() * sizeof(TraceRecord)));
+
+        return out ? (long long)all.size() : -1;
+
+        }
+
+    } // End Trace namespace
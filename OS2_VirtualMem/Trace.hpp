@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstddef>
+
+#include "IntegralTypes.hpp"
+
+// Kernel tracing, filtered at compile time. Each trace point has a level,
+// and points above VM_TRACE_LEVEL expand to nothing - their arguments aren't
+// even evaluated. Points that are compiled in append a fixed-size binary
+// record to a ring buffer of the calling thread, without locking; the rings
+// are written out by trace::dump() and read back by the decoder in
+// TraceDecode.cpp.
+#define VM_TRACE_OFF    0
+#define VM_TRACE_EVENTS 1 // Page-level events: swaps, frames given out, large pages
+#define VM_TRACE_WALK   2 // Also every translation step and single-page transfer
+
+#ifndef VM_TRACE_LEVEL
+#define VM_TRACE_LEVEL VM_TRACE_OFF
+#endif
+
+// Where a KernelSystem leaves the trace when it is destroyed:
+#ifndef VM_TRACE_FILE
+#define VM_TRACE_FILE "vm_trace.bin"
+#endif
+
+#if VM_TRACE_LEVEL >= VM_TRACE_EVENTS
+#define TRACE_EVENT(event, a, b) trace::record(TraceEvent::event, (Uint64)(a), (Uint64)(b))
+#else
+#define TRACE_EVENT(event, a, b) do { } while (false)
+#endif
+
+#if VM_TRACE_LEVEL >= VM_TRACE_WALK
+#define TRACE_WALK(event, a, b) trace::record(TraceEvent::event, (Uint64)(a), (Uint64)(b))
+#else
+#define TRACE_WALK(event, a, b) do { } while (false)
+#endif
+
+struct TraceEvent {
+
+    enum EventEnum {
+
+        // VM_TRACE_WALK:
+        AccessPtl1,
+        AccessPtl2,
+        AccessPhys,
+        DiskPut,
+        DiskGet,
+
+        // VM_TRACE_EVENTS:
+        DiskPutPages,
+        DiskGetPages,
+        KsSwapOut,
+        UsSwapOut,
+        KsGrant,
+        UsGrant,
+        UsClone,
+        HugePromote,
+        HugeDemote,
+        TableEvict,
+        DirectoryEvict,
+        MasterEvict,
+        MasterTableSet,
+
+        COUNT
+
+        };
+
+    // Names of the event and its two arguments, for the decoder:
+    struct Info {
+
+        const char *name;
+        const char *arg0;
+        const char *arg1;
+
+        };
+
+    static const Info &info(Uint32 event) {
+
+        static const Info INFO[COUNT + 1] = {
+
+            { "access_ptl1",      "table",    "address" },
+            { "access_ptl2",      "table",    "address" },
+            { "access_phys",      "frame",    "address" },
+            { "disk_put",         "slot",     "buffer"  },
+            { "disk_get",         "slot",     "buffer"  },
+            { "disk_put_pages",   "pages",    ""        },
+            { "disk_get_pages",   "pages",    ""        },
+            { "ks_swap_out",      "frame",    ""        },
+            { "us_swap_out",      "frame",    ""        },
+            { "ks_grant",         "frame",    "type"    },
+            { "us_grant",         "frame",    "type"    },
+            { "us_clone",         "frame",    "source"  },
+            { "huge_promote",     "table",    "frame"   },
+            { "huge_demote",      "frame",    "table"   },
+            { "table_evict",      "table",    ""        },
+            { "directory_evict",  "table",    ""        },
+            { "master_evict",     "table",    ""        },
+            { "master_table_set", "table",    "new"     },
+            { "unknown",          "",         ""        }
+
+            };
+
+        return INFO[(event < COUNT) ? event : (Uint32)COUNT];
+
+        }
+
+    };
+
+// One trace point, as stored in the rings and in dump files:
+struct TraceRecord {
+
+    Uint64 time;   // Nanoseconds, steady clock
+    Uint32 event;
+    Uint32 thread; // In order of each thread's first trace point
+    Uint64 arg[2];
+
+    };
+
+namespace trace { // Start Trace namespace
+
+    static const size_t RING_RECORDS = 1 << 14; // Per thread, power of two
+
+    static const Uint64 FILE_MAGIC = 0x3145434152544D56ull; // "VMTRACE1"
+
+    void record(TraceEvent::EventEnum event, Uint64 a, Uint64 b);
+
+    // Writes the records of every ring, oldest first within a ring; returns
+    // the number written, or -1 if the file couldn't be written. Records
+    // being written meanwhile may come out torn.
+    long long dump(const char *path);
+
+    } // End Trace namespace
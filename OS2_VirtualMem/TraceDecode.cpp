@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+
+#include "IntegralTypes.hpp"
+#include "Trace.hpp"
+
+// Offline decoder of trace::dump() files: prints the records of all threads
+// merged in time order, with times relative to the first record.
+int trace_decode_main(int argc, char **argv) {
+
+    if (argc < 2) {
+
+        std::cout << "Usage: " << argv[0] << " <trace file>\n";
+
+        return 1;
+
+        }
+
+    std::ifstream in(argv[1], std::ios::binary);
+
+    Uint64 header[2];
+
+    if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != trace::FILE_MAGIC) {
+
+        std::cout << argv[1] << " is not a trace file.\n";
+
+        return 1;
+
+        }
+
+    std::vector<TraceRecord> records((size_t)header[1]);
+
+    if (!in.read(reinterpret_cast<char*>(records.data()), (std::streamsize)(records.size() * sizeof(TraceRecord)))) {
+
+        std::cout << argv[1] << " is truncated.\n";
+
+        return 1;
+
+        }
+
+    std::stable_sort(records.begin(), records.end(),
+                     [](const TraceRecord &a, const TraceRecord &b) { return a.time < b.time; });
+
+    Uint64 start = records.empty() ? 0 : records.front().time;
+
+    for (const TraceRecord &rec : records) {
+
+        const TraceEvent::Info &info = TraceEvent::info(rec.event);
+
+        std::cout << std::setw(14) << std::fixed << std::setprecision(3) << (rec.time - start) / 1000.0 << " us  "
+                  << "t" << std::left << std::setw(4) << rec.thread << std::setw(18) << info.name << std::right;
+
+        if (*info.arg0 != '\0') std::cout << info.arg0 << "=" << rec.arg[0] << " ";
+        if (*info.arg1 != '\0') std::cout << info.arg1 << "=" << rec.arg[1];
+
+        std::cout << "\n";
+
+        }
+
+    return 0;
+
+    }
+
+#if defined(VM_TRACE_DECODE_MAIN)
+
+int main(int argc, char **argv) {
+
+    return trace_decode_main(argc, argv);
+
+    }
+
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "IntegralTypes.hpp"
+#include "VmDecl.hpp"
+#include "Part.h"
+
+#include <cstddef>
+
+// Layout of a virtual address (high to low):
+//   [ L1 slot : L1Bits ][ directory slots : DIR_BITS each ][ L2 slot : L2Bits ][ offset : PageBits ]
+// A leaf (L2) page table occupies exactly one frame, so its fan-out follows
+// from the page size; the master table holds the L1 table followed by the
+// segment table in a single frame. With more than two levels, the L1 entries
+// point to page directories (one frame of L1-style entries each) and the
+// entries of the last directory point to the L2 tables.
+template<unsigned PageBits, unsigned L1Bits, unsigned Levels = 2>
+struct VmGeometry {
+
+    static const unsigned PT_LEVELS  = Levels;
+    static const unsigned DIR_LEVELS = Levels - 2; // Directories between L1 and L2
+
+    static const unsigned PAGE_BITS = PageBits;
+    static const unsigned PTL2_BITS = PageBits - 2; // sizeof(PageTableL2Entry) == 4
+    static const unsigned DIR_BITS  = PageBits - 2; // sizeof(PageTableL1Entry) == 4
+    static const unsigned PTL1_BITS = L1Bits;
+
+    static const unsigned VPN_BITS     = PTL1_BITS + DIR_LEVELS * DIR_BITS + PTL2_BITS;
+    static const unsigned ADDRESS_BITS = PAGE_BITS + VPN_BITS;
+
+    static const size_t FRAME_SIZE   = (size_t)1 << PAGE_BITS;
+    static const size_t PTL1_ENTRIES = (size_t)1 << PTL1_BITS;
+    static const size_t PTL2_ENTRIES = (size_t)1 << PTL2_BITS;
+    static const size_t DIR_ENTRIES  = (size_t)1 << DIR_BITS;
+
+    static const size_t PTL1_TABLE_SIZE = PTL1_ENTRIES * 4; // sizeof(PageTableL1Entry) == 4
+    // Start pages of segments are VPN_BITS wide; past two levels they no
+    // longer fit a 4-byte segment table entry beside the length:
+    static const size_t SEGMENT_ENTRY_SIZE = (Levels == 2) ? 4 : 8;
+    static const size_t SEGMENT_ENTRIES    = (FRAME_SIZE - PTL1_TABLE_SIZE) / SEGMENT_ENTRY_SIZE;
+
+    // A page is moved to/from the partition as a run of whole clusters:
+    static const size_t CLUSTERS_PER_PAGE = FRAME_SIZE / ClusterSize;
+
+    static const VirtualAddress OFFSET_MASK = (VirtualAddress)(FRAME_SIZE - 1);
+    static const VirtualAddress VPN_MASK    = ((VirtualAddress)1 << VPN_BITS) - 1;
+
+    static size_t offset(VirtualAddress addr) {
+
+        return (size_t)(addr & OFFSET_MASK);
+
+        }
+
+    static VirtualAddress page(VirtualAddress addr) {
+
+        return ((addr >> PAGE_BITS) & VPN_MASK);
+
+        }
+
+    static size_t ptl1_slot(VirtualAddress addr) {
+
+        return (size_t)((addr >> (PAGE_BITS + PTL2_BITS + DIR_LEVELS * DIR_BITS)) & (PTL1_ENTRIES - 1));
+
+        }
+
+    // Slot in the directory at the given depth (1 = directly below L1)
+    static size_t dir_slot(VirtualAddress addr, unsigned depth) {
+
+        return (size_t)((addr >> (PAGE_BITS + PTL2_BITS + (DIR_LEVELS - depth) * DIR_BITS)) & (DIR_ENTRIES - 1));
+
+        }
+
+    static size_t ptl2_slot(VirtualAddress addr) {
+
+        return (size_t)((addr >> PAGE_BITS) & (PTL2_ENTRIES - 1));
+
+        }
+
+    static bool aligned(VirtualAddress addr) {
+
+        return ((addr & OFFSET_MASK) == 0);
+
+        }
+
+    static_assert(Levels >= 2 && Levels <= 4,
+                  "VmGeometry - Between 2 and 4 page table levels are supported.");
+
+    static_assert(FRAME_SIZE >= ClusterSize && FRAME_SIZE % ClusterSize == 0,
+                  "VmGeometry - Page size must be a multiple of the partition's cluster size.");
+
+    static_assert(ADDRESS_BITS <= 8 * sizeof(VirtualAddress),
+                  "VmGeometry - Address space too wide for VirtualAddress (define VM_WIDE_ADDRESSES).");
+
+    static_assert(VPN_BITS <= 40,
+                  "VmGeometry - Page numbers must fit into SegTableEntry::start_page.");
+
+    static_assert(PTL1_TABLE_SIZE < FRAME_SIZE,
+                  "VmGeometry - L1 table must leave room for the segment table.");
+
+    };
+
+// Number of page table levels: 2 (L1 + L2), 3 or 4. With 1 KiB pages, three
+// levels give a 32-bit address space; with 4 KiB pages, four levels give 48 bits.
+#ifndef VM_PT_LEVELS
+#define VM_PT_LEVELS 2
+#endif
+
+// Default L1 fan-out: 64 entries
+#ifndef VM_PTL1_BITS
+#define VM_PTL1_BITS 6
+#endif
+
+typedef VmGeometry<VM_PAGE_BITS, VM_PTL1_BITS, VM_PT_LEVELS> VmConfig;
+
+static_assert(VmConfig::FRAME_SIZE == PAGE_SIZE, "VmGeometry - PAGE_SIZE does not match VM_PAGE_BITS.");
@@ -0,0 +1,56 @@
+#pragma once
+
+// Snapshot of the kernel's event counters (see System::getStats). Counters
+// only grow; the difference of two snapshots covers the time between them.
+// Each field is summed on its own while the kernel runs, so the fields of a
+// snapshot may be off by events that were in flight.
+struct VmStats {
+
+    // Translation:
+    unsigned long long accesses;          // Calls to System::access
+    unsigned long long ipt_hits;          // Resolved through the inverted page table
+    unsigned long long walk_hits;         // Resolved by walking the page tables
+
+    // Page faults, by what the faulting entry held:
+    unsigned long long faults_zero_fill;  // To-be-created page
+    unsigned long long faults_swap_in;    // Page on disk
+    unsigned long long faults_shared;     // Page of a shared segment
+
+    // Pages read back from swap (faults, read-ahead and clones included):
+    unsigned long long table_swap_ins;    // Kernel tables
+    unsigned long long page_swap_ins;     // User pages
+
+    // Evictions, by type of the frame:
+    unsigned long long evict_user_pages;
+    unsigned long long evict_page_tables;
+    unsigned long long evict_page_dirs;
+    unsigned long long evict_seg_tables;
+
+    // How evicted user pages left memory:
+    unsigned long long dirty_writebacks;  // Written to their swap slots
+    unsigned long long clean_drops;       // Already on disk as they were
+
+    // Swap:
+    unsigned long long dvt_allocations;   // Swap slots taken
+    unsigned long long disk_reads;        // Pages
+    unsigned long long disk_writes;       // Pages (queued ones once sent)
+
+    // Synchronization:
+    unsigned long long lock_waits;        // System::access calls that found the data bus taken
+
+    };
+
+// Snapshot of one process's memory use and faults (see Process::getStats).
+// Page counts are current; fault counts grow over the process's life.
+struct ProcessStats {
+
+    unsigned long long resident_pages; // Pages mapped to frames, shared ones included
+    unsigned long long table_pages;    // Frames held by its page tables and directories, master table included
+    unsigned long long swapped_pages;  // Private pages that are only on swap
+
+    unsigned long long major_faults;   // Faults that read the page from swap
+    unsigned long long minor_faults;   // Faults served from memory (new pages, resident shared pages)
+
+    unsigned long long cloned_pages;   // Pages copied when the process was cloned
+
+    };
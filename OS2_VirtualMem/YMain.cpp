@@ -15,11 +15,11 @@
 #include <chrono>
 #include <cstdlib>
 #include <random>
-#include <windows.h>
 #include <new>
 
 #include "VmDecl.hpp"
 #include "KernelProcess.hpp"
+#include "Platform.hpp"
 
 #ifndef PAGE_SIZE
 #define PAGE_SIZE 1024
@@ -36,8 +36,8 @@ int main2(int, char**) {
     const int US_SIZE = 2;
     const int KS_SIZE = 128;
 
-    Uint8 *us = (Uint8*)_aligned_malloc(US_SIZE * PAGE_SIZE, 1024);
-    Uint8 *ks = (Uint8*)_aligned_malloc(KS_SIZE * PAGE_SIZE, 1024);
+    Uint8 *us = (Uint8*)plat::aligned_malloc(US_SIZE * PAGE_SIZE, PAGE_SIZE);
+    Uint8 *ks = (Uint8*)plat::aligned_malloc(KS_SIZE * PAGE_SIZE, PAGE_SIZE);
 
     Partition part("partition1.ini");
 
@@ -142,8 +142,8 @@ int main2(int, char**) {
     delete p1;
     delete p2;
 
-    _aligned_free(us);
-    _aligned_free(ks);
+    plat::aligned_free(us);
+    plat::aligned_free(ks);
 
     std::cout << "Test completed!\n";
 
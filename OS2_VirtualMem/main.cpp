@@ -1,10 +1,11 @@
 #include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <memory>
 #include <iostream>
 #include <thread>
 #include "System.h"
-#include "part.h"
+#include "Part.h"
 #include "vm_declarations.h"
 #include "ProcessTest.h"
 #include "SystemTest.h"
@@ -12,7 +13,10 @@
 //#define VM_SPACE_SIZE (10000)
 //#define PMT_SPACE_SIZE (3000)
 #define VM_SPACE_SIZE (250)
-#define PMT_SPACE_SIZE (18)
+#ifndef VM_PT_LEVELS
+#define VM_PT_LEVELS 2
+#endif
+#define PMT_SPACE_SIZE (18 + 2 * (VM_PT_LEVELS - 2)) // Each level locks two more frames (see KS_MIN_FRAMES)
 #define N_PROCESS (5)
 #define PERIODIC_JOB_COST (1)
 
@@ -29,16 +33,21 @@ int main(int argc, char **argv) {
 
     Partition part("partition1.ini");
 
-    uint64_t size = (VM_SPACE_SIZE + 2) * PAGE_SIZE;
+    // Both spaces can be sized from the command line (user space, then page
+    // table space), e.g. to give free frames enough room for magazines:
+    PageNum vmSpaceSize = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : VM_SPACE_SIZE;
+    PageNum pmtSpaceSize = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : PMT_SPACE_SIZE;
+
+    uint64_t size = (vmSpaceSize + 2) * PAGE_SIZE;
     PhysicalAddress vmSpace = (PhysicalAddress ) new char[size];
     PhysicalAddress alignedVmSpace = alignPointer(vmSpace);
 
-    size = (PMT_SPACE_SIZE + 2) * PAGE_SIZE;
+    size = (pmtSpaceSize + 2) * PAGE_SIZE;
     PhysicalAddress pmtSpace = (PhysicalAddress ) new char[size];
     PhysicalAddress alignedPmtSpace = alignPointer(pmtSpace);
 
-    System system(alignedVmSpace, VM_SPACE_SIZE, alignedPmtSpace, PMT_SPACE_SIZE, &part);
-    SystemTest systemTest(system, alignedVmSpace, VM_SPACE_SIZE);
+    System system(alignedVmSpace, vmSpaceSize, alignedPmtSpace, pmtSpaceSize, &part);
+    SystemTest systemTest(system, alignedVmSpace, vmSpaceSize);
     ProcessTest* process[N_PROCESS];
     std::thread *threads[N_PROCESS];
 
@@ -2,7 +2,12 @@
 
 typedef unsigned long PageNum;
 
+// Define VM_WIDE_ADDRESSES for address spaces wider than 32 bits (see VmGeometry.hpp)
+#ifdef VM_WIDE_ADDRESSES
+typedef unsigned long long VirtualAddress;
+#else
 typedef unsigned long VirtualAddress;
+#endif
 
 typedef void* PhysicalAddress;
 
@@ -14,4 +19,9 @@ enum AccessType {READ, WRITE, READ_WRITE, EXECUTE};
 
 typedef unsigned ProcessId;
 
-#define PAGE_SIZE 1024
\ No newline at end of file
+// Page size is 2^VM_PAGE_BITS bytes (10 = 1 KiB, 12 = 4 KiB, 14 = 16 KiB)
+#ifndef VM_PAGE_BITS
+#define VM_PAGE_BITS 10
+#endif
+
+#define PAGE_SIZE (1 << VM_PAGE_BITS)
\ No newline at end of file